@@ -5,6 +5,12 @@
 #include <atomic>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "driver/rmt.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
 #include <FS.h>
 #include <SPIFFS.h>
 #include "json.h"
@@ -15,964 +21,5085 @@
 using namespace std;
 
 #define JSON_FILE "/settings.json"
+#define SERIAL_BAUD 921600
+#define SERIAL_RX_BUFFER 4096
 
 #define LED_PIN 23
-#define LED_COUNT 14
-Adafruit_NeoPixel strip(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
 
-#define fo4 for (uint8_t i = 0; i < 4; i++)
-#define fo6 for (uint8_t i = 0; i < 6; i++)
-#define fo10 for (uint8_t i = 0; i < 1; i++)
-
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
-#define OLED_RESET -1
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+// Pads wired and scanned. piezoPins, padMap, padNotes and the settings.json
+// "pads" list always describe the whole NUM_SENSORS kit; only the first
+// NUM_PADS are sampled, get a render task and can be picked in menus.
+#ifndef NUM_PADS
+#define NUM_PADS 1
+#endif
+#ifndef PAD_LEDS
+#define PAD_LEDS 14 // LEDs per pad
+#endif
 
-const int NUM_SENSORS = 10;
-int piezoPins[NUM_SENSORS] = {35, 35, 39, 36, 27, 13, 14, 4, 2, 15};
-struct LedTaskParams
+// One entry per physical strip. Every channel gets its own GPIO and RMT
+// channel and all of them are clocked out at the same time, so a frame costs
+// the time of the longest strip instead of the sum of all strips: a WS2812
+// takes 30 us, so 10 pads x 30 LEDs is 9 ms (~105 fps) on one channel and
+// 4.5 ms (~210 fps) on two. Pads are chained PADS_PER_CHANNEL to a channel.
+// Every GPIO of the current board is taken, so extra channels need their
+// pins from build_flags (LED_PIN_2 ...).
+#ifndef LED_CHANNELS
+#define LED_CHANNELS 1
+#endif
+static_assert(LED_CHANNELS >= 1 && LED_CHANNELS <= 4, "ledChannelConfig lists up to 4 channels");
+#define PADS_PER_CHANNEL ((NUM_PADS + LED_CHANNELS - 1) / LED_CHANNELS)
+struct LedChannelConfig
 {
-    uint8_t piezoPin;
-    int ledStart;
-    int ledCount;
+    uint8_t pin;
+    uint16_t count;
 };
-LedTaskParams taskParams[NUM_SENSORS];
-TaskHandle_t ledTaskHandles[NUM_SENSORS];
+// LEDs on channel `ch`: its share of the wired pads
+constexpr uint16_t channelLeds(uint8_t ch)
+{
+    return (NUM_PADS > ch * PADS_PER_CHANNEL
+                ? (NUM_PADS - ch * PADS_PER_CHANNEL < PADS_PER_CHANNEL ? NUM_PADS - ch * PADS_PER_CHANNEL
+                                                                       : PADS_PER_CHANNEL)
+                : 0) *
+           PAD_LEDS;
+}
+const LedChannelConfig ledChannelConfig[LED_CHANNELS] = {
+    {LED_PIN, channelLeds(0)},
+#if LED_CHANNELS > 1
+    {LED_PIN_2, channelLeds(1)},
+#endif
+#if LED_CHANNELS > 2
+    {LED_PIN_3, channelLeds(2)},
+#endif
+#if LED_CHANNELS > 3
+    {LED_PIN_4, channelLeds(3)},
+#endif
+};
+static_assert(LED_CHANNELS <= RMT_CHANNEL_MAX, "one RMT channel per LED channel");
 
-const uint8_t presetPins[6] = {26, 25, 33, 32, 19, 18};
-atomic<bool> presetState[6];
-// const uint8_t btnPins[4] = {12, 13, 14, 27};
-const uint8_t btnPins[4] = {12, 17, 16, 5};
+// WS2812 bit timings in ns, RMT runs at 80 MHz / 2 = 25 ns per tick
+#define WS2812_T0H_NS 350
+#define WS2812_T0L_NS 1000
+#define WS2812_T1H_NS 1000
+#define WS2812_T1L_NS 350
+#define WS2812_RESET_US 300
+static rmt_item32_t ws2812Bit0, ws2812Bit1;
 
-atomic<bool> buttonState[4];
+// WS2812 current model: each colour channel draws up to LED_MA_FULL at 255,
+// linear in the byte, plus LED_MA_IDLE per LED for its driver. The budget is
+// LED_POWER_LIMIT_MA unless settings.json has "power_limit_ma" (0 = no limit).
+#define LED_MA_FULL 20
+#define LED_MA_IDLE 1
+#ifndef LED_POWER_LIMIT_MA
+#define LED_POWER_LIMIT_MA 4000
+#endif
 
-enum btn
+static void IRAM_ATTR ws2812Translate(const void *src, rmt_item32_t *dest, size_t srcSize,
+                                      size_t wantedNum, size_t *translatedSize, size_t *itemNum)
 {
-    up,
-    down,
-    ok,
-    back
-};
-enum MenuState
+    if (src == NULL || dest == NULL)
+    {
+        *translatedSize = 0;
+        *itemNum = 0;
+        return;
+    }
+    const uint8_t *psrc = (const uint8_t *)src;
+    size_t size = 0, num = 0;
+    while (size < srcSize && num < wantedNum)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+            dest[num++].val = (*psrc & (1 << bit)) ? ws2812Bit1.val : ws2812Bit0.val;
+        size++;
+        psrc++;
+    }
+    *translatedSize = size;
+    *itemNum = num;
+}
+
+class LedSegment;
+void recordHitLatency(uint32_t us);
+
+// Per-effect frame cost. Each frame records compute time (beginFrame() to
+// show()), show time (show() until the output task has it on the wire) and
+// the interval since the segment's previous frame of the same effect into
+// power-of-two histograms: bucket 0 is < 64 us, bucket b covers
+// [32 << b, 64 << b) us, the last bucket is open ended.
+enum EffectId
 {
-    MENU_MAIN,
-    HITMENU,
-    BASEMENU,
-    RGB_SCREEN,
-    SELECTED_RGB,
-    SELECTED_BASE,
-    SELECTED_HIT,
-    MEM_SCREEN
+    FX_HIT_RAINBOW_CHASE,
+    FX_HIT_RAINBOW,
+    FX_HIT_CHASE,
+    FX_HIT_FADE,
+    FX_BASE_RAINBOW_STROBE,
+    FX_BASE_STROBE,
+    FX_BASE_RAINBOW,
+    FX_BASE_SOLID,
+    FX_BASE_AUDIO,
+    FX_BASE_HEARTBEAT,
+    FX_BASE_EXTERNAL,
+    FX_BASE_VM,
+    FX_HIT_VM,
+    FX_COUNT,
+    FX_NONE = 0xFF
 };
-std::atomic<MenuState> currentMenu{MENU_MAIN};
-std::atomic<int> selectedMainIndex{0};
-constexpr int menuItemCount = 2;
-enum class MainMenu
+const char *effectNames[FX_COUNT] = {
+    "hit rainbow-chase",
+    "hit rainbow",
+    "hit chase",
+    "hit fade",
+    "base rainbow-strobe",
+    "base strobe",
+    "base rainbow",
+    "base solid",
+    "base audio",
+    "base heartbeat",
+    "base external",
+    "base program",
+    "hit program"};
+#define FX_HIST_BUCKETS 12
+struct EffectStats
 {
-    BASE,
-    HIT
+    uint32_t frames;
+    uint32_t computeMaxUs, showMaxUs;
+    uint32_t compute[FX_HIST_BUCKETS], show[FX_HIST_BUCKETS], interval[FX_HIST_BUCKETS];
 };
-const char *mainMenuItems[menuItemCount] = {
-    "Base Color",
-    "Hit Color"};
+EffectStats effectStats[FX_COUNT];
+portMUX_TYPE effectStatsMux = portMUX_INITIALIZER_UNLOCKED;
 
-std::atomic<int> selectedHitIndex{0};
-constexpr int hitItemCount = 5; // 2 lock or 5 adv
-enum class HitMenu
+uint8_t histBucket(uint32_t us)
 {
-    COLOR,
-    BRIGHTNESS,
-    TAIL,
-    CHASE,
-    RAINBOW
-};
-const char *hitItems[hitItemCount] = {
-    "Color",
-    "Brightness",
-    "Tail",
-    "Chase",
-    "Rainbow",
-};
-
-std::atomic<int> selectedBaseIndex{0};
-constexpr int baseItemCount = 5;
-enum class BaseMenu
+    if (us < 64)
+        return 0;
+    return min(FX_HIST_BUCKETS - 1, 32 - __builtin_clz(us >> 6));
+}
+void recordEffectFrame(uint8_t effect, uint32_t computeUs, uint32_t showUs, uint32_t intervalUs)
 {
-    COLOR,
-    BRIGHTNESS,
-    SPEED,
-    STROBE,
-    RAINBOW
-
-};
-const char *baseItems[baseItemCount] = {
-    "Color",
-    "Brightness",
-    "Speed",
-    "Strobe",
-    "Rainbow"};
-
-std::atomic<int> selectedRGBIndex{0};
-constexpr int RGBItemCount = 3;
-const char *RGBItems[RGBItemCount] = {
-    "Red",
-    "Green",
-    "Blue"};
+    if (effect >= FX_COUNT)
+        return;
+    portENTER_CRITICAL(&effectStatsMux);
+    EffectStats &e = effectStats[effect];
+    e.frames++;
+    e.compute[histBucket(computeUs)]++;
+    e.show[histBucket(showUs)]++;
+    if (intervalUs)
+        e.interval[histBucket(intervalUs)]++;
+    if (computeUs > e.computeMaxUs)
+        e.computeMaxUs = computeUs;
+    if (showUs > e.showMaxUs)
+        e.showMaxUs = showUs;
+    portEXIT_CRITICAL(&effectStatsMux);
+}
+void printHistogram(const char *label, const uint32_t *hist)
+{
+    Serial.print(label);
+    for (uint8_t b = 0; b < FX_HIST_BUCKETS; b++)
+    {
+        Serial.print(' ');
+        Serial.print(hist[b]);
+    }
+    Serial.println();
+}
+void printEffectStats()
+{
+    Serial.println("=== Effects ===");
+    Serial.print("buckets <us:");
+    for (uint8_t b = 0; b < FX_HIST_BUCKETS - 1; b++)
+    {
+        Serial.print(' ');
+        Serial.print(64UL << b);
+    }
+    Serial.println(" inf");
+    for (uint8_t fx = 0; fx < FX_COUNT; fx++)
+    {
+        EffectStats e;
+        portENTER_CRITICAL(&effectStatsMux);
+        e = effectStats[fx];
+        portEXIT_CRITICAL(&effectStatsMux);
+        if (e.frames == 0)
+            continue;
+        Serial.printf("%s: %u frames, compute max %u us, show max %u us\n", effectNames[fx], e.frames, e.computeMaxUs, e.showMaxUs);
+        printHistogram("  compute ", e.compute);
+        printHistogram("  show    ", e.show);
+        printHistogram("  interval", e.interval);
+    }
+    Serial.println("================");
+}
 
-class HitData
+// Owns the pixel memory of every channel. Segments draw unscaled RGB into
+// `raw` and commit() a finished frame into `frame`, which wakes the output
+// task. Its show() scales each segment by its brightness into the GRB
+// `wire` buffer and starts all RMT channels before waiting on any of them,
+// so every segment committed since the last frame goes out in one show()
+// however many pads are drawing.
+class LedOutput
 {
 public:
-    atomic<uint8_t> red{255}, blue{255}, green{255}, tail{3};
-    atomic<float> brightness{100};
+    uint8_t *raw[LED_CHANNELS];
+    uint8_t *wire[LED_CHANNELS];
+    uint16_t channelOffset[LED_CHANNELS]; // channels laid end to end
+    uint16_t totalPixels = 0;
+    TaskHandle_t task = NULL; // ledOutputTask
 
-    atomic<bool> chase{0}, rainbow{0};
+    void begin()
+    {
+        mutex = xSemaphoreCreateMutex();
+        uint32_t ticksPerUs = 40;
+        ws2812Bit0 = {{{WS2812_T0H_NS * ticksPerUs / 1000, 1, WS2812_T0L_NS * ticksPerUs / 1000, 0}}};
+        ws2812Bit1 = {{{WS2812_T1H_NS * ticksPerUs / 1000, 1, WS2812_T1L_NS * ticksPerUs / 1000, 0}}};
+        for (uint8_t ch = 0; ch < LED_CHANNELS; ch++)
+        {
+            size_t bytes = ledChannelConfig[ch].count * 3;
+            channelOffset[ch] = totalPixels;
+            totalPixels += ledChannelConfig[ch].count;
+            raw[ch] = (uint8_t *)calloc(bytes, 1);
+            frame[ch] = (uint8_t *)calloc(bytes, 1);
+            wire[ch] = (uint8_t *)calloc(bytes, 1);
+
+            rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)ledChannelConfig[ch].pin, (rmt_channel_t)ch);
+            config.clk_div = 2;
+            rmt_config(&config);
+            rmt_driver_install((rmt_channel_t)ch, 0, 0);
+            rmt_translator_init((rmt_channel_t)ch, ws2812Translate);
+        }
+    }
+    // the segment's slot, 0xFF if all are taken
+    uint8_t attach(LedSegment *segment)
+    {
+        if (segmentCount >= NUM_SEGMENTS)
+            return 0xFF;
+        segments[segmentCount] = segment;
+        return segmentCount++;
+    }
+    void commit(const LedSegment &segment, uint8_t effect, uint32_t computeUs, uint32_t intervalUs);
+    // a frame even if no segment changed, e.g. for a new idle level
+    void request()
+    {
+        if (task)
+            xTaskNotifyGive(task);
+    }
+    void show();
+
+private:
+    static const uint8_t NUM_SEGMENTS = 16;
+    // a slot's last committed frame: how to scale it, and its effect stats
+    // and hit until it is on the wire
+    struct Committed
+    {
+        uint8_t brightness;
+        bool composite;
+        uint8_t effect;
+        uint32_t computeUs, intervalUs, at, hitTime;
+    };
+    LedSegment *segments[NUM_SEGMENTS];
+    uint8_t segmentCount = 0;
+    uint8_t *frame[LED_CHANNELS];
+    Committed committed[NUM_SEGMENTS];
+    uint16_t dirty = 0; // slots committed since the last show()
+    portMUX_TYPE commitMux = portMUX_INITIALIZER_UNLOCKED;
+    SemaphoreHandle_t mutex = NULL;
+    uint32_t lastShowEnd = 0;
+    bool shown = false;
+    uint16_t limitGain = 256; // power limiter, 256 = unlimited
+    uint32_t limitFrame(uint32_t sum);
 };
-class BaseData
+LedOutput ledOutput;
+
+// A pad's slice of one channel. Mirrors the Adafruit_NeoPixel calls the
+// effects already use, with indexes relative to the segment.
+class LedSegment
 {
 public:
-    atomic<uint8_t> red{255}, blue{0}, green{0}, speed{2};
-    atomic<float> brightness{100};
-    atomic<bool> strobe{0}, rainbow{0};
+    uint8_t channel = 0;
+    uint16_t start = 0, count = 0;
+    uint8_t brightness = 255;
+    uint32_t hitTime = 0; // detection time of a hit not yet on the LEDs
+    uint8_t effect = FX_NONE;
+    uint32_t frameStart = 0, lastShow = 0;
+    bool composite = false; // unlit pixels show the external frame
+    uint8_t *pixels = NULL; // this segment's RGB in the channel's raw buffer
+    uint8_t slot = 0xFF;    // in LedOutput, 0xFF off-screen
+
+    void attach(uint8_t ch, uint16_t first, uint16_t n)
+    {
+        channel = ch;
+        start = first;
+        count = n;
+        pixels = &ledOutput.raw[ch][first * 3];
+        slot = ledOutput.attach(this);
+    }
+    // draw into `buf` instead, off-screen (show() only records the stats)
+    void attachBuffer(uint8_t *buf, uint16_t n)
+    {
+        count = n;
+        pixels = buf;
+    }
+    uint16_t numPixels() const { return count; }
+    void setBrightness(uint8_t b) { brightness = b; }
+    void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)
+    {
+        if (n >= count)
+            return;
+        uint8_t *p = &pixels[n * 3];
+        p[0] = r;
+        p[1] = g;
+        p[2] = b;
+    }
+    void setPixelColor(uint16_t n, uint32_t c)
+    {
+        setPixelColor(n, (uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c);
+    }
+    uint32_t getPixelColor(uint16_t n) const
+    {
+        if (n >= count)
+            return 0;
+        const uint8_t *p = &pixels[n * 3];
+        return (uint32_t)p[0] << 16 | p[1] << 8 | p[2];
+    }
+    void clear() { memset(pixels, 0, count * 3); }
+    // start timing a frame of `fx`, call before drawing it
+    void beginFrame(uint8_t fx)
+    {
+        if (fx != effect)
+            lastShow = 0;
+        effect = fx;
+        frameStart = micros();
+    }
+    // the frame is done: hand it to the output task, which records its
+    // show time and hit latency once it is on the wire
+    void show()
+    {
+        uint32_t now = micros();
+        uint8_t fx = frameStart ? effect : FX_NONE;
+        uint32_t computeUs = now - frameStart, intervalUs = lastShow ? now - lastShow : 0;
+        if (frameStart)
+        {
+            lastShow = now;
+            frameStart = 0;
+        }
+        if (slot != 0xFF)
+            ledOutput.commit(*this, fx, computeUs, intervalUs);
+        else
+            recordEffectFrame(fx, computeUs, 0, intervalUs);
+        hitTime = 0;
+    }
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return Adafruit_NeoPixel::Color(r, g, b); }
+    static uint32_t ColorHSV(uint16_t hue, uint8_t sat = 255, uint8_t val = 255) { return Adafruit_NeoPixel::ColorHSV(hue, sat, val); }
+    static uint32_t gamma32(uint32_t c) { return Adafruit_NeoPixel::gamma32(c); }
 };
-HitData hitData;
-BaseData baseData;
 
-atomic<bool> hit(0), base(0);
-String mem_screen_data;
-void printAllData();
-void updateSelectedIndex(std::atomic<int> &index, int itemCount, bool moveUp)
-{
-    int newIndex = index.load() + (moveUp ? -1 : 1);
-    if (newIndex < 0)
-        newIndex = 0;
-    else if (newIndex >= itemCount)
-        newIndex = itemCount - 1;
-    index.store(newIndex);
-}
-void savePresetToJson(uint8_t i)
+// External render mode: a host streams RGB frames over serial (see
+// CMD_PIXELS). Chunks land in the back buffer; the chunk flagged as the end
+// of a frame swaps it to the front. A frame that is superseded before it is
+// complete, or arrives with an older sequence number, is dropped. Pixels are
+// addressed across all channels laid end to end (LedOutput::channelOffset).
+class ExternalFrames
 {
-    JsonDocument doc;
+public:
+    atomic<uint32_t> presented{0}, dropped{0}, fps{0};
 
-    if (SPIFFS.exists(JSON_FILE))
+    void begin(uint16_t pixels)
     {
-        File file = SPIFFS.open(JSON_FILE, FILE_READ);
-        if (file)
+        count = pixels;
+        buf[0] = (uint8_t *)calloc(count * 3, 1);
+        buf[1] = (uint8_t *)calloc(count * 3, 1);
+    }
+    // serialTask only
+    void write(uint16_t seq, uint16_t offset, const uint8_t *rgb, uint16_t n, bool endOfFrame)
+    {
+        if (!backActive || seq != backSeq)
         {
-            DeserializationError error = deserializeJson(doc, file);
-            file.close();
-            if (error)
+            if (backActive)
+                dropped.store(dropped.load() + 1);
+            backActive = false;
+            int16_t age = seq - frontSeq;
+            if (presented.load() && age <= 0 && age > -1000) // far behind: host restarted
             {
-                Serial.println("Failed to parse existing JSON");
-                doc.clear();
+                dropped.store(dropped.load() + 1);
                 return;
             }
+            // partial updates start from what is on screen
+            memcpy(buf[front ^ 1], buf[front], count * 3);
+            backActive = true;
+            backSeq = seq;
+        }
+        if (offset < count)
+            memcpy(buf[front ^ 1] + offset * 3, rgb, min<uint16_t>(n, count - offset) * 3);
+        if (endOfFrame)
+        {
+            portENTER_CRITICAL(&mux);
+            front ^= 1;
+            portEXIT_CRITICAL(&mux);
+            frontSeq = seq;
+            backActive = false;
+            presented.store(presented.load() + 1);
+            framesThisSecond++;
         }
     }
-    if (i < 3)
+    // serialTask, once per loop
+    void tick(uint32_t now)
     {
-        JsonArray baseArray = doc["base"].as<JsonArray>();
-        JsonObject base_item = baseArray[i];
-        base_item["red"] = baseData.red.load();
-        base_item["blue"] = baseData.blue.load();
-        base_item["green"] = baseData.green.load();
-        base_item["brightness"] = baseData.brightness.load();
-        base_item["speed"] = baseData.speed.load();
-        base_item["strobe"] = baseData.strobe.load();
-        base_item["rainbow"] = baseData.rainbow.load();
+        if (now - fpsWindow >= 1000)
+        {
+            fps.store(framesThisSecond);
+            framesThisSecond = 0;
+            fpsWindow = now;
+        }
     }
-    if (i > 2)
+    // copy `n` pixels from global index `first` of the front frame, pixels
+    // the frame does not cover (or all of them before the first frame) are black
+    void read(uint16_t first, uint8_t *rgb, uint16_t n)
     {
-        uint8_t index = i - 3;
-        Serial.println("sss");
-        JsonArray hitArray = doc["hit"].as<JsonArray>();
-        JsonObject hit_item = hitArray[index];
-        hit_item["red"] = hitData.red.load();
-        hit_item["blue"] = hitData.blue.load();
-        hit_item["green"] = hitData.green.load();
-        hit_item["brightness"] = hitData.brightness.load();
-        hit_item["tail"] = hitData.tail.load();
-        hit_item["chase"] = hitData.chase.load();
-        hit_item["rainbow"] = hitData.rainbow.load();
+        uint16_t copied = buf[0] == NULL || first >= count ? 0 : min<uint16_t>(n, count - first);
+        if (copied)
+        {
+            portENTER_CRITICAL(&mux);
+            memcpy(rgb, buf[front] + first * 3, copied * 3);
+            portEXIT_CRITICAL(&mux);
+        }
+        memset(rgb + copied * 3, 0, (n - copied) * 3);
     }
+    // for LedOutput::show(), call between lock() and unlock()
+    const uint8_t *frontPixels(uint16_t first) const { return buf[front] + first * 3; }
+    void lock() { portENTER_CRITICAL(&mux); }
+    void unlock() { portEXIT_CRITICAL(&mux); }
 
-    File file = SPIFFS.open(JSON_FILE, FILE_WRITE);
-    if (!file)
+private:
+    uint8_t *buf[2] = {NULL, NULL};
+    uint8_t front = 0;
+    uint16_t count = 0, backSeq = 0, frontSeq = 0;
+    bool backActive = false;
+    uint32_t framesThisSecond = 0, fpsWindow = 0;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+ExternalFrames extFrames;
+
+// output level of the idle governor, applied on top of every segment
+atomic<uint8_t> idleLevel{255};
+atomic<uint32_t> powerLimitMa{LED_POWER_LIMIT_MA}, powerEstimateMa{0}, powerLimitedFrames{0};
+atomic<uint16_t> powerGain{256};
+atomic<uint32_t> wakeAtUs{0}, wakeLatencyLastUs{0}, wakeLatencyMaxUs{0};
+atomic<uint32_t> ledWireUs{0}; // last frame's time on the wire, all channels
+
+// Boot timeline: micros() since reset at each stage of the staged boot,
+// printed once the background stages are done and with printAllData()
+#define BOOT_STAGES 12
+struct BootStage
+{
+    const char *name;
+    uint32_t us;
+};
+BootStage bootStages[BOOT_STAGES];
+atomic<uint8_t> bootStageCount{0};
+void bootMark(const char *name)
+{
+    uint8_t i = bootStageCount.fetch_add(1);
+    if (i < BOOT_STAGES)
+        bootStages[i] = {name, (uint32_t)micros()};
+}
+void printBootTimeline()
+{
+    uint8_t count = min<uint8_t>(bootStageCount.load(), BOOT_STAGES);
+    for (uint8_t i = 0; i < count; i++)
+        Serial.printf("%-12s %8u us\n", bootStages[i].name, (unsigned)bootStages[i].us);
+}
+
+// Power limiter, fed with the byte sum show() collects while converting the
+// frame. The gain it leaves is folded into the next frame's scale, so a
+// frame within budget costs nothing extra. A frame over budget is scaled
+// down in place once (the only second pass, on the first loud frame) and
+// the gain drops to match, then creeps back up by 1/64 per frame while
+// there is headroom. Returns the estimated current as sent.
+uint32_t LedOutput::limitFrame(uint32_t sum)
+{
+    uint32_t idle = totalPixels * LED_MA_IDLE, limit = powerLimitMa.load();
+    uint32_t ma = idle + sum * LED_MA_FULL / 255;
+    if (limit && ma > limit)
     {
-        Serial.println("Failed to open file for writing");
-        return;
+        uint32_t budget = limit > idle ? limit - idle : 0;
+        uint16_t k = ma > idle ? budget * 256 / (ma - idle) : 0; // < 256
+        for (uint8_t ch = 0; ch < LED_CHANNELS; ch++)
+            for (uint16_t i = 0; i < ledChannelConfig[ch].count * 3; i++)
+                wire[ch][i] = wire[ch][i] * k >> 8;
+        limitGain = max<uint16_t>(1, limitGain * k >> 8);
+        ma = idle + (sum * k >> 8) * LED_MA_FULL / 255;
+        powerLimitedFrames.fetch_add(1);
     }
-
-    serializeJsonPretty(doc, file);
-    file.close();
-    // Serial.println("Preset saved.");
-    // printAllData();
-    // Serial.println("✅ settings.json contents:");
-    // serializeJsonPretty(doc, Serial);
+    else if (limitGain < 256)
+    {
+        // release only if the frame would still fit at the raised gain
+        uint16_t next = min<uint16_t>(256, limitGain + 4);
+        if (!limit || idle + (uint64_t)sum * next / limitGain * LED_MA_FULL / 255 <= limit)
+            limitGain = next;
+    }
+    powerGain.store(limitGain);
+    return ma;
 }
-void loadPresetToJson(uint8_t i)
+
+// the segment's owner, after drawing a frame. A frame not yet sent is
+// replaced; its hit stays pending so the latency counts from the first.
+void LedOutput::commit(const LedSegment &segment, uint8_t effect, uint32_t computeUs, uint32_t intervalUs)
 {
-    JsonDocument doc;
+    portENTER_CRITICAL(&commitMux);
+    memcpy(&frame[segment.channel][segment.start * 3], segment.pixels, segment.count * 3);
+    Committed &c = committed[segment.slot];
+    c.brightness = segment.brightness;
+    c.composite = segment.composite;
+    c.effect = effect;
+    c.computeUs = computeUs;
+    c.intervalUs = intervalUs;
+    c.at = micros();
+    if (!(dirty & 1 << segment.slot) || !c.hitTime)
+        c.hitTime = segment.hitTime;
+    dirty |= 1 << segment.slot;
+    portEXIT_CRITICAL(&commitMux);
+    request();
+}
 
-    if (SPIFFS.exists(JSON_FILE))
+// ledOutputTask: one frame of every segment's last committed pixels
+void LedOutput::show()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Committed sent[NUM_SEGMENTS];
+    portENTER_CRITICAL(&commitMux);
+    uint16_t sentMask = dirty;
+    dirty = 0;
+    memcpy(sent, committed, segmentCount * sizeof(Committed));
+    portEXIT_CRITICAL(&commitMux);
+    uint16_t level = (idleLevel.load() + 1) * limitGain >> 8;
+    uint32_t sum = 0; // every byte sent, for the power limiter
+    for (uint8_t s = 0; s < segmentCount; s++)
     {
-        File file = SPIFFS.open(JSON_FILE, FILE_READ);
-        if (file)
+        const LedSegment *seg = segments[s];
+        const uint8_t *src = &frame[seg->channel][seg->start * 3];
+        uint8_t *dst = &wire[seg->channel][seg->start * 3];
+        uint16_t scale = (sent[s].brightness + 1) * level >> 8;
+        portENTER_CRITICAL(&commitMux);
+        if (sent[s].composite)
         {
-            DeserializationError error = deserializeJson(doc, file);
-            file.close();
-            if (error)
+            extFrames.lock();
+            const uint8_t *under = extFrames.frontPixels(channelOffset[seg->channel] + seg->start);
+            for (uint16_t i = 0; i < seg->count; i++, src += 3, dst += 3, under += 3)
             {
-                Serial.println("Failed to parse existing JSON");
-                doc.clear();
-                return;
+                const uint8_t *px = (src[0] | src[1] | src[2]) ? src : under;
+                uint16_t k = px == src ? scale : level;
+                dst[0] = (px[1] * k) >> 8;
+                dst[1] = (px[0] * k) >> 8;
+                dst[2] = (px[2] * k) >> 8;
+                sum += dst[0] + dst[1] + dst[2];
+            }
+            extFrames.unlock();
+        }
+        else
+        {
+            for (uint16_t i = 0; i < seg->count; i++, src += 3, dst += 3)
+            {
+                dst[0] = (src[1] * scale) >> 8;
+                dst[1] = (src[0] * scale) >> 8;
+                dst[2] = (src[2] * scale) >> 8;
+                sum += dst[0] + dst[1] + dst[2];
             }
         }
+        portEXIT_CRITICAL(&commitMux);
     }
-    if (i < 3)
+    powerEstimateMa.store(limitFrame(sum));
+    while (micros() - lastShowEnd < WS2812_RESET_US)
+        ;
+    uint32_t wireStart = micros();
+    for (uint8_t ch = 0; ch < LED_CHANNELS; ch++)
+        rmt_write_sample((rmt_channel_t)ch, wire[ch], ledChannelConfig[ch].count * 3, false);
+    for (uint8_t ch = 0; ch < LED_CHANNELS; ch++)
+        rmt_wait_tx_done((rmt_channel_t)ch, portMAX_DELAY);
+    lastShowEnd = micros();
+    ledWireUs.store(lastShowEnd - wireStart);
+    uint32_t wokeAt = wakeAtUs.exchange(0);
+    if (wokeAt)
     {
-        JsonArray baseArray = doc["base"].as<JsonArray>();
-        JsonObject base_item = baseArray[i];
-        baseData.red.store(base_item["red"]);
-        baseData.blue.store(base_item["blue"]);
-        baseData.green.store(base_item["green"]);
-        baseData.brightness.store(base_item["brightness"]);
-        baseData.speed.store(base_item["speed"]);
-        baseData.strobe.store(base_item["strobe"]);
-        baseData.rainbow.store(base_item["rainbow"]);
+        uint32_t us = lastShowEnd - wokeAt;
+        wakeLatencyLastUs.store(us);
+        if (us > wakeLatencyMaxUs.load())
+            wakeLatencyMaxUs.store(us);
     }
-    if (i > 2)
+    if (!shown)
     {
-        uint8_t index = i - 3;
-        JsonArray hitArray = doc["hit"].as<JsonArray>();
-        JsonObject hit_item = hitArray[index];
-        hitData.red.store(hit_item["red"]);
-        hitData.blue.store(hit_item["blue"]);
-        hitData.green.store(hit_item["green"]);
-        hitData.brightness.store(hit_item["brightness"]);
-        hitData.tail.store(hit_item["tail"]);
-        hitData.chase.store(hit_item["chase"]);
-        hitData.rainbow.store(hit_item["rainbow"]);
+        shown = true;
+        bootMark("first frame");
+    }
+    xSemaphoreGive(mutex);
+    for (uint8_t s = 0; s < segmentCount; s++)
+    {
+        if (!(sentMask & 1 << s))
+            continue;
+        recordEffectFrame(sent[s].effect, sent[s].computeUs, lastShowEnd - sent[s].at, sent[s].intervalUs);
+        if (sent[s].hitTime)
+            recordHitLatency(micros() - sent[s].hitTime);
     }
-    // Serial.println("Preset Loaded.");
-    // printAllData();
-    // Serial.println("✅ settings.json contents:");
-    // serializeJsonPretty(doc, Serial);
 }
-void menu_screen();
-void base_screen(int selectedWidth);
-void hit_screen(int selectedWidth);
-void rgb_screen(int selectedWidth);
-void mem_screen(String line);
-void printAllData()
+void ledOutputTask(void *pvParameters)
 {
-    Serial.println("=== HitData ===");
-    Serial.print("Red: ");
-    Serial.println(hitData.red.load());
-    Serial.print("Green: ");
-    Serial.println(hitData.green.load());
-    Serial.print("Blue: ");
-    Serial.println(hitData.blue.load());
-    Serial.print("Brightness: ");
-    Serial.println(hitData.brightness.load());
-    Serial.print("Tail: ");
-    Serial.println(hitData.tail.load());
-    Serial.print("Chase: ");
-    Serial.println(hitData.chase.load() ? "true" : "false");
-    Serial.print("Rainbow: ");
-    Serial.println(hitData.rainbow.load() ? "true" : "false");
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        ledOutput.show();
+    }
+}
 
-    Serial.println("=== BaseData ===");
-    Serial.print("Red: ");
-    Serial.println(baseData.red.load());
-    Serial.print("Green: ");
-    Serial.println(baseData.green.load());
-    Serial.print("Blue: ");
-    Serial.println(baseData.blue.load());
-    Serial.print("Brightness: ");
-    Serial.println(baseData.brightness.load());
-    Serial.print("Speed: ");
-    Serial.println(baseData.speed.load());
-    Serial.print("Strobe: ");
-    Serial.println(baseData.strobe.load() ? "true" : "false");
-    Serial.print("Rainbow: ");
-    Serial.println(baseData.rainbow.load() ? "true" : "false");
+#define fo4 for (uint8_t i = 0; i < 4; i++)
+#define fo6 for (uint8_t i = 0; i < 6; i++)
+#define fo10 for (uint8_t i = 0; i < NUM_PADS; i++)
 
-    Serial.println("================");
-}
+#define SCREEN_WIDTH 128
+#define SCREEN_HEIGHT 64
+#define OLED_RESET -1
+Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
 
-void adjustRGBValue(int direction)
+const int NUM_SENSORS = 10;
+static_assert(NUM_PADS >= 1 && NUM_PADS <= NUM_SENSORS, "NUM_PADS out of range");
+constexpr int piezoPins[NUM_SENSORS] = {35, 35, 39, 36, 27, 13, 14, 4, 2, 15};
+// true if a scanned pad's piezo sits on `pin`
+constexpr bool padUsesPin(int pin, uint8_t pad = 0)
 {
-    std::atomic<uint8_t> *colorPtr = nullptr;
+    return pad < NUM_PADS && (piezoPins[pad] == pin || padUsesPin(pin, pad + 1));
+}
+struct LedTaskParams
+{
+    uint8_t piezoPin;
+    uint8_t ledChannel;
+    int ledStart;
+    int ledCount;
+};
+// pad -> {piezo pin (filled in from piezoPins), channel, first LED, LED count}.
+// Each pad owns PAD_LEDS LEDs of its channel; entries past NUM_PADS are unused.
+#define PAD_RANGE(pad) {0, (pad) / PADS_PER_CHANNEL, (pad) % PADS_PER_CHANNEL * PAD_LEDS, PAD_LEDS}
+const LedTaskParams padMap[NUM_SENSORS] = {
+    PAD_RANGE(0),
+    PAD_RANGE(1),
+    PAD_RANGE(2),
+    PAD_RANGE(3),
+    PAD_RANGE(4),
+    PAD_RANGE(5),
+    PAD_RANGE(6),
+    PAD_RANGE(7),
+    PAD_RANGE(8),
+    PAD_RANGE(9)};
+LedTaskParams taskParams[NUM_SENSORS];
+LedSegment padSegments[NUM_SENSORS];
+TaskHandle_t ledTaskHandles[NUM_SENSORS];
 
-    if (base.load())
+// Hits travel from sensorTask to the pad's ledTask through a one-slot
+// mailbox; a newer hit overwrites one the renderer has not picked up yet.
+struct HitEvent
+{
+    uint8_t pad;
+    uint16_t level;
+    uint8_t velocity; // 1-127
+    uint32_t time;    // micros() at detection
+};
+QueueHandle_t hitQueues[NUM_SENSORS];
+// Where a hit came from. Piezo, MIDI-in and replayed hits all go through
+// dispatchHit(), so MIDI out, the render mailbox, beat clock, sequencer,
+// recorder and idle governor see every hit the same way.
+enum HitSource
+{
+    HIT_PIEZO,
+    HIT_MIDI,  // not echoed to MIDI out
+    HIT_REPLAY // not recorded again
+};
+void dispatchHit(uint8_t pad, uint16_t level, uint8_t velocity, uint32_t now, uint8_t source);
+// Hits raised on other tasks (replay) wait here for sensorTask, which
+// dispatches them with its own, so the MIDI and sequencer state stays on
+// one task.
+#define HIT_INBOX 8
+struct QueuedHit
+{
+    uint8_t pad, velocity, source;
+};
+QueueHandle_t hitInbox = NULL;
+bool queueHit(uint8_t pad, uint8_t velocity, uint8_t source);
+const uint32_t hitCooldown = 50;
+// Piezo front end. Pins are plain analog inputs (a pull-up would bias the
+// piezo towards the rail) at PIEZO_ATTENUATION, 11 dB covering 0-3.1 V.
+// Each pad tracks its resting level as an exponential average over
+// 2^PIEZO_BASELINE_SHIFT samples (~4 s at the 1 kHz scan), 16.16 fixed point;
+// detection, velocity and calibration all see the level above it, so
+// sensitivity holds while offset drifts with temperature over a gig. The
+// average holds still during strikes, but a level that stays above the
+// threshold for PIEZO_HOLD_MS is an offset step and is tracked anyway.
+#define PIEZO_ATTENUATION ADC_11db
+#define PIEZO_BASELINE_SHIFT 12
+#define PIEZO_HOLD_MS 250
+void piezoAnalogMode()
+{
+    fo10
     {
-        if (selectedRGBIndex.load() == 0)
-            colorPtr = &baseData.red;
-        else if (selectedRGBIndex.load() == 1)
-            colorPtr = &baseData.green;
-        else if (selectedRGBIndex.load() == 2)
-            colorPtr = &baseData.blue;
+        pinMode(piezoPins[i], ANALOG);
+        analogSetPinAttenuation(piezoPins[i], PIEZO_ATTENUATION);
     }
-    else if (hit.load())
+}
+atomic<uint32_t> hitLatencyLastUs{0}, hitLatencyMaxUs{0};
+// hit recorder state, see recorderTask
+enum RecState
+{
+    REC_IDLE,
+    REC_RECORDING,
+    REC_REPLAYING
+};
+atomic<uint8_t> recState{REC_IDLE};
+atomic<uint32_t> recEvents{0}, recDropped{0};
+
+// Idle governor stages, see idleService()
+enum IdleStage
+{
+    IDLE_ACTIVE,
+    IDLE_DIM,   // lower clock, dimmed LEDs and OLED, slow OLED refresh
+    IDLE_SLEEP, // LEDs and OLED off, light sleep until a pad, button or MIDI
+};
+atomic<uint8_t> idleStage{IDLE_ACTIVE};
+atomic<uint32_t> lastActivity{0};
+void noteActivity()
+{
+    lastActivity.store(millis());
+}
+
+// Beat clock, fed with every hit onset and with tap-tempo presses. Each
+// onset is matched to the nearest half beat of the current estimate; a match
+// nudges period and phase (a small PLL), four misses in a row re-lock to the
+// new interval. Work per hit is a handful of integer ops under a spinlock.
+class BeatClock
+{
+public:
+    static const uint32_t MIN_PERIOD = 300;  // 200 bpm
+    static const uint32_t MAX_PERIOD = 1000; // 60 bpm
+
+    void onHit(uint32_t ms)
     {
-        if (selectedRGBIndex.load() == 0)
-            colorPtr = &hitData.red;
-        else if (selectedRGBIndex.load() == 1)
-            colorPtr = &hitData.green;
-        else if (selectedRGBIndex.load() == 2)
-            colorPtr = &hitData.blue;
+        portENTER_CRITICAL(&mux);
+        uint32_t ioi = ms - lastOnset;
+        if (ioi < 60)
+        {
+            // flam or several pads at once: one onset
+            portEXIT_CRITICAL(&mux);
+            return;
+        }
+        lastOnset = ms;
+        uint32_t halfBeat = period / 2;
+        uint32_t k = (ioi + halfBeat / 2) / halfBeat;
+        int32_t ioiErr = ioi - k * halfBeat;
+        if (k >= 1 && k <= 8 && abs(ioiErr) < (int32_t)period / 8)
+        {
+            if (k <= 4)
+                period += (int32_t)(ioi * 2 / k - period) / 8;
+            // nearest beat to the onset, rounding away from the anchor both ways
+            int32_t d = ms - anchor, half = period / 2;
+            int32_t n = (d < 0 ? d - half : d + half) / (int32_t)period;
+            int32_t err = d - n * (int32_t)period;
+            anchor += n * period + err / 4;
+            misses = 0;
+            if (hits < 4)
+                hits++;
+        }
+        else if (ioi < 4 * MAX_PERIOD && ++misses >= 4)
+        {
+            while (ioi < MIN_PERIOD)
+                ioi *= 2;
+            while (ioi > MAX_PERIOD)
+                ioi /= 2;
+            period = ioi;
+            anchor = ms;
+            misses = 0;
+            hits = 1;
+        }
+        portEXIT_CRITICAL(&mux);
     }
-
-    if (colorPtr != nullptr)
+    // tap tempo: average of the last taps, a pause of 2 s starts over
+    void tap(uint32_t ms)
     {
-        colorPtr->store(colorPtr->load() + direction);
-        vTaskDelay(pdMS_TO_TICKS(500));
-        buttonState[up].store(!digitalRead(btnPins[up]));
-        buttonState[down].store(!digitalRead(btnPins[down]));
-        while ((direction == 1 ? buttonState[up].load() : buttonState[down].load()))
+        portENTER_CRITICAL(&mux);
+        uint32_t gap = ms - lastTap;
+        if (gap > 2000)
         {
-            colorPtr->store(colorPtr->load() + direction);
-            vTaskDelay(pdMS_TO_TICKS(40));
-            buttonState[up].store(!digitalRead(btnPins[up]));
-            buttonState[down].store(!digitalRead(btnPins[down]));
+            taps = 0;
+            tapPeriod = 0;
+        }
+        else
+        {
+            // running mean over up to the last four intervals
+            taps = min<uint8_t>(taps + 1, 4);
+            tapPeriod = tapPeriod + ((int32_t)gap - (int32_t)tapPeriod) / taps;
+            period = constrain(tapPeriod, MIN_PERIOD, MAX_PERIOD);
+            hits = 4;
+            misses = 0;
         }
+        anchor = ms;
+        lastTap = ms;
+        portEXIT_CRITICAL(&mux);
     }
+    bool locked() const { return hits >= 4; }
+    uint32_t bpm() const { return 60000 / period; }
+    // beats since the anchor; phase within the beat and period in ms
+    uint32_t beat(uint32_t now, uint32_t *phase, uint32_t *beatPeriod)
+    {
+        portENTER_CRITICAL(&mux);
+        uint32_t p = period, a = anchor;
+        portEXIT_CRITICAL(&mux);
+        int32_t d = now - a;
+        uint32_t index = 0;
+        if (d < 0)
+            d += p;
+        else
+            index = d / p;
+        *phase = d % p;
+        *beatPeriod = p;
+        return index;
+    }
+
+private:
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t period = 500, anchor = 0, lastOnset = 0, lastTap = 0, tapPeriod = 0;
+    uint8_t hits = 0, misses = 0, taps = 0;
+};
+BeatClock beatClock;
+
+// MIDI out. Every hit leaves as a Note On on UART2 straight from the
+// detection path, before the renderer sees it. Writes go into the UART
+// driver's TX ring (drained by its ISR), so sending never blocks: a message
+// that does not fit is dropped and counted. Note Off is sent as Note On with
+// velocity 0 so all traffic shares one running status byte (2 bytes/msg).
+#ifndef MIDI_TX_PIN
+#define MIDI_TX_PIN 0
+#endif
+#define MIDI_BAUD 31250
+#define MIDI_TX_BUFFER 256
+#define MIDI_GATE_MS 30
+uint8_t midiChannel = 9; // 0-based, GM drums on channel 10
+uint8_t padNotes[NUM_SENSORS] = {38, 38, 48, 45, 43, 36, 42, 46, 49, 51};
+uint8_t midiRunningStatus = 0;
+uint32_t midiNoteOffAt[NUM_SENSORS] = {0};
+atomic<uint32_t> midiDropped{0};
+
+// Per-pad detection, set by the calibration wizard and kept in settings.json
+// "pads": a strike counts once the level passes `threshold`, and velocity
+// runs linearly from 1 at `low` to 127 at `high` (the pad's gain).
+struct PadCal
+{
+    atomic<uint16_t> threshold{10}, low{10}, high{4095};
+};
+PadCal padCal[NUM_SENSORS];
+uint8_t hitVelocity(uint8_t pad, uint16_t level)
+{
+    const PadCal &c = padCal[pad];
+    return constrain(map(level, c.low.load(), c.high.load(), 1, 127), 1, 127);
 }
-void adjustValueHold(std::atomic<float> &value, bool (*upState)(), bool (*downState)(), int minVal, int maxVal, int step = 1)
+void setPadCal(uint8_t pad, uint16_t threshold, uint16_t low, uint16_t high)
 {
-    const unsigned long repeatDelay = 50; // ms between changes
+    high = constrain(high, 16, 4095);
+    low = min<uint16_t>(low, high - 16); // keeps map() away from a zero range
+    padCal[pad].threshold.store(min<uint16_t>(threshold, 4095));
+    padCal[pad].low.store(low);
+    padCal[pad].high.store(high);
+}
 
-    // Keep looping while button is held
-    // while (upState() || downState())
-    // {
-    if (upState())
+// Calibration wizard, one pad at a time. sensorTask feeds it every sample
+// of that pad: first the peak level over CAL_NOISE_MS of silence, then
+// CAL_STRIKES soft and CAL_STRIKES hard strikes, each taken as the peak
+// over CAL_PEAK_MS once the level clears the noise by CAL_MARGIN. The
+// threshold lands halfway between noise and the softest strike, the
+// velocity range runs from there to the mean hard strike.
+#define CAL_NOISE_MS 2000
+#define CAL_STRIKES 4
+#define CAL_PEAK_MS 15
+#define CAL_REARM_MS 150
+#define CAL_MARGIN 20
+enum CalStep
+{
+    CAL_IDLE,
+    CAL_NOISE,
+    CAL_SOFT,
+    CAL_HARD,
+    CAL_DONE
+};
+class PadCalibrator
+{
+public:
+    atomic<uint8_t> pad{0}, step{CAL_IDLE}, strikes{0};
+    atomic<uint16_t> noise{0}, soft{0}, hard{0};
+
+    // any task; sensorTask does the reset on the pad's next sample, so it
+    // never races a sample in flight
+    void start(uint8_t p)
     {
-        int newVal = value.load() + step;
-        if (newVal > maxVal)
-            newVal = maxVal;
-        value.store(newVal);
+        step.store(CAL_IDLE);
+        pad.store(p);
+        restart.store(true);
     }
-    else if (downState())
+    void cancel()
     {
-        int newVal = value.load() - step;
-        if (newVal < minVal)
-            newVal = minVal;
-        value.store(newVal);
+        restart.store(false);
+        step.store(CAL_IDLE);
     }
-    //     vTaskDelay(pdMS_TO_TICKS(repeatDelay));
-    // }
-}
-bool isUpPressed()
+    // sensorTask: one sample of pad `i`
+    void feed(uint8_t i, uint16_t level, uint32_t now)
+    {
+        if (i == pad.load() && restart.exchange(false))
+        {
+            noise.store(0);
+            soft.store(4095);
+            hard.store(0);
+            hardSum = 0;
+            inStrike = false;
+            lastStrike = now;
+            next(CAL_NOISE, now);
+        }
+        uint8_t s = step.load();
+        if (s == CAL_IDLE || s == CAL_DONE || i != pad.load())
+            return;
+        if (s == CAL_NOISE)
+        {
+            noise.store(max(noise.load(), level));
+            if (now - stepAt >= CAL_NOISE_MS)
+                next(CAL_SOFT, now);
+            return;
+        }
+        if (!inStrike)
+        {
+            if (level > noise.load() + CAL_MARGIN && now - lastStrike >= CAL_REARM_MS)
+            {
+                inStrike = true;
+                peakAt = now;
+                peak = level;
+            }
+            return;
+        }
+        peak = max(peak, level);
+        if (now - peakAt < CAL_PEAK_MS)
+            return;
+        inStrike = false;
+        lastStrike = now;
+        if (s == CAL_SOFT)
+            soft.store(min(soft.load(), peak));
+        else
+            hardSum += peak;
+        if (strikes.load() + 1 < CAL_STRIKES)
+        {
+            strikes.fetch_add(1);
+            return;
+        }
+        if (s == CAL_SOFT)
+            next(CAL_HARD, now);
+        else
+        {
+            hard.store(hardSum / CAL_STRIKES);
+            strikes.store(CAL_STRIKES);
+            step.store(CAL_DONE);
+        }
+    }
+    // threshold, low and high from a finished run
+    void result(uint16_t &threshold, uint16_t &low, uint16_t &high) const
+    {
+        threshold = max<uint16_t>(noise.load() + CAL_MARGIN / 2, (noise.load() + soft.load()) / 2);
+        low = threshold;
+        high = max<uint16_t>(hard.load(), low + 16);
+    }
+    void apply()
+    {
+        uint16_t threshold, low, high;
+        result(threshold, low, high);
+        setPadCal(pad.load(), threshold, low, high);
+        Serial.printf("Pad %u: threshold %u, velocity %u-%u\n", pad.load() + 1, threshold, low, high);
+        step.store(CAL_IDLE);
+    }
+
+private:
+    atomic<bool> restart{false};
+    // sensorTask only
+    uint32_t stepAt = 0, peakAt = 0, lastStrike = 0, hardSum = 0;
+    uint16_t peak = 0;
+    bool inStrike = false;
+
+    void next(uint8_t s, uint32_t now)
+    {
+        stepAt = now;
+        strikes.store(0);
+        step.store(s);
+    }
+};
+PadCalibrator padCalibrator;
+bool midiSend(uint8_t status, uint8_t data1, uint8_t data2)
 {
-    fo4 buttonState[i].store(!digitalRead(btnPins[i]));
-    return buttonState[up];
+    bool running = status == midiRunningStatus;
+    if (Serial2.availableForWrite() < (running ? 2 : 3))
+    {
+        midiDropped.store(midiDropped.load() + 1);
+        midiRunningStatus = 0;
+        return false;
+    }
+    uint8_t msg[3] = {status, data1, data2};
+    Serial2.write(running ? msg + 1 : msg, running ? 2 : 3);
+    midiRunningStatus = status;
+    return true;
 }
-bool isDownPressed()
+// detection path only (sensorTask)
+void midiHit(uint8_t pad, uint8_t velocity, uint32_t now)
 {
-    fo4 buttonState[i].store(!digitalRead(btnPins[i]));
-    return buttonState[down];
+    uint8_t status = 0x90 | midiChannel;
+    if (midiNoteOffAt[pad])
+        midiSend(status, padNotes[pad], 0);
+    midiSend(status, padNotes[pad], velocity);
+    midiNoteOffAt[pad] = now + MIDI_GATE_MS;
+    if (midiNoteOffAt[pad] == 0)
+        midiNoteOffAt[pad] = 1;
 }
-
-void oledTask(void *pvParameters)
+void midiService(uint32_t now)
 {
-    display.setTextSize(1);
-    display.setTextColor(SSD1306_WHITE);
-    while (true)
+    fo10
     {
-        display.clearDisplay();
-        if (currentMenu.load() == MENU_MAIN)
+        if (midiNoteOffAt[i] && (int32_t)(now - midiNoteOffAt[i]) >= 0)
         {
-            menu_screen();
+            midiSend(0x90 | midiChannel, padNotes[i], 0);
+            midiNoteOffAt[i] = 0;
         }
-        else if (currentMenu.load() == BASEMENU)
-            base_screen(0);
-        else if (currentMenu.load() == HITMENU)
-            hit_screen(0);
-        else if (currentMenu.load() == RGB_SCREEN)
-            rgb_screen(0);
-        else if (currentMenu.load() == SELECTED_RGB)
-            rgb_screen(100);
-        else if (currentMenu.load() == SELECTED_BASE)
-            base_screen(100);
-        else if (currentMenu.load() == SELECTED_HIT)
-            hit_screen(100);
-        else if (currentMenu.load() == MEM_SCREEN)
-            mem_screen(mem_screen_data);
-        display.display();
-        vTaskDelay(pdMS_TO_TICKS(1));
     }
 }
-
-void buttonTask(void *pvParameters)
+// MIDI in. An external drum module on UART2 RX triggers the same HitEvents
+// as the piezos. The parser is a byte-at-a-time state machine with no
+// buffers beyond two data bytes: running status is kept across messages,
+// realtime bytes are skipped without disturbing it, system messages cancel it.
+// Both MIDI pins are strapping pins (GPIO 0 must be high at reset, GPIO 15
+// only silences the boot log), which the idle-high UART lines satisfy. No
+// other GPIO is free on this board: GPIO 15 is also pad 10's piezo, so MIDI
+// in is off by default once all ten pads are scanned. -DMIDI_IN=0/1 forces
+// it, -DMIDI_RX_PIN moves it.
+#ifndef MIDI_RX_PIN
+#define MIDI_RX_PIN 15
+#endif
+#ifdef MIDI_IN
+constexpr bool midiInEnabled = MIDI_IN;
+#else
+constexpr bool midiInEnabled = !padUsesPin(MIDI_RX_PIN);
+#endif
+static_assert(!midiInEnabled || !padUsesPin(MIDI_RX_PIN), "a scanned pad shares a GPIO with MIDI in");
+static_assert(!padUsesPin(MIDI_TX_PIN), "a scanned pad shares a GPIO with MIDI out");
+#define MIDI_RX_BUFFER 512
+uint8_t noteToPad[128];
+class MidiParser
 {
-    while (1)
+public:
+    uint8_t status = 0, data[2];
+
+    // true once a complete channel message sits in status/data
+    bool feed(uint8_t b)
     {
-        bool pressed = false;
-        fo4
+        if (b >= 0xF8)
+            return false;
+        if (b & 0x80)
         {
-            buttonState[i].store(!digitalRead(btnPins[i]));
-            if (buttonState[i].load())
-                pressed = true;
+            status = b < 0xF0 ? b : 0;
+            count = 0;
+            expected = ((b & 0xE0) == 0xC0) ? 1 : 2; // program change / channel pressure
+            return false;
         }
-        if (currentMenu.load() == MENU_MAIN)
+        if (status == 0)
+            return false;
+        data[count++] = b;
+        if (count < expected)
+            return false;
+        count = 0;
+        return true;
+    }
+
+private:
+    uint8_t count = 0, expected = 2;
+};
+MidiParser midiIn;
+
+void buildNoteMap()
+{
+    memset(noteToPad, 0xFF, sizeof(noteToPad));
+    for (int8_t pad = NUM_SENSORS - 1; pad >= 0; pad--)
+        noteToPad[padNotes[pad]] = pad;
+}
+// sensorTask: drain whatever arrived since the last poll
+void midiReceive(uint32_t now)
+{
+    if (!midiInEnabled)
+        return;
+    int n = Serial2.available();
+    while (n-- > 0)
+    {
+        if (!midiIn.feed(Serial2.read()))
+            continue;
+        if (midiIn.status != (0x90 | midiChannel) || midiIn.data[1] == 0)
+            continue;
+        uint8_t pad = noteToPad[midiIn.data[0]];
+        if (pad >= NUM_PADS)
+            continue;
+        uint8_t velocity = midiIn.data[1];
+        dispatchHit(pad, map(velocity, 1, 127, 10, 4095), velocity, now, HIT_MIDI);
+    }
+}
+// Every JSON document read from or written to flash lives in this fixed
+// arena instead of the heap, so preset I/O costs the same whenever a button
+// is pressed and can't fragment or exhaust the heap mid-show. Blocks are
+// carved off the top; ArduinoJson grows its slot pool and strings at the
+// top and frees everything with the document, so giving back the topmost
+// block and rewinding once nothing is live is enough. Running out fails
+// the parse with NoMemory. A document that outlives the I/O call gets an
+// arena of its own, see ShowSequencer.
+#ifndef JSON_POOL_SIZE
+#define JSON_POOL_SIZE 24576
+#endif
+template <size_t SIZE>
+class JsonArena : public ArduinoJson::Allocator
+{
+public:
+    void *allocate(size_t size) override
+    {
+        portENTER_CRITICAL(&mux);
+        void *ptr = carve(size);
+        portEXIT_CRITICAL(&mux);
+        return ptr;
+    }
+    void deallocate(void *ptr) override
+    {
+        if (!ptr)
+            return;
+        portENTER_CRITICAL(&mux);
+        release(ptr);
+        portEXIT_CRITICAL(&mux);
+    }
+    void *reallocate(void *ptr, size_t size) override
+    {
+        if (!ptr)
+            return allocate(size);
+        portENTER_CRITICAL(&mux);
+        size_t start = (uint8_t *)ptr - arena, old = blockSize(ptr);
+        if (start + old == top && start + round(size) <= SIZE)
         {
-            if (buttonState[up].load() || buttonState[down].load())
-            {
-                if (buttonState[up].load())
-                    updateSelectedIndex(selectedMainIndex, menuItemCount, 1);
-                else if (buttonState[down].load())
-                    updateSelectedIndex(selectedMainIndex, menuItemCount, 0);
-            }
-            else if (buttonState[ok].load())
-            {
-                if (selectedMainIndex == static_cast<int>(MainMenu::BASE))
-                    currentMenu.store(BASEMENU);
-                else if (selectedMainIndex == static_cast<int>(MainMenu::HIT))
-                    currentMenu.store(HITMENU);
-            }
-            if (buttonState[back].load())
-            {
-                printAllData();
-            }
+            // topmost block grows or shrinks in place
+            blockSize(ptr) = round(size);
+            top = start + round(size);
+            peak = max(peak, top);
         }
-        else if (currentMenu.load() == BASEMENU)
+        else if (size > old)
         {
-            if (buttonState[up].load() || buttonState[down].load())
-            {
-                if (buttonState[up].load())
-                    updateSelectedIndex(selectedBaseIndex, baseItemCount, 1);
-                else if (buttonState[down].load())
-                    updateSelectedIndex(selectedBaseIndex, baseItemCount, 0);
-            }
-            else if (selectedBaseIndex == static_cast<int>(BaseMenu::COLOR) && buttonState[ok])
-            {
-                base.store(1);
-                hit.store(0);
-                currentMenu.store(RGB_SCREEN);
-            }
-            else if (buttonState[ok].load())
-            {
-                currentMenu.store(SELECTED_BASE);
-            }
-            else if (buttonState[back].load())
+            void *moved = carve(size);
+            if (moved)
             {
-                currentMenu.store(MENU_MAIN);
+                memcpy(moved, ptr, old);
+                release(ptr);
             }
+            ptr = moved;
         }
-        else if (currentMenu.load() == HITMENU)
+        portEXIT_CRITICAL(&mux);
+        return ptr;
+    }
+    size_t peakBytes() const { return peak; }
+    uint32_t failures() const { return failed; }
+
+private:
+    static const size_t HEADER = 8; // keeps blocks 8-byte aligned
+    alignas(8) uint8_t arena[SIZE];
+    size_t top = 0, peak = 0;
+    uint32_t live = 0, failed = 0;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    static size_t round(size_t size) { return (size + HEADER - 1) & ~(HEADER - 1); }
+    size_t &blockSize(void *ptr) { return *(size_t *)((uint8_t *)ptr - HEADER); }
+    void *carve(size_t size)
+    {
+        if (top + HEADER + round(size) > SIZE)
         {
-            if (buttonState[up].load() || buttonState[down].load())
-            {
-                if (buttonState[up].load())
-                    updateSelectedIndex(selectedHitIndex, hitItemCount, 1);
-                else if (buttonState[down].load())
-                    updateSelectedIndex(selectedHitIndex, hitItemCount, 0);
-            }
-            else if (selectedHitIndex == static_cast<int>(HitMenu::COLOR) && buttonState[ok])
+            failed++;
+            return NULL;
+        }
+        uint8_t *ptr = arena + top + HEADER;
+        blockSize(ptr) = round(size);
+        top += HEADER + round(size);
+        peak = max(peak, top);
+        live++;
+        return ptr;
+    }
+    void release(void *ptr)
+    {
+        if (--live == 0)
+            top = 0;
+        else if ((uint8_t *)ptr + blockSize(ptr) == arena + top)
+            top = (uint8_t *)ptr - HEADER - arena;
+    }
+};
+typedef JsonArena<JSON_POOL_SIZE> JsonPool;
+JsonPool jsonPool;
+atomic<uint32_t> jsonParseLastUs{0}, jsonParseMaxUs{0};
+
+// Every JSON file goes through readJsonFile(): files over JSON_MAX_FILE
+// bytes or nested deeper than JSON_MAX_NESTING are refused before parsing,
+// so a corrupt or truncated file fails fast with bounded memory instead of
+// stalling a task. A missing file reads as an empty document, unless a
+// save lost power between swapping out the old file and renaming its copy
+// in: then the copy is read and promoted (see writeJsonFile). A filter keeps
+// only the members a caller needs, see ArduinoJson's DeserializationOption.
+#define JSON_MAX_FILE 16384
+#define JSON_MAX_NESTING 8
+bool readJsonFile(const char *path, JsonDocument &doc, JsonDocument *filter = NULL)
+{
+    doc.clear();
+    if (!SPIFFS.exists(path))
+    {
+        char tmp[40];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        if (!SPIFFS.exists(tmp))
+            return true;
+        // a copy that does not parse is from a first save cut short
+        if (readJsonFile(tmp, doc, filter) && SPIFFS.rename(tmp, path))
+            Serial.printf("Recovered %s from %s\n", path, tmp);
+        else
+            SPIFFS.remove(tmp);
+        return true;
+    }
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+        return false;
+    DeserializationError error = DeserializationError::TooDeep;
+    size_t size = file.size();
+    uint32_t start = micros();
+    if (size <= JSON_MAX_FILE && filter)
+        error = deserializeJson(doc, file, DeserializationOption::Filter(*filter),
+                                DeserializationOption::NestingLimit(JSON_MAX_NESTING));
+    else if (size <= JSON_MAX_FILE)
+        error = deserializeJson(doc, file, DeserializationOption::NestingLimit(JSON_MAX_NESTING));
+    uint32_t took = micros() - start;
+    jsonParseLastUs.store(took);
+    if (took > jsonParseMaxUs.load())
+        jsonParseMaxUs.store(took);
+    file.close();
+    if (error)
+    {
+        Serial.printf("Bad JSON in %s (%u bytes): %s\n", path, (unsigned)size,
+                      size > JSON_MAX_FILE ? "too large" : error.c_str());
+        doc.clear();
+        return false;
+    }
+    return true;
+}
+
+// Writes `doc` to a copy of `path` and swaps it in, so a reset mid-write
+// leaves the old file, and a reset mid-swap the copy, which readJsonFile
+// picks up. Callers hold the StorageLock.
+bool writeJsonFile(const char *path, JsonDocument &doc)
+{
+    char tmp[40];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    File file = SPIFFS.open(tmp, FILE_WRITE);
+    if (!file)
+    {
+        Serial.println("Failed to open file for writing");
+        return false;
+    }
+    bool written = serializeJsonPretty(doc, file) > 0;
+    file.close();
+    if (!written || !(SPIFFS.remove(path), SPIFFS.rename(tmp, path)))
+    {
+        Serial.printf("Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// default preset crossfade, a preset's "crossfade" key overrides it
+atomic<float> crossfadeMs{500};
+// cue list files of the show sequencer, in song order
+#define SHOW_MAX_SONGS 16
+char showPaths[SHOW_MAX_SONGS][32];
+uint8_t showCount = 0;
+atomic<int8_t> showSong{-1}; // -1 when stopped
+atomic<int16_t> showCue{-1}; // last cue fired
+// the presets a loaded song copied, see ShowSequencer
+#ifndef SHOW_PRESET_POOL
+#define SHOW_PRESET_POOL 6144
+#endif
+JsonArena<SHOW_PRESET_POOL> showPresetPool;
+
+// settings.json globals: optional "crossfade_ms", "power_limit_ma", "pads"
+// (PadCal per pad), "shows" (cue list paths) and
+// "midi": {"channel": 1-16, "notes": [..], "in_map": [[note, pad], ..]};
+// notes is the pad -> note map used both ways, in_map adds extra incoming
+// notes (rim shots, cymbal chokes...) for a pad
+void loadSettings()
+{
+    JsonDocument doc(&jsonPool), filter(&jsonPool);
+    filter["crossfade_ms"] = true;
+    filter["power_limit_ma"] = true;
+    filter["pads"] = true;
+    filter["shows"] = true;
+    filter["midi"] = true;
+    if (!readJsonFile(JSON_FILE, doc, &filter))
+        return;
+    crossfadeMs.store(constrain(doc["crossfade_ms"] | 500, 0, 10000));
+    if (doc["power_limit_ma"].is<uint32_t>())
+        powerLimitMa.store(doc["power_limit_ma"].as<uint32_t>());
+    JsonArrayConst pads = doc["pads"];
+    for (uint8_t i = 0; i < NUM_SENSORS && i < pads.size(); i++)
+        if (pads[i]["threshold"].is<uint16_t>() && pads[i]["low"].is<uint16_t>() && pads[i]["high"].is<uint16_t>())
+            setPadCal(i, pads[i]["threshold"], pads[i]["low"], pads[i]["high"]);
+    showCount = 0;
+    for (JsonVariantConst path : doc["shows"].as<JsonArrayConst>())
+        if (path.is<const char *>() && showCount < SHOW_MAX_SONGS)
+            strlcpy(showPaths[showCount++], path, sizeof(showPaths[0]));
+
+    JsonObject midi = doc["midi"];
+    if (midi["channel"].is<int>())
+        midiChannel = constrain(midi["channel"].as<int>(), 1, 16) - 1;
+    JsonArray notes = midi["notes"];
+    for (uint8_t i = 0; i < NUM_SENSORS && i < notes.size(); i++)
+        if (notes[i].is<uint8_t>())
+            padNotes[i] = notes[i].as<uint8_t>() & 0x7F;
+    buildNoteMap();
+    for (JsonArray entry : midi["in_map"].as<JsonArray>())
+    {
+        uint8_t note = entry[0].as<uint8_t>(), pad = entry[1].as<uint8_t>();
+        if (entry[0].is<uint8_t>() && entry[1].is<uint8_t>() && note < 128 && pad < NUM_SENSORS)
+            noteToPad[note] = pad;
+    }
+}
+
+// Scheduling plan. Sampling/detection preempts everything, rendering runs
+// below it on the same core, UI and persistence sit low on the other core so
+// an OLED redraw or a SPIFFS write can never hold up a hit. Override any of
+// these from build_flags.
+#ifndef SENSE_TASK_CORE
+#define SENSE_TASK_CORE 1
+#endif
+#ifndef SENSE_TASK_PRIORITY
+#define SENSE_TASK_PRIORITY 5
+#endif
+#ifndef RENDER_TASK_CORE
+#define RENDER_TASK_CORE 1
+#endif
+#ifndef RENDER_TASK_PRIORITY
+#define RENDER_TASK_PRIORITY 4
+#endif
+#ifndef UI_TASK_CORE
+#define UI_TASK_CORE 0
+#endif
+#ifndef UI_TASK_PRIORITY
+#define UI_TASK_PRIORITY 2
+#endif
+#ifndef AUDIO_TASK_CORE
+#define AUDIO_TASK_CORE 0
+#endif
+#ifndef AUDIO_TASK_PRIORITY
+#define AUDIO_TASK_PRIORITY 3
+#endif
+#ifndef STORAGE_TASK_CORE
+#define STORAGE_TASK_CORE 0
+#endif
+#ifndef STORAGE_TASK_PRIORITY
+#define STORAGE_TASK_PRIORITY 1
+#endif
+// ledTask holds three EffectStates and, in a crossfade, renders two effects
+// on top of the VM interpreter's frame; stack_free in the task report
+// (printTaskProfile) shows the headroom left
+#ifndef LED_TASK_STACK
+#define LED_TASK_STACK 4096
+#endif
+TaskHandle_t sensorTaskHandle = NULL, oledTaskHandle = NULL, buttonTaskHandle = NULL, presetTaskHandle = NULL,
+             audioTaskHandle = NULL, serialTaskHandle = NULL, recorderTaskHandle = NULL;
+
+// Per-task profiler. Each task brackets its loop body with
+// profileLoopBegin/End; once a second the owner publishes CPU share
+// (busy / wall time), mean loop period and jitter (max - min period).
+// For ledTask the busy time is one frame of the running effect.
+enum ProfileId
+{
+    PROFILE_SENSOR,
+    PROFILE_OLED,
+    PROFILE_BUTTON,
+    PROFILE_PRESET,
+    PROFILE_AUDIO,
+    PROFILE_SERIAL,
+    PROFILE_RECORDER,
+    PROFILE_LED,
+    PROFILE_COUNT = PROFILE_LED + NUM_SENSORS
+};
+const char *profileNames[PROFILE_LED] = {"Sense", "OLED", "Button", "Preset", "Audio", "Serial", "Record"};
+struct TaskProfile
+{
+    char name[8];
+    TaskHandle_t handle = NULL;
+    uint32_t loopStart = 0, windowStart = 0, busyUs = 0, loops = 0;
+    uint32_t periodMinUs = UINT32_MAX, periodMaxUs = 0;
+    atomic<uint8_t> cpuPercent{0};
+    atomic<uint32_t> periodUs{0}, jitterUs{0};
+};
+TaskProfile profiles[PROFILE_COUNT];
+
+void profileLoopBegin(uint8_t id)
+{
+    TaskProfile &p = profiles[id];
+    uint32_t now = micros();
+    if (p.handle == NULL)
+    {
+        p.handle = xTaskGetCurrentTaskHandle();
+        if (id < PROFILE_LED)
+            snprintf(p.name, sizeof(p.name), "%s", profileNames[id]);
+        else
+            snprintf(p.name, sizeof(p.name), "LED%d", id - PROFILE_LED);
+        p.windowStart = now;
+    }
+    else
+    {
+        uint32_t period = now - p.loopStart;
+        if (period < p.periodMinUs)
+            p.periodMinUs = period;
+        if (period > p.periodMaxUs)
+            p.periodMaxUs = period;
+        p.loops++;
+    }
+    p.loopStart = now;
+
+    uint32_t window = now - p.windowStart;
+    if (window >= 1000000)
+    {
+        p.cpuPercent.store(min<uint32_t>(100, (uint64_t)p.busyUs * 100 / window));
+        p.periodUs.store(p.loops ? window / p.loops : 0);
+        p.jitterUs.store(p.loops ? p.periodMaxUs - p.periodMinUs : 0);
+        p.windowStart = now;
+        p.busyUs = 0;
+        p.loops = 0;
+        p.periodMinUs = UINT32_MAX;
+        p.periodMaxUs = 0;
+    }
+}
+void profileLoopEnd(uint8_t id)
+{
+    profiles[id].busyUs += micros() - profiles[id].loopStart;
+}
+void printTaskProfile()
+{
+    Serial.println("=== Tasks ===");
+    Serial.println("name    cpu%  period_us  jitter_us  stack_free");
+    for (uint8_t id = 0; id < PROFILE_COUNT; id++)
+    {
+        TaskProfile &p = profiles[id];
+        if (p.handle == NULL)
+            continue;
+        Serial.printf("%-7s %4u  %9u  %9u  %10u\n", p.name, p.cpuPercent.load(), p.periodUs.load(),
+                      p.jitterUs.load(), (unsigned)uxTaskGetStackHighWaterMark(p.handle));
+    }
+    Serial.println("================");
+}
+
+const uint8_t presetPins[6] = {26, 25, 33, 32, 19, 18};
+atomic<bool> presetState[6];
+// const uint8_t btnPins[4] = {12, 13, 14, 27};
+const uint8_t btnPins[4] = {12, 17, 16, 5};
+
+atomic<bool> buttonState[4];
+
+enum btn
+{
+    up,
+    down,
+    ok,
+    back
+};
+enum MenuState
+{
+    MENU_MAIN,
+    HITMENU,
+    BASEMENU,
+    RGB_SCREEN,
+    SELECTED_RGB,
+    SELECTED_BASE,
+    SELECTED_HIT,
+    MEM_SCREEN,
+    DIAG_SCREEN,
+    CAL_SCREEN
+};
+std::atomic<MenuState> currentMenu{MENU_MAIN};
+std::atomic<int> selectedMainIndex{0};
+constexpr int menuItemCount = 6;
+enum class MainMenu
+{
+    BASE,
+    HIT,
+    DIAG,
+    TAP,
+    SHOW,
+    CALIBRATE
+};
+const char *mainMenuItems[menuItemCount] = {
+    "Base Color",
+    "Hit Color",
+    "Diagnostics",
+    "Tap Tempo",
+    "Show",
+    "Calibrate"};
+std::atomic<int> selectedCalPad{0};
+
+std::atomic<int> selectedHitIndex{0};
+constexpr int hitItemCount = 5; // 2 lock or 5 adv
+enum class HitMenu
+{
+    COLOR,
+    BRIGHTNESS,
+    TAIL,
+    CHASE,
+    RAINBOW
+};
+const char *hitItems[hitItemCount] = {
+    "Color",
+    "Brightness",
+    "Tail",
+    "Chase",
+    "Rainbow",
+};
+
+std::atomic<int> selectedBaseIndex{0};
+constexpr int baseItemCount = 7;
+enum class BaseMenu
+{
+    COLOR,
+    BRIGHTNESS,
+    SPEED,
+    STROBE,
+    RAINBOW,
+    AUDIO,
+    SYNC
+};
+const char *baseItems[baseItemCount] = {
+    "Color",
+    "Brightness",
+    "Speed",
+    "Strobe",
+    "Rainbow",
+    "Audio",
+    "Sync"};
+
+std::atomic<int> selectedRGBIndex{0};
+constexpr int RGBItemCount = 3;
+const char *RGBItems[RGBItemCount] = {
+    "Red",
+    "Green",
+    "Blue"};
+
+class HitData
+{
+public:
+    atomic<uint8_t> red{255}, blue{255}, green{255}, tail{3};
+    atomic<float> brightness{100};
+
+    atomic<bool> chase{0}, rainbow{0};
+    atomic<uint8_t> effect{FX_HIT_FADE};
+    atomic<uint8_t> palette{0};
+};
+class BaseData
+{
+public:
+    atomic<uint8_t> red{255}, blue{0}, green{0}, speed{2};
+    atomic<float> brightness{100};
+    atomic<bool> strobe{0}, rainbow{0}, audio{0}, sync{0};
+    atomic<bool> external{0}, composite{1}; // host-rendered base, hits on top
+    atomic<uint8_t> effect{FX_BASE_SOLID};
+    atomic<uint8_t> palette{0};
+};
+HitData hitData;
+BaseData baseData;
+
+atomic<bool> hit(0), base(0);
+String mem_screen_data;
+void printAllData();
+void updateSelectedIndex(std::atomic<int> &index, int itemCount, bool moveUp)
+{
+    int newIndex = index.load() + (moveUp ? -1 : 1);
+    if (newIndex < 0)
+        newIndex = 0;
+    else if (newIndex >= itemCount)
+        newIndex = itemCount - 1;
+    index.store(newIndex);
+}
+enum VmSlot
+{
+    VM_BASE,
+    VM_HIT
+};
+struct VmProgram;
+bool vmLoadProgram(uint8_t slot, const char *path);
+void vmPublish(uint8_t slot, const VmProgram *prog);
+// FX_NONE (or an unusable id) picks the effect from the option flags
+void selectBaseEffect(uint8_t id = FX_NONE);
+void selectHitEffect(uint8_t id = FX_NONE);
+uint8_t effectByName(const char *name);
+enum PresetLayer
+{
+    LAYER_BASE,
+    LAYER_HIT
+};
+void paletteFromJson(uint8_t layer, JsonVariantConst value);
+void paletteToJson(uint8_t layer, JsonObject item);
+const char *paletteName(uint8_t layer);
+void selectPalette(uint8_t layer, uint8_t index);
+void beginPresetFade(uint8_t layer, uint32_t ms, uint32_t at);
+void requestShow(int8_t song);
+void requestRecorder(uint8_t state, uint8_t speed);
+int effectSelfTest(bool record);
+atomic<uint32_t> vmOverruns{0}, vmFaults{0};
+
+// settings.json is read-modify-written from more than one task
+SemaphoreHandle_t storageMutex = NULL;
+struct StorageLock
+{
+    StorageLock() { xSemaphoreTake(storageMutex, portMAX_DELAY); }
+    ~StorageLock() { xSemaphoreGive(storageMutex); }
+};
+// "pads": [{"threshold", "low", "high"}, ..] for the whole kit, see PadCal
+void savePadCalibration()
+{
+    StorageLock lock;
+    JsonDocument doc(&jsonPool);
+    if (!readJsonFile(JSON_FILE, doc) || (!doc.isNull() && !doc.is<JsonObject>()))
+    {
+        Serial.println("Failed to parse existing JSON");
+        return;
+    }
+    JsonArray pads = doc["pads"].to<JsonArray>();
+    for (uint8_t i = 0; i < NUM_SENSORS; i++)
+    {
+        JsonObject pad = pads.add<JsonObject>();
+        pad["threshold"] = padCal[i].threshold.load();
+        pad["low"] = padCal[i].low.load();
+        pad["high"] = padCal[i].high.load();
+    }
+    writeJsonFile(JSON_FILE, doc);
+}
+// preset `index` of the "base" or "hit" list, created if the file lacks it
+JsonObject presetSlot(JsonDocument &doc, const char *key, uint8_t index)
+{
+    JsonArray list = doc[key].is<JsonArray>() ? doc[key].as<JsonArray>() : doc[key].to<JsonArray>();
+    while (list.size() <= index)
+        list.add<JsonObject>();
+    return list[index].is<JsonObject>() ? list[index].as<JsonObject>() : list[index].to<JsonObject>();
+}
+void savePresetToJson(uint8_t i)
+{
+    if (i > 5)
+        return;
+    StorageLock lock;
+    JsonDocument doc(&jsonPool);
+
+    // never overwrite a file that could not be read, it may be recoverable
+    if (!readJsonFile(JSON_FILE, doc) || (!doc.isNull() && !doc.is<JsonObject>()))
+    {
+        Serial.println("Failed to parse existing JSON");
+        return;
+    }
+    if (i < 3)
+    {
+        JsonObject base_item = presetSlot(doc, "base", i);
+        base_item["red"] = baseData.red.load();
+        base_item["blue"] = baseData.blue.load();
+        base_item["green"] = baseData.green.load();
+        base_item["brightness"] = baseData.brightness.load();
+        base_item["speed"] = baseData.speed.load();
+        base_item["strobe"] = baseData.strobe.load();
+        base_item["rainbow"] = baseData.rainbow.load();
+        base_item["audio"] = baseData.audio.load();
+        base_item["sync"] = baseData.sync.load();
+        base_item["external"] = baseData.external.load();
+        base_item["effect"] = effectNames[baseData.effect.load()];
+        paletteToJson(LAYER_BASE, base_item);
+    }
+    if (i > 2)
+    {
+        uint8_t index = i - 3;
+        JsonObject hit_item = presetSlot(doc, "hit", index);
+        hit_item["red"] = hitData.red.load();
+        hit_item["blue"] = hitData.blue.load();
+        hit_item["green"] = hitData.green.load();
+        hit_item["brightness"] = hitData.brightness.load();
+        hit_item["tail"] = hitData.tail.load();
+        hit_item["chase"] = hitData.chase.load();
+        hit_item["rainbow"] = hitData.rainbow.load();
+        hit_item["effect"] = effectNames[hitData.effect.load()];
+        paletteToJson(LAYER_HIT, hit_item);
+    }
+
+    writeJsonFile(JSON_FILE, doc);
+    // Serial.println("Preset saved.");
+    // printAllData();
+    // Serial.println("✅ settings.json contents:");
+    // serializeJsonPretty(doc, Serial);
+}
+// Type and range check of a whole preset entry before any of it is applied.
+// Keys added after the first release (audio, sync, external, effect,
+// palette, program, crossfade) may be missing.
+bool optionalIs(JsonVariantConst v, bool ok)
+{
+    return v.isNull() || ok;
+}
+const char *presetError(uint8_t i, JsonObjectConst item)
+{
+    if (item.isNull())
+        return "missing";
+    if (!item["red"].is<uint8_t>() || !item["green"].is<uint8_t>() || !item["blue"].is<uint8_t>())
+        return "bad colour";
+    float brightness = item["brightness"] | -1.0f;
+    if (!item["brightness"].is<float>() || brightness < 0 || brightness > 255)
+        return "bad brightness";
+    const char *range = i < 3 ? "speed" : "tail";
+    if (!item[range].is<uint8_t>() || item[range].as<uint8_t>() > 9)
+        return i < 3 ? "bad speed" : "bad tail";
+    static const char *baseFlags[] = {"strobe", "rainbow", "audio", "sync", "external"};
+    static const char *hitFlags[] = {"chase", "rainbow"};
+    const char **flags = i < 3 ? baseFlags : hitFlags;
+    for (uint8_t f = 0; f < (i < 3 ? 5 : 2); f++)
+        if (!optionalIs(item[flags[f]], item[flags[f]].is<bool>()))
+            return "bad flag";
+    if (!optionalIs(item["effect"], item["effect"].is<const char *>()) ||
+        !optionalIs(item["program"], item["program"].is<const char *>()) ||
+        !optionalIs(item["crossfade"], item["crossfade"].is<uint16_t>()) ||
+        !optionalIs(item["palette"], item["palette"].is<const char *>() || item["palette"].is<JsonArrayConst>()))
+        return "bad option";
+    for (JsonVariantConst stop : item["palette"].as<JsonArrayConst>())
+        if (stop.size() != 4 || !stop[0].is<uint8_t>() || !stop[1].is<uint8_t>() || !stop[2].is<uint8_t>() ||
+            !stop[3].is<uint8_t>())
+            return "bad palette stop";
+    return NULL;
+}
+// Stores preset `i` (0-2 base, 3-5 hit) from its settings.json entry,
+// crossfading from `at` over `fadeMs` (negative: the preset's "crossfade"
+// or the default). `program` is the preset's effect program already read
+// from flash, or NULL to read it here.
+bool applyPreset(uint8_t i, JsonObjectConst item, const VmProgram *program, int32_t fadeMs, uint32_t at)
+{
+    if (const char *error = presetError(i, item))
+    {
+        Serial.printf("Preset %u not loaded: %s\n", i + 1, error);
+        return false;
+    }
+    if (fadeMs < 0)
+        fadeMs = item["crossfade"] | (uint32_t)crossfadeMs.load();
+    if (i < 3)
+    {
+        beginPresetFade(LAYER_BASE, fadeMs, at);
+        baseData.red.store(item["red"]);
+        baseData.blue.store(item["blue"]);
+        baseData.green.store(item["green"]);
+        baseData.brightness.store(item["brightness"]);
+        baseData.speed.store(item["speed"]);
+        baseData.strobe.store(item["strobe"]);
+        baseData.rainbow.store(item["rainbow"]);
+        baseData.audio.store(item["audio"]);
+        baseData.sync.store(item["sync"]);
+        baseData.external.store(item["external"]);
+        if (program)
+            vmPublish(VM_BASE, program);
+        else
+            vmLoadProgram(VM_BASE, item["program"] | "");
+        paletteFromJson(LAYER_BASE, item["palette"]);
+        selectBaseEffect(effectByName(item["effect"]));
+    }
+    else
+    {
+        beginPresetFade(LAYER_HIT, fadeMs, at);
+        hitData.red.store(item["red"]);
+        hitData.blue.store(item["blue"]);
+        hitData.green.store(item["green"]);
+        hitData.brightness.store(item["brightness"]);
+        hitData.tail.store(item["tail"]);
+        hitData.chase.store(item["chase"]);
+        hitData.rainbow.store(item["rainbow"]);
+        if (program)
+            vmPublish(VM_HIT, program);
+        else
+            vmLoadProgram(VM_HIT, item["program"] | "");
+        paletteFromJson(LAYER_HIT, item["palette"]);
+        selectHitEffect(effectByName(item["effect"]));
+    }
+    return true;
+}
+// settings.json entry of preset `i`, null if it has none
+JsonObjectConst presetItem(JsonDocument &doc, uint8_t i)
+{
+    if (i > 5)
+        return JsonObjectConst();
+    return i < 3 ? doc["base"][i] : doc["hit"][i - 3];
+}
+void loadPresetToJson(uint8_t i)
+{
+    StorageLock lock;
+    // only this preset's list is materialised, the filter drops the rest
+    JsonDocument doc(&jsonPool), filter(&jsonPool);
+    filter[i < 3 ? "base" : "hit"][0] = true;
+
+    if (!readJsonFile(JSON_FILE, doc, &filter))
+    {
+        Serial.println("Failed to parse existing JSON");
+        return;
+    }
+    applyPreset(i, presetItem(doc, i), NULL, -1, millis());
+    // Serial.println("Preset Loaded.");
+    // printAllData();
+    // Serial.println("✅ settings.json contents:");
+    // serializeJsonPretty(doc, Serial);
+}
+void menu_screen();
+void base_screen(int selectedWidth);
+void hit_screen(int selectedWidth);
+void rgb_screen(int selectedWidth);
+void mem_screen(String line);
+void diag_screen();
+void cal_screen();
+void savePadCalibration();
+void recordHitLatency(uint32_t us)
+{
+    hitLatencyLastUs.store(us);
+    if (us > hitLatencyMaxUs.load())
+        hitLatencyMaxUs.store(us);
+}
+void printAllData()
+{
+    Serial.println("=== HitData ===");
+    Serial.print("Red: ");
+    Serial.println(hitData.red.load());
+    Serial.print("Green: ");
+    Serial.println(hitData.green.load());
+    Serial.print("Blue: ");
+    Serial.println(hitData.blue.load());
+    Serial.print("Brightness: ");
+    Serial.println(hitData.brightness.load());
+    Serial.print("Tail: ");
+    Serial.println(hitData.tail.load());
+    Serial.print("Chase: ");
+    Serial.println(hitData.chase.load() ? "true" : "false");
+    Serial.print("Rainbow: ");
+    Serial.println(hitData.rainbow.load() ? "true" : "false");
+
+    Serial.println("=== BaseData ===");
+    Serial.print("Red: ");
+    Serial.println(baseData.red.load());
+    Serial.print("Green: ");
+    Serial.println(baseData.green.load());
+    Serial.print("Blue: ");
+    Serial.println(baseData.blue.load());
+    Serial.print("Brightness: ");
+    Serial.println(baseData.brightness.load());
+    Serial.print("Speed: ");
+    Serial.println(baseData.speed.load());
+    Serial.print("Strobe: ");
+    Serial.println(baseData.strobe.load() ? "true" : "false");
+    Serial.print("Rainbow: ");
+    Serial.println(baseData.rainbow.load() ? "true" : "false");
+    Serial.print("Audio: ");
+    Serial.println(baseData.audio.load() ? "true" : "false");
+    Serial.print("Sync: ");
+    Serial.println(baseData.sync.load() ? "true" : "false");
+    Serial.print("BPM: ");
+    Serial.print(beatClock.bpm());
+    Serial.println(beatClock.locked() ? " (locked)" : "");
+
+    Serial.println("=== Hit latency ===");
+    Serial.print("Last us: ");
+    Serial.println(hitLatencyLastUs.load());
+    Serial.print("Max us: ");
+    Serial.println(hitLatencyMaxUs.load());
+    Serial.print("MIDI dropped: ");
+    Serial.println(midiDropped.load());
+    Serial.print("Effects (base/hit): ");
+    Serial.print(effectNames[baseData.effect.load()]);
+    Serial.print(" / ");
+    Serial.println(effectNames[hitData.effect.load()]);
+    Serial.print("Palettes (base/hit): ");
+    Serial.print(paletteName(LAYER_BASE));
+    Serial.print(" / ");
+    Serial.println(paletteName(LAYER_HIT));
+    Serial.print("Show (song:cue): ");
+    Serial.print(showSong.load() + 1);
+    Serial.print(":");
+    Serial.println(showCue.load() + 1);
+    Serial.print("Recorder (state/events/dropped): ");
+    Serial.print(recState.load());
+    Serial.print("/");
+    Serial.print(recEvents.load());
+    Serial.print("/");
+    Serial.println(recDropped.load());
+    Serial.print("JSON pool peak/size/failed: ");
+    Serial.print(jsonPool.peakBytes());
+    Serial.print("/");
+    Serial.print(JSON_POOL_SIZE);
+    Serial.print("/");
+    Serial.println(jsonPool.failures());
+    Serial.print("Show preset pool peak/size/failed: ");
+    Serial.print(showPresetPool.peakBytes());
+    Serial.print("/");
+    Serial.print(SHOW_PRESET_POOL);
+    Serial.print("/");
+    Serial.println(showPresetPool.failures());
+    Serial.print("JSON parse last/max us: ");
+    Serial.print(jsonParseLastUs.load());
+    Serial.print("/");
+    Serial.println(jsonParseMaxUs.load());
+    Serial.print("LED frame us (max fps): ");
+    Serial.print(ledWireUs.load());
+    Serial.print(" (");
+    Serial.print(1000000 / (ledWireUs.load() + WS2812_RESET_US));
+    Serial.println(")");
+    Serial.print("LED current mA (limit), gain, limited frames: ");
+    Serial.print(powerEstimateMa.load());
+    Serial.print(" (");
+    Serial.print(powerLimitMa.load());
+    Serial.print("), ");
+    Serial.print(powerGain.load());
+    Serial.print(", ");
+    Serial.println(powerLimitedFrames.load());
+    Serial.print("Idle stage, wake latency last/max us: ");
+    Serial.print(idleStage.load());
+    Serial.print(", ");
+    Serial.print(wakeLatencyLastUs.load());
+    Serial.print("/");
+    Serial.println(wakeLatencyMaxUs.load());
+    Serial.print("Program overruns/faults: ");
+    Serial.print(vmOverruns.load());
+    Serial.print("/");
+    Serial.println(vmFaults.load());
+    Serial.print("External: ");
+    Serial.print(extFrames.fps.load());
+    Serial.print(" fps x ");
+    Serial.print(ledOutput.totalPixels);
+    Serial.print(" LEDs, dropped ");
+    Serial.println(extFrames.dropped.load());
+
+    Serial.println("=== Boot ===");
+    printBootTimeline();
+
+    Serial.println("================");
+}
+
+void adjustRGBValue(int direction)
+{
+    std::atomic<uint8_t> *colorPtr = nullptr;
+
+    if (base.load())
+    {
+        if (selectedRGBIndex.load() == 0)
+            colorPtr = &baseData.red;
+        else if (selectedRGBIndex.load() == 1)
+            colorPtr = &baseData.green;
+        else if (selectedRGBIndex.load() == 2)
+            colorPtr = &baseData.blue;
+    }
+    else if (hit.load())
+    {
+        if (selectedRGBIndex.load() == 0)
+            colorPtr = &hitData.red;
+        else if (selectedRGBIndex.load() == 1)
+            colorPtr = &hitData.green;
+        else if (selectedRGBIndex.load() == 2)
+            colorPtr = &hitData.blue;
+    }
+
+    if (colorPtr != nullptr)
+    {
+        colorPtr->store(colorPtr->load() + direction);
+        vTaskDelay(pdMS_TO_TICKS(500));
+        buttonState[up].store(!digitalRead(btnPins[up]));
+        buttonState[down].store(!digitalRead(btnPins[down]));
+        while ((direction == 1 ? buttonState[up].load() : buttonState[down].load()))
+        {
+            colorPtr->store(colorPtr->load() + direction);
+            vTaskDelay(pdMS_TO_TICKS(40));
+            buttonState[up].store(!digitalRead(btnPins[up]));
+            buttonState[down].store(!digitalRead(btnPins[down]));
+        }
+    }
+}
+void adjustValueHold(std::atomic<float> &value, bool (*upState)(), bool (*downState)(), int minVal, int maxVal, int step = 1)
+{
+    const unsigned long repeatDelay = 50; // ms between changes
+
+    // Keep looping while button is held
+    // while (upState() || downState())
+    // {
+    if (upState())
+    {
+        int newVal = value.load() + step;
+        if (newVal > maxVal)
+            newVal = maxVal;
+        value.store(newVal);
+    }
+    else if (downState())
+    {
+        int newVal = value.load() - step;
+        if (newVal < minVal)
+            newVal = minVal;
+        value.store(newVal);
+    }
+    //     vTaskDelay(pdMS_TO_TICKS(repeatDelay));
+    // }
+}
+bool isUpPressed()
+{
+    fo4 buttonState[i].store(!digitalRead(btnPins[i]));
+    return buttonState[up];
+}
+bool isDownPressed()
+{
+    fo4 buttonState[i].store(!digitalRead(btnPins[i]));
+    return buttonState[down];
+}
+
+// Binary control protocol on the USB serial port, for a lighting desk or a
+// laptop. Frames are COBS encoded and 0x00 delimited, so they survive the
+// text the firmware also prints; replies start with an extra 0x00 for the
+// same reason. Decoded frame: [command][payload..][crc16 lo][crc16 hi],
+// CRC-16/CCITT-FALSE over command + payload. Frames are decoded in place in
+// a static buffer, nothing is allocated. Reply: [command | 0x80][status][..].
+// Commands that touch flash are handed to presetTask, and the self-test to
+// a task of its own, which reply once done, so serialTask keeps taking
+// frames; one can be in flight at a time, another arriving meanwhile is
+// answered PROTO_BUSY.
+#define PROTO_MAX_FRAME 1024
+#define PROTO_MAX_REPLY 64
+enum ProtoCommand
+{
+    CMD_PING = 0x01,
+    CMD_SET_PARAM = 0x02,    // [param][value i32]
+    CMD_GET_PARAM = 0x03,    // [param] -> [param][value i32]
+    CMD_RECALL_PRESET = 0x04, // [0-5], 0-2 base, 3-5 hit
+    CMD_SAVE_PRESET = 0x05,  // [0-5]
+    CMD_GET_STATS = 0x06,    // -> see sendStats()
+    CMD_PIXELS = 0x07,       // [seq u16][first pixel u16][flags][RGB..], no reply
+    CMD_SHOW = 0x08,         // [song], 0xFF stops
+    CMD_RECORD = 0x09,       // [0 stop, 1 record, 2 replay][replay speed, 0 flat out]
+    CMD_SELFTEST = 0x0A      // [0 verify, 1 record] -> [mismatches, 0xFF no golden file]
+};
+#define PIXELS_END_OF_FRAME 0x01
+enum ProtoStatus
+{
+    PROTO_OK,
+    PROTO_BAD_CRC,
+    PROTO_BAD_LENGTH,
+    PROTO_BAD_COMMAND,
+    PROTO_BAD_PARAM,
+    PROTO_BUSY
+};
+enum ParamId
+{
+    P_HIT_RED,
+    P_HIT_GREEN,
+    P_HIT_BLUE,
+    P_HIT_BRIGHTNESS,
+    P_HIT_TAIL,
+    P_HIT_CHASE,
+    P_HIT_RAINBOW,
+    P_BASE_RED,
+    P_BASE_GREEN,
+    P_BASE_BLUE,
+    P_BASE_BRIGHTNESS,
+    P_BASE_SPEED,
+    P_BASE_STROBE,
+    P_BASE_RAINBOW,
+    P_BASE_AUDIO,
+    P_BASE_SYNC,
+    P_BASE_EXTERNAL,
+    P_BASE_COMPOSITE,
+    P_HIT_EFFECT,
+    P_BASE_EFFECT,
+    P_HIT_PALETTE,
+    P_BASE_PALETTE,
+    P_CROSSFADE_MS,
+    P_COUNT
+};
+// exactly one of u8 / f / b is set
+struct ParamDef
+{
+    atomic<uint8_t> *u8;
+    atomic<float> *f;
+    atomic<bool> *b;
+    int32_t minVal, maxVal;
+};
+const ParamDef paramDefs[P_COUNT] = {
+    {&hitData.red, NULL, NULL, 0, 255},
+    {&hitData.green, NULL, NULL, 0, 255},
+    {&hitData.blue, NULL, NULL, 0, 255},
+    {NULL, &hitData.brightness, NULL, 0, 255},
+    {&hitData.tail, NULL, NULL, 0, 9},
+    {NULL, NULL, &hitData.chase, 0, 1},
+    {NULL, NULL, &hitData.rainbow, 0, 1},
+    {&baseData.red, NULL, NULL, 0, 255},
+    {&baseData.green, NULL, NULL, 0, 255},
+    {&baseData.blue, NULL, NULL, 0, 255},
+    {NULL, &baseData.brightness, NULL, 0, 255},
+    {&baseData.speed, NULL, NULL, 0, 9},
+    {NULL, NULL, &baseData.strobe, 0, 1},
+    {NULL, NULL, &baseData.rainbow, 0, 1},
+    {NULL, NULL, &baseData.audio, 0, 1},
+    {NULL, NULL, &baseData.sync, 0, 1},
+    {NULL, NULL, &baseData.external, 0, 1},
+    {NULL, NULL, &baseData.composite, 0, 1},
+    {&hitData.effect, NULL, NULL, 0, FX_COUNT - 1},
+    {&baseData.effect, NULL, NULL, 0, FX_COUNT - 1},
+    {&hitData.palette, NULL, NULL, 0, 255}, // built-in index, see builtinPalettes
+    {&baseData.palette, NULL, NULL, 0, 255},
+    {NULL, &crossfadeMs, NULL, 0, 10000}};
+
+int32_t getParam(uint8_t id)
+{
+    const ParamDef &p = paramDefs[id];
+    if (p.u8)
+        return p.u8->load();
+    if (p.f)
+        return (int32_t)p.f->load();
+    return p.b->load();
+}
+void setParam(uint8_t id, int32_t value)
+{
+    const ParamDef &p = paramDefs[id];
+    value = constrain(value, p.minVal, p.maxVal);
+    if (p.u8)
+        p.u8->store(value);
+    else if (p.f)
+        p.f->store(value);
+    else
+        p.b->store(value);
+
+    if (id == P_HIT_EFFECT)
+        selectHitEffect(value);
+    else if (id == P_BASE_EFFECT)
+        selectBaseEffect(value);
+    else if (id == P_HIT_PALETTE)
+        selectPalette(LAYER_HIT, value);
+    else if (id == P_BASE_PALETTE)
+        selectPalette(LAYER_BASE, value);
+    else if (p.b)
+    {
+        // an option flag changed the effect
+        selectHitEffect();
+        selectBaseEffect();
+    }
+}
+
+uint16_t crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--)
+    {
+        crc ^= (uint16_t)*data++ << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+// in place, the output never overtakes the input; 0 on a malformed frame
+size_t cobsDecode(uint8_t *buf, size_t len)
+{
+    size_t in = 0, out = 0;
+    while (in < len)
+    {
+        uint8_t code = buf[in++];
+        if (code == 0 || in + code - 1 > len)
+            return 0;
+        for (uint8_t k = 1; k < code; k++)
+            buf[out++] = buf[in++];
+        if (code < 0xFF && in < len)
+            buf[out++] = 0;
+    }
+    return out;
+}
+size_t cobsEncode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t out = 1, codeAt = 0;
+    uint8_t code = 1;
+    for (size_t in = 0; in < len; in++)
+    {
+        if (src[in] == 0)
+        {
+            dst[codeAt] = code;
+            codeAt = out++;
+            code = 1;
+            continue;
+        }
+        dst[out++] = src[in];
+        if (++code == 0xFF)
+        {
+            dst[codeAt] = code;
+            codeAt = out++;
+            code = 1;
+        }
+    }
+    dst[codeAt] = code;
+    return out;
+}
+void protoReply(uint8_t command, uint8_t status, const uint8_t *payload = NULL, size_t len = 0)
+{
+    uint8_t frame[PROTO_MAX_REPLY];
+    uint8_t wire[PROTO_MAX_REPLY + PROTO_MAX_REPLY / 254 + 3];
+    if (len > PROTO_MAX_REPLY - 4)
+        len = PROTO_MAX_REPLY - 4;
+    frame[0] = command | 0x80;
+    frame[1] = status;
+    if (len)
+        memcpy(frame + 2, payload, len);
+    uint16_t crc = crc16(frame, len + 2);
+    frame[len + 2] = crc & 0xFF;
+    frame[len + 3] = crc >> 8;
+    wire[0] = 0;
+    size_t n = cobsEncode(frame, len + 4, wire + 1) + 1;
+    wire[n++] = 0;
+    Serial.write(wire, n);
+}
+atomic<uint16_t> protoJob{0}; // deferred command << 8 | argument, 0 for none
+bool deferCommand(uint8_t command, uint8_t arg)
+{
+    uint16_t none = 0;
+    if (protoJob.compare_exchange_strong(none, command << 8 | arg))
+        return true;
+    protoReply(command, PROTO_BUSY);
+    return false;
+}
+// presetTask: run a deferred command and answer it
+void serviceProtoJob()
+{
+    uint16_t job = protoJob.load();
+    uint8_t command = job >> 8, arg = job & 0xFF;
+    if (command == CMD_RECALL_PRESET)
+        loadPresetToJson(arg);
+    else if (command == CMD_SAVE_PRESET)
+        savePresetToJson(arg);
+    else
+        return;
+    protoReply(command, PROTO_OK);
+    protoJob.store(0);
+}
+// CMD_SELFTEST renders every effect, too long to hold up serialTask or
+// presetTask
+void selfTestTask(void *pvParameters)
+{
+    uint8_t failed = min(effectSelfTest((protoJob.load() & 0xFF) != 0), 0xFE);
+    protoReply(CMD_SELFTEST, PROTO_OK, &failed, 1);
+    protoJob.store(0);
+    vTaskDelete(NULL);
+}
+void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+// [latency last us u32][latency max us u32][midi dropped u32][bpm u16]
+// [beat locked u8][external fps u16][external dropped u32][LED count u16]
+// [cpu % u8 per profiled task]
+void sendStats()
+{
+    uint8_t payload[23 + PROFILE_COUNT];
+    put32(payload, hitLatencyLastUs.load());
+    put32(payload + 4, hitLatencyMaxUs.load());
+    put32(payload + 8, midiDropped.load());
+    uint16_t bpm = beatClock.bpm();
+    payload[12] = bpm;
+    payload[13] = bpm >> 8;
+    payload[14] = beatClock.locked();
+    uint16_t fps = extFrames.fps.load();
+    payload[15] = fps;
+    payload[16] = fps >> 8;
+    put32(payload + 17, extFrames.dropped.load());
+    payload[21] = ledOutput.totalPixels;
+    payload[22] = ledOutput.totalPixels >> 8;
+    for (uint8_t id = 0; id < PROFILE_COUNT; id++)
+        payload[23 + id] = profiles[id].cpuPercent.load();
+    protoReply(CMD_GET_STATS, PROTO_OK, payload, sizeof(payload));
+}
+void handleFrame(uint8_t *frame, size_t len)
+{
+    len = cobsDecode(frame, len);
+    if (len < 3)
+        return; // not even a command: nothing to answer to
+    uint8_t command = frame[0];
+    len -= 2;
+    if (crc16(frame, len) != (frame[len] | (frame[len + 1] << 8)))
+    {
+        protoReply(command, PROTO_BAD_CRC);
+        return;
+    }
+    noteActivity();
+    const uint8_t *arg = frame + 1;
+    size_t argLen = len - 1;
+
+    switch (command)
+    {
+    case CMD_PING:
+        protoReply(command, PROTO_OK);
+        break;
+    case CMD_SET_PARAM:
+        if (argLen != 5)
+            protoReply(command, PROTO_BAD_LENGTH);
+        else if (arg[0] >= P_COUNT)
+            protoReply(command, PROTO_BAD_PARAM);
+        else
+        {
+            setParam(arg[0], (int32_t)(arg[1] | arg[2] << 8 | arg[3] << 16 | (uint32_t)arg[4] << 24));
+            protoReply(command, PROTO_OK);
+        }
+        break;
+    case CMD_GET_PARAM:
+        if (argLen != 1)
+            protoReply(command, PROTO_BAD_LENGTH);
+        else if (arg[0] >= P_COUNT)
+            protoReply(command, PROTO_BAD_PARAM);
+        else
+        {
+            uint8_t payload[5] = {arg[0]};
+            put32(payload + 1, getParam(arg[0]));
+            protoReply(command, PROTO_OK, payload, sizeof(payload));
+        }
+        break;
+    case CMD_RECALL_PRESET:
+    case CMD_SAVE_PRESET:
+        if (argLen != 1)
+            protoReply(command, PROTO_BAD_LENGTH);
+        else if (arg[0] > 5)
+            protoReply(command, PROTO_BAD_PARAM);
+        else
+            deferCommand(command, arg[0]);
+        break;
+    case CMD_GET_STATS:
+        sendStats();
+        break;
+    case CMD_SHOW:
+        if (argLen != 1)
+            protoReply(command, PROTO_BAD_LENGTH);
+        else if (arg[0] >= showCount && arg[0] != 0xFF)
+            protoReply(command, PROTO_BAD_PARAM);
+        else
+        {
+            requestShow(arg[0] == 0xFF ? -1 : arg[0]);
+            protoReply(command, PROTO_OK);
+        }
+        break;
+    case CMD_RECORD:
+        if (argLen < 1 || argLen > 2)
+            protoReply(command, PROTO_BAD_LENGTH);
+        else if (arg[0] > 2)
+            protoReply(command, PROTO_BAD_PARAM);
+        else
+        {
+            requestRecorder(arg[0], argLen == 2 ? arg[1] : 1);
+            protoReply(command, PROTO_OK);
+        }
+        break;
+    case CMD_SELFTEST:
+        if (argLen != 1)
+            protoReply(command, PROTO_BAD_LENGTH);
+        else if (deferCommand(command, arg[0] != 0) &&
+                 xTaskCreatePinnedToCore(selfTestTask, "Self Test", 4096, NULL, STORAGE_TASK_PRIORITY, NULL,
+                                         STORAGE_TASK_CORE) != pdPASS)
+        {
+            protoJob.store(0);
+            protoReply(command, PROTO_BUSY);
+        }
+        break;
+    case CMD_PIXELS:
+        if (argLen < 5 || (argLen - 5) % 3)
+            protoReply(command, PROTO_BAD_LENGTH);
+        else
+            extFrames.write(arg[0] | arg[1] << 8, arg[2] | arg[3] << 8, arg + 5, (argLen - 5) / 3,
+                            arg[4] & PIXELS_END_OF_FRAME);
+        break;
+    default:
+        protoReply(command, PROTO_BAD_COMMAND);
+    }
+}
+void serialTask(void *pvParameters)
+{
+    static uint8_t rx[PROTO_MAX_FRAME + PROTO_MAX_FRAME / 254 + 1];
+    size_t rxLen = 0;
+    bool overflow = false;
+
+    while (true)
+    {
+        profileLoopBegin(PROFILE_SERIAL);
+        int n = Serial.available();
+        while (n-- > 0)
+        {
+            uint8_t b = Serial.read();
+            if (b == 0)
+            {
+                if (rxLen && !overflow)
+                    handleFrame(rx, rxLen);
+                rxLen = 0;
+                overflow = false;
+            }
+            else if (rxLen < sizeof(rx))
+                rx[rxLen++] = b;
+            else
+                overflow = true;
+        }
+        extFrames.tick(millis());
+        profileLoopEnd(PROFILE_SERIAL);
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+}
+
+// Idle governor timing, override from build_flags; IDLE_SLEEP_MS 0 never sleeps
+#ifndef IDLE_DIM_MS
+#define IDLE_DIM_MS 60000
+#endif
+#ifndef IDLE_SLEEP_MS
+#define IDLE_SLEEP_MS 300000
+#endif
+#define IDLE_LED_LEVEL 48   // LED output level while dimmed
+#define IDLE_CPU_MHZ 80     // lowest clock that keeps APB (RMT, UART) at 80 MHz
+#define IDLE_OLED_MS 250    // OLED refresh while dimmed
+#define IDLE_WAKE_VELOCITY 100 // the waking hit's peak is gone before the ADC is back
+// false until the SSD1306 answered, lighting and input never wait for it
+atomic<bool> displayReady{false};
+void oledTask(void *pvParameters)
+{
+    if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C))
+    {
+        Serial.println("SSD1306 init failed, running without display");
+        bootMark("no display");
+        while (true)
+            vTaskDelay(portMAX_DELAY);
+    }
+    displayReady.store(true);
+    bootMark("display");
+    display.setTextSize(1);
+    display.setTextColor(SSD1306_WHITE);
+    uint8_t shownStage = IDLE_ACTIVE;
+    while (true)
+    {
+        uint8_t stage = idleStage.load();
+        if (stage != shownStage)
+        {
+            display.dim(stage != IDLE_ACTIVE);
+            display.ssd1306_command(stage == IDLE_SLEEP ? SSD1306_DISPLAYOFF : SSD1306_DISPLAYON);
+            shownStage = stage;
+        }
+        if (stage == IDLE_SLEEP)
+        {
+            vTaskDelay(pdMS_TO_TICKS(IDLE_OLED_MS));
+            continue;
+        }
+        profileLoopBegin(PROFILE_OLED);
+        display.clearDisplay();
+        if (currentMenu.load() == MENU_MAIN)
+        {
+            menu_screen();
+        }
+        else if (currentMenu.load() == BASEMENU)
+            base_screen(0);
+        else if (currentMenu.load() == HITMENU)
+            hit_screen(0);
+        else if (currentMenu.load() == RGB_SCREEN)
+            rgb_screen(0);
+        else if (currentMenu.load() == SELECTED_RGB)
+            rgb_screen(100);
+        else if (currentMenu.load() == SELECTED_BASE)
+            base_screen(100);
+        else if (currentMenu.load() == SELECTED_HIT)
+            hit_screen(100);
+        else if (currentMenu.load() == MEM_SCREEN)
+            mem_screen(mem_screen_data);
+        else if (currentMenu.load() == DIAG_SCREEN)
+            diag_screen();
+        else if (currentMenu.load() == CAL_SCREEN)
+            cal_screen();
+        display.display();
+        profileLoopEnd(PROFILE_OLED);
+        vTaskDelay(pdMS_TO_TICKS(stage == IDLE_ACTIVE ? 1 : IDLE_OLED_MS));
+    }
+}
+
+void buttonTask(void *pvParameters)
+{
+    while (1)
+    {
+        profileLoopBegin(PROFILE_BUTTON);
+        bool pressed = false;
+        fo4
+        {
+            buttonState[i].store(!digitalRead(btnPins[i]));
+            if (buttonState[i].load())
+                pressed = true;
+        }
+        if (pressed)
+            noteActivity();
+        if (currentMenu.load() == MENU_MAIN)
+        {
+            if (buttonState[up].load() || buttonState[down].load())
+            {
+                if (buttonState[up].load())
+                    updateSelectedIndex(selectedMainIndex, menuItemCount, 1);
+                else if (buttonState[down].load())
+                    updateSelectedIndex(selectedMainIndex, menuItemCount, 0);
+            }
+            else if (buttonState[ok].load())
+            {
+                if (selectedMainIndex == static_cast<int>(MainMenu::BASE))
+                    currentMenu.store(BASEMENU);
+                else if (selectedMainIndex == static_cast<int>(MainMenu::HIT))
+                    currentMenu.store(HITMENU);
+                else if (selectedMainIndex == static_cast<int>(MainMenu::DIAG))
+                    currentMenu.store(DIAG_SCREEN);
+                else if (selectedMainIndex == static_cast<int>(MainMenu::TAP))
+                    beatClock.tap(millis());
+                else if (selectedMainIndex == static_cast<int>(MainMenu::SHOW))
+                {
+                    // each press starts the next song, past the last one stops
+                    int next = showSong.load() + 1;
+                    requestShow(next < showCount ? next : -1);
+                }
+                else if (selectedMainIndex == static_cast<int>(MainMenu::CALIBRATE))
+                    currentMenu.store(CAL_SCREEN);
+            }
+            if (buttonState[back].load())
+            {
+                printAllData();
+            }
+        }
+        else if (currentMenu.load() == BASEMENU)
+        {
+            if (buttonState[up].load() || buttonState[down].load())
+            {
+                if (buttonState[up].load())
+                    updateSelectedIndex(selectedBaseIndex, baseItemCount, 1);
+                else if (buttonState[down].load())
+                    updateSelectedIndex(selectedBaseIndex, baseItemCount, 0);
+            }
+            else if (selectedBaseIndex == static_cast<int>(BaseMenu::COLOR) && buttonState[ok])
+            {
+                base.store(1);
+                hit.store(0);
+                currentMenu.store(RGB_SCREEN);
+            }
+            else if (buttonState[ok].load())
+            {
+                currentMenu.store(SELECTED_BASE);
+            }
+            else if (buttonState[back].load())
+            {
+                currentMenu.store(MENU_MAIN);
+            }
+        }
+        else if (currentMenu.load() == HITMENU)
+        {
+            if (buttonState[up].load() || buttonState[down].load())
+            {
+                if (buttonState[up].load())
+                    updateSelectedIndex(selectedHitIndex, hitItemCount, 1);
+                else if (buttonState[down].load())
+                    updateSelectedIndex(selectedHitIndex, hitItemCount, 0);
+            }
+            else if (selectedHitIndex == static_cast<int>(HitMenu::COLOR) && buttonState[ok])
+            {
+                base.store(0);
+                hit.store(1);
+                currentMenu.store(RGB_SCREEN);
+            }
+            else if (buttonState[ok].load())
+            {
+                currentMenu.store(SELECTED_HIT);
+            }
+            else if (buttonState[back].load())
+            {
+                currentMenu.store(MENU_MAIN);
+            }
+        }
+        else if (currentMenu.load() == RGB_SCREEN)
+        {
+            if (buttonState[up].load() || buttonState[down].load())
+            {
+                if (buttonState[up].load())
+                    updateSelectedIndex(selectedRGBIndex, RGBItemCount, 1);
+                else if (buttonState[down].load())
+                    updateSelectedIndex(selectedRGBIndex, RGBItemCount, 0);
+            }
+            else if (buttonState[ok].load())
+            {
+                currentMenu.store(SELECTED_RGB);
+            }
+            else if (buttonState[back].load())
+            {
+                if (base.load())
+                    currentMenu.store(BASEMENU);
+                else if (hit.load())
+                    currentMenu.store(HITMENU);
+            }
+        }
+        else if (currentMenu.load() == SELECTED_RGB)
+        {
+            if (buttonState[up].load())
+            {
+                adjustRGBValue(+1);
+            }
+
+            if (buttonState[down].load())
+            {
+                adjustRGBValue(-1);
+            }
+
+            else if (buttonState[ok].load())
+            {
+                currentMenu.store(RGB_SCREEN);
+            }
+            else if (buttonState[back])
+            {
+                currentMenu.store(RGB_SCREEN);
+            }
+        }
+        else if (currentMenu.load() == SELECTED_BASE)
+        {
+            // if (selectedBaseIndex == static_cast<int>(BaseMenu::BRIGHTNESS) && buttonState[up])
+            // {
+            //     baseData.brightness.store(baseData.brightness.load() + 22.5);
+            // }
+            // else if (selectedBaseIndex == static_cast<int>(BaseMenu::BRIGHTNESS) && buttonState[down])
+            // {
+            //     baseData.brightness.store(baseData.brightness.load() - 22.5);
+            // }
+            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::BRIGHTNESS))
+            {
+                adjustValueHold(baseData.brightness, isUpPressed, isDownPressed, 0, 255, 22.5);
+            }
+            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::SPEED) && buttonState[up])
+            {
+                uint8_t speed = baseData.speed.load() + 1;
+                if (speed > 9)
+                    speed = 9;
+                else if (speed < 0)
+                    speed = 0;
+                baseData.speed.store(speed);
+            }
+            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::SPEED) && buttonState[down])
+            {
+                uint8_t speed = baseData.speed.load() - 1;
+                if (speed > 9)
+                    speed = 9;
+                else if (speed < 0)
+                    speed = 0;
+                baseData.speed.store(speed);
+            }
+            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::STROBE) && buttonState[up])
+            {
+                baseData.strobe.store(true);
+            }
+            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::STROBE) && buttonState[down])
+            {
+                baseData.strobe.store(false);
+            }
+            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::RAINBOW) && buttonState[up])
+            {
+                baseData.rainbow.store(true);
+            }
+            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::RAINBOW) && buttonState[down])
+            {
+                baseData.rainbow.store(false);
+            }
+            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::AUDIO) && buttonState[up])
+            {
+                baseData.audio.store(true);
+            }
+            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::AUDIO) && buttonState[down])
+            {
+                baseData.audio.store(false);
+            }
+            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::SYNC) && buttonState[up])
+            {
+                baseData.sync.store(true);
+            }
+            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::SYNC) && buttonState[down])
+            {
+                baseData.sync.store(false);
+            }
+            selectBaseEffect();
+            if (buttonState[ok].load())
+            {
+                currentMenu.store(BASEMENU);
+            }
+            else if (buttonState[back].load())
+            {
+                currentMenu.store(BASEMENU);
+            }
+        }
+        else if (currentMenu.load() == SELECTED_HIT)
+        {
+            // if (selectedHitIndex == static_cast<int>(HitMenu::BRIGHTNESS) && buttonState[up])
+            // {
+            //     hitData.brightness.store(hitData.brightness.load() + 22.5);
+            // }
+            // else if (selectedHitIndex == static_cast<int>(HitMenu::BRIGHTNESS) && buttonState[down])
+            // {
+            //     hitData.brightness.store(hitData.brightness.load() - 22.5);
+            // }
+            if (selectedHitIndex.load() == static_cast<int>(HitMenu::BRIGHTNESS))
+            {
+                adjustValueHold(hitData.brightness, isUpPressed, isDownPressed, 0, 255, 22.5);
+            }
+            if (selectedHitIndex.load() == static_cast<int>(HitMenu::TAIL) && buttonState[up].load())
+            {
+                uint8_t tail = hitData.tail.load() + 1;
+                if (tail > 9)
+                    tail = 9;
+                else if (tail < 0)
+                    tail = 0;
+                hitData.tail.store(tail);
+            }
+            else if (selectedHitIndex.load() == static_cast<int>(HitMenu::TAIL) && buttonState[down].load())
+            {
+                uint8_t tail = hitData.tail.load() - 1;
+                if (tail > 9)
+                    tail = 9;
+                else if (tail < 0)
+                    tail = 0;
+                hitData.tail.store(tail);
+            }
+            if (selectedHitIndex.load() == static_cast<int>(HitMenu::CHASE) && buttonState[up].load())
+            {
+                hitData.chase.store(1);
+            }
+            else if (selectedHitIndex.load() == static_cast<int>(HitMenu::CHASE) && buttonState[down].load())
+            {
+                hitData.chase.store(0);
+            }
+            if (selectedHitIndex.load() == static_cast<int>(HitMenu::RAINBOW) && buttonState[up].load())
+            {
+                hitData.rainbow.store(1);
+            }
+            else if (selectedHitIndex.load() == static_cast<int>(HitMenu::RAINBOW) && buttonState[down].load())
+            {
+                hitData.rainbow.store(0);
+            }
+            selectHitEffect();
+            if (buttonState[ok].load())
+            {
+                currentMenu.store(HITMENU);
+            }
+            else if (buttonState[back].load())
+            {
+                currentMenu.store(HITMENU);
+            }
+        }
+        else if (currentMenu.load() == DIAG_SCREEN)
+        {
+            if (buttonState[ok].load())
+            {
+                printTaskProfile();
+                printEffectStats();
+            }
+            else if (buttonState[back].load())
+            {
+                currentMenu.store(MENU_MAIN);
+            }
+        }
+        else if (currentMenu.load() == CAL_SCREEN)
+        {
+            // pick a pad, ok runs the wizard, ok on the result saves it and
+            // moves to the next pad; back cancels a run or leaves
+            uint8_t step = padCalibrator.step.load();
+            if (step == CAL_IDLE && (buttonState[up].load() || buttonState[down].load()))
+                updateSelectedIndex(selectedCalPad, NUM_PADS, buttonState[up].load());
+            else if (step == CAL_IDLE && buttonState[ok].load())
+                padCalibrator.start(selectedCalPad.load());
+            else if (step == CAL_DONE && buttonState[ok].load())
+            {
+                padCalibrator.apply();
+                savePadCalibration();
+                updateSelectedIndex(selectedCalPad, NUM_PADS, 0);
+            }
+            else if (buttonState[back].load())
+            {
+                if (step == CAL_IDLE)
+                    currentMenu.store(MENU_MAIN);
+                padCalibrator.cancel();
+            }
+        }
+        profileLoopEnd(PROFILE_BUTTON);
+        while (pressed)
+        {
+            pressed = false;
+            fo4
+            {
+                buttonState[i].store(!digitalRead(btnPins[i]));
+                if (buttonState[i].load())
+                    pressed = true;
+            }
+            vTaskDelay(pdMS_TO_TICKS(1));
+        }
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+}
+
+// Lub-dub: pulse, gap, pulse, fade, rest. The original fixed timings
+// (100 / 50 / 200 / 450 / 500 ms) are stretched over one beat so the pulse
+// follows the beat clock; the level for `phase` within `period`.
+uint8_t heartbeatLevel(uint32_t phase, uint32_t period)
+{
+    uint32_t t = phase * 1300 / period;
+    if (t < 100)
+        return 255;
+    if (t < 150)
+        return 0;
+    if (t < 350)
+        return 255;
+    if (t < 800)
+        return 255 - (t - 350) * 255 / 450;
+    return 0;
+}
+// Audio-reactive base. A line-level input (biased to mid-rail) on an ADC1
+// pin is sampled at AUDIO_SAMPLE_RATE from an esp_timer callback, which runs
+// in task context so analogRead stays legal. Every full block is handed to
+// audioTask for a windowed Q15 FFT and reduced to bass / mid / high levels
+// (0-255, auto-ranged). Sampling only runs while the audio base is enabled.
+#define AUDIO_PIN 34
+#define AUDIO_SAMPLE_RATE 8000
+#define AUDIO_FFT_BITS 8
+#define AUDIO_FFT_SIZE (1 << AUDIO_FFT_BITS)
+#define AUDIO_BASS_HZ 250
+#define AUDIO_MID_HZ 2000
+#define AUDIO_BIN(hz) ((hz) * AUDIO_FFT_SIZE / AUDIO_SAMPLE_RATE)
+
+int16_t audioSamples[2][AUDIO_FFT_SIZE];
+volatile uint8_t audioFill = 0;
+uint16_t audioIndex = 0;
+esp_timer_handle_t audioTimer = NULL;
+atomic<uint8_t> audioBass{0}, audioMid{0}, audioHigh{0};
+
+int16_t fftSin[AUDIO_FFT_SIZE * 3 / 4]; // cos(k) = fftSin[k + N/4]
+int16_t fftWindow[AUDIO_FFT_SIZE];
+
+void fftInit()
+{
+    for (int k = 0; k < AUDIO_FFT_SIZE * 3 / 4; k++)
+        fftSin[k] = (int16_t)(32767 * sinf(2 * PI * k / AUDIO_FFT_SIZE));
+    for (int k = 0; k < AUDIO_FFT_SIZE; k++)
+        fftWindow[k] = (int16_t)(32767 * (0.5f - 0.5f * cosf(2 * PI * k / (AUDIO_FFT_SIZE - 1))));
+}
+// in-place radix-2 DIT, every stage scaled by 1/2 so Q15 cannot overflow
+void fftQ15(int16_t *re, int16_t *im)
+{
+    for (uint16_t i = 1, j = 0; i < AUDIO_FFT_SIZE; i++)
+    {
+        uint16_t bit = AUDIO_FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+        {
+            swap(re[i], re[j]);
+            swap(im[i], im[j]);
+        }
+    }
+    for (uint16_t len = 2; len <= AUDIO_FFT_SIZE; len <<= 1)
+    {
+        uint16_t half = len >> 1, step = AUDIO_FFT_SIZE / len;
+        for (uint16_t i = 0; i < AUDIO_FFT_SIZE; i += len)
+        {
+            for (uint16_t k = 0; k < half; k++)
+            {
+                int32_t wr = fftSin[k * step + AUDIO_FFT_SIZE / 4], wi = -fftSin[k * step];
+                uint16_t a = i + k, b = a + half;
+                int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+                int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+                re[b] = (re[a] - tr) >> 1;
+                im[b] = (im[a] - ti) >> 1;
+                re[a] = (re[a] + tr) >> 1;
+                im[a] = (im[a] + ti) >> 1;
+            }
+        }
+    }
+}
+// log2 in 1/4 steps, 0..~250 for a 64-bit energy
+uint8_t log2q(uint64_t e)
+{
+    if (e == 0)
+        return 0;
+    uint8_t msb = 63 - __builtin_clzll(e);
+    uint8_t frac = msb >= 2 ? (e >> (msb - 2)) & 3 : 0;
+    return msb * 4 + frac;
+}
+// Auto-ranging band follower: fast attack, slow release against a decaying
+// peak and a creeping floor, so quiet and loud rooms both use 0-255.
+struct BandFollower
+{
+    uint8_t peak = 1, low = 0;
+    uint16_t out = 0; // 8.8 fixed point
+
+    uint8_t update(uint8_t level)
+    {
+        if (level > peak)
+            peak = level;
+        else if (peak > low + 8)
+            peak--;
+        if (level < low)
+            low = level;
+        else if (low + 8 < peak)
+            low++;
+        uint16_t target = (uint16_t)(max(0, level - low) * 255 / max(1, peak - low)) << 8;
+        out = target > out ? target : out - ((out - target) >> 3);
+        return out >> 8;
+    }
+};
+
+void audioSampleCallback(void *)
+{
+    audioSamples[audioFill][audioIndex++] = analogRead(AUDIO_PIN);
+    if (audioIndex == AUDIO_FFT_SIZE)
+    {
+        audioIndex = 0;
+        audioFill ^= 1;
+        xTaskNotifyGive(audioTaskHandle);
+    }
+}
+// one block of raw ADC samples -> spectral energy in bass / mid / high
+void audioEnergy(const int16_t *block, uint64_t energy[3])
+{
+    static int16_t re[AUDIO_FFT_SIZE], im[AUDIO_FFT_SIZE];
+    int32_t mean = 0;
+    for (int k = 0; k < AUDIO_FFT_SIZE; k++)
+        mean += block[k];
+    mean /= AUDIO_FFT_SIZE;
+    for (int k = 0; k < AUDIO_FFT_SIZE; k++)
+    {
+        // 12-bit ADC around mid-rail -> Q15, then Hann window
+        re[k] = ((block[k] - mean) * 8 * fftWindow[k]) >> 15;
+        im[k] = 0;
+    }
+    fftQ15(re, im);
+
+    energy[0] = energy[1] = energy[2] = 0;
+    for (int k = 1; k < AUDIO_FFT_SIZE / 2; k++)
+    {
+        uint8_t band = k < AUDIO_BIN(AUDIO_BASS_HZ) ? 0 : k < AUDIO_BIN(AUDIO_MID_HZ) ? 1 : 2;
+        energy[band] += (int32_t)re[k] * re[k] + (int32_t)im[k] * im[k];
+    }
+}
+void audioTask(void *pvParameters)
+{
+    BandFollower bass, mid, high;
+    bool running = false;
+
+    fftInit();
+    analogSetPinAttenuation(AUDIO_PIN, ADC_11db);
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = audioSampleCallback;
+    timerArgs.name = "audio";
+    esp_timer_create(&timerArgs, &audioTimer);
+
+    while (true)
+    {
+        if (baseData.audio.load() != running)
+        {
+            running = !running;
+            if (running)
+                esp_timer_start_periodic(audioTimer, 1000000 / AUDIO_SAMPLE_RATE);
+            else
+                esp_timer_stop(audioTimer);
+        }
+        if (!running || ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100)) == 0)
+        {
+            if (!running)
+                vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        profileLoopBegin(PROFILE_AUDIO);
+
+        uint64_t energy[3];
+        audioEnergy(audioSamples[audioFill ^ 1], energy);
+        audioBass.store(bass.update(log2q(energy[0])));
+        audioMid.store(mid.update(log2q(energy[1])));
+        audioHigh.store(high.update(log2q(energy[2])));
+        profileLoopEnd(PROFILE_AUDIO);
+    }
+}
+
+// Gradient palettes. A palette is up to 16 stops (position 0-255, colour)
+// expanded once, when selected, into a 256-entry table, so any effect picks
+// a colour with one lookup. Two stops at neighbouring positions give a hard
+// edge. A preset names a built-in palette or lists its own stops:
+//   "palette": "fire"   or   "palette": [[0, 0, 0, 64], [255, 0, 255, 255]]
+// Without one, colour effects use the preset colour and the rainbow
+// effects the hue wheel.
+#define PALETTE_STOPS 16
+#define PALETTE_NONE 0
+#define PALETTE_CUSTOM 0xFF
+struct PaletteStop
+{
+    uint8_t pos, r, g, b;
+};
+struct GradientPalette
+{
+    const char *name;
+    uint8_t count; // no stops: the gamma-corrected hue wheel
+    PaletteStop stops[PALETTE_STOPS];
+};
+const GradientPalette builtinPalettes[] = {
+    {"none", 0, {}},
+    {"rainbow", 0, {}},
+    // the seven bands of the original rainbow chase
+    {"rainbow7", 14, {{0, 255, 0, 0}, {35, 255, 0, 0}, {36, 255, 127, 0}, {72, 255, 127, 0}, {73, 255, 255, 0}, {108, 255, 255, 0}, {109, 0, 255, 0}, {145, 0, 255, 0}, {146, 0, 255, 255}, {181, 0, 255, 255}, {182, 0, 0, 255}, {218, 0, 0, 255}, {219, 148, 0, 211}, {255, 148, 0, 211}}},
+    {"fire", 5, {{0, 0, 0, 0}, {64, 128, 0, 0}, {128, 255, 64, 0}, {192, 255, 192, 0}, {255, 255, 255, 160}}},
+    {"lava", 5, {{0, 0, 0, 0}, {80, 96, 0, 0}, {160, 255, 32, 0}, {220, 255, 128, 0}, {255, 255, 255, 255}}},
+    {"ocean", 5, {{0, 0, 0, 32}, {64, 0, 32, 128}, {128, 0, 128, 192}, {192, 32, 192, 192}, {255, 160, 255, 255}}},
+    {"ice", 4, {{0, 0, 0, 64}, {96, 0, 64, 192}, {192, 128, 192, 255}, {255, 255, 255, 255}}},
+    {"forest", 4, {{0, 0, 32, 0}, {96, 0, 128, 16}, {176, 64, 160, 0}, {255, 160, 255, 64}}},
+    {"sunset", 5, {{0, 32, 0, 64}, {64, 128, 0, 128}, {128, 255, 32, 64}, {192, 255, 128, 0}, {255, 255, 224, 96}}},
+    {"party", 6, {{0, 85, 0, 171}, {51, 171, 0, 85}, {102, 255, 0, 0}, {153, 171, 85, 0}, {204, 0, 171, 85}, {255, 0, 85, 171}}}};
+#define PALETTE_BUILTINS (sizeof(builtinPalettes) / sizeof(builtinPalettes[0]))
+
+// Double buffered like the effect programs: expand into the idle table, then
+// publish it. Each expansion gets a new tag; an effect keeps the tag it began
+// with and pins that table for the length of a frame (PalettePin), so a
+// crossfade still draws the outgoing palette while it is there. Expanding
+// retires the idle table and waits for its pins to drain before writing.
+class Palette
+{
+public:
+    Palette() { expand(NULL, 0); }
+    // stops must be sorted by position
+    void expand(const PaletteStop *stops, uint8_t count)
+    {
+        uint8_t idle = !current.load();
+        tag[idle].store(0);
+        while (pins[idle].load())
+            vTaskDelay(1);
+        uint32_t *out = table[idle];
+        uint8_t next = 0;
+        for (int k = 0; k < 256; k++)
+        {
+            if (count == 0)
             {
-                base.store(0);
-                hit.store(1);
-                currentMenu.store(RGB_SCREEN);
+                out[k] = Adafruit_NeoPixel::gamma32(Adafruit_NeoPixel::ColorHSV(k * 256));
+                continue;
             }
-            else if (buttonState[ok].load())
+            while (next < count && stops[next].pos < k)
+                next++;
+            const PaletteStop &b = stops[min<uint8_t>(next, count - 1)];
+            const PaletteStop &a = stops[next > 0 ? next - 1 : 0];
+            int span = b.pos - a.pos, t = k - a.pos;
+            if (span <= 0 || t <= 0)
+                out[k] = Adafruit_NeoPixel::Color(b.r, b.g, b.b);
+            else
+                out[k] = Adafruit_NeoPixel::Color(a.r + (b.r - a.r) * t / span, a.g + (b.g - a.g) * t / span,
+                                                  a.b + (b.b - a.b) * t / span);
+        }
+        tag[idle].store(++generation);
+        current.store(idle);
+    }
+    // tag of the table new effects should draw from
+    uint32_t latest() { return tag[current.load()].load(); }
+    // the table tagged `tag`, or the latest one once that has been retired
+    const uint32_t *pin(uint32_t want)
+    {
+        while (true)
+        {
+            for (uint8_t k = 0; k < 2; k++)
             {
-                currentMenu.store(SELECTED_HIT);
+                pins[k]++;
+                if (want && tag[k].load() == want)
+                    return table[k];
+                pins[k]--;
             }
-            else if (buttonState[back].load())
+            want = latest();
+        }
+    }
+    void unpin(const uint32_t *lut) { pins[lut == table[1]]--; }
+
+private:
+    uint32_t table[2][256];
+    atomic<uint32_t> tag[2] = {{0}, {0}}; // 0 while a table is being rewritten
+    atomic<uint8_t> pins[2] = {{0}, {0}};
+    atomic<uint8_t> current{0};
+    uint32_t generation = 0; // written by expand() only
+};
+Palette palettes[2];
+
+atomic<uint8_t> &paletteIndex(uint8_t layer)
+{
+    return layer == LAYER_BASE ? baseData.palette : hitData.palette;
+}
+void selectPalette(uint8_t layer, uint8_t index)
+{
+    if (index >= PALETTE_BUILTINS)
+        index = PALETTE_NONE;
+    const GradientPalette &pal = builtinPalettes[index];
+    palettes[layer].expand(pal.stops, pal.count);
+    paletteIndex(layer).store(index);
+}
+void paletteFromJson(uint8_t layer, JsonVariantConst value)
+{
+    JsonArrayConst list = value.as<JsonArrayConst>();
+    if (list.isNull())
+    {
+        const char *name = value | "none";
+        uint8_t index = PALETTE_NONE;
+        for (uint8_t i = 0; i < PALETTE_BUILTINS; i++)
+            if (strcmp(name, builtinPalettes[i].name) == 0)
+                index = i;
+        selectPalette(layer, index);
+        return;
+    }
+    PaletteStop stops[PALETTE_STOPS];
+    uint8_t count = 0;
+    for (JsonArrayConst stop : list)
+    {
+        if (count == PALETTE_STOPS)
+            break;
+        PaletteStop s = {stop[0], stop[1], stop[2], stop[3]};
+        // insertion sort by position
+        uint8_t i = count++;
+        for (; i > 0 && stops[i - 1].pos > s.pos; i--)
+            stops[i] = stops[i - 1];
+        stops[i] = s;
+    }
+    if (count == 0)
+    {
+        selectPalette(layer, PALETTE_NONE);
+        return;
+    }
+    palettes[layer].expand(stops, count);
+    paletteIndex(layer).store(PALETTE_CUSTOM);
+}
+void paletteToJson(uint8_t layer, JsonObject item)
+{
+    // custom stops are left as they are in the file
+    uint8_t index = paletteIndex(layer).load();
+    if (index == PALETTE_NONE)
+        item.remove("palette");
+    else if (index != PALETTE_CUSTOM)
+        item["palette"] = builtinPalettes[index].name;
+}
+const char *paletteName(uint8_t layer)
+{
+    uint8_t index = paletteIndex(layer).load();
+    return index == PALETTE_CUSTOM ? "custom" : builtinPalettes[index].name;
+}
+uint32_t scaleColor(uint32_t color, uint8_t level)
+{
+    return (((color >> 16) & 0xFF) * level / 255) << 16 | (((color >> 8) & 0xFF) * level / 255) << 8 |
+           ((color & 0xFF) * level / 255);
+}
+
+// Effect programs. A compiled program (tools/fxasm.py -> data/fx/*.fxb) is
+// referenced by a preset's "program" key and runs once per pixel per frame
+// on a 16-deep int32 stack. Inputs are time, pixel index/count, velocity,
+// beat phase, audio bands, the preset colour and palette; the value left on top is
+// the pixel colour 0xRRGGBB. Jumps only go forward, so a pixel costs at most
+// the program length in instructions, and a frame is capped at
+// VM_MAX_OPS_PER_FRAME; pixels past the cap stay dark and count as overruns.
+//
+// File: "FXB1", u16 duration ms (hit programs), u16 code length, code.
+#define VM_MAX_CODE 256
+#define VM_STACK 16
+#define VM_REGS 8
+#define VM_MAX_OPS_PER_FRAME 32768
+enum VmOp
+{
+    OP_END = 0x00,
+    OP_PUSH8 = 0x01, // s8
+    OP_PUSH16,       // s16
+    OP_DUP,
+    OP_DROP,
+    OP_SWAP,
+    OP_OVER,
+    OP_LD, // reg
+    OP_ST, // reg
+    OP_T = 0x10,
+    OP_I,
+    OP_N,
+    OP_V,
+    OP_BEAT,
+    OP_COLOR,
+    OP_BASS,
+    OP_MID,
+    OP_HIGH,
+    OP_ADD = 0x20,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_MULQ, // (a * b) >> 8
+    OP_NEG,
+    OP_ABS,
+    OP_MIN,
+    OP_MAX,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+    OP_LT = 0x30,
+    OP_GT,
+    OP_EQ,
+    OP_NOT,
+    OP_JZ = 0x38, // u8 forward offset
+    OP_JMP,       // u8 forward offset
+    OP_SIN8 = 0x40,
+    OP_TRI8,
+    OP_CLAMP8,
+    OP_RGB = 0x48, // r g b -> colour
+    OP_HSV,        // hue16 sat val -> colour, gamma corrected
+    OP_SCALE,      // colour k -> colour * k / 255
+    OP_PAL         // index -> palette colour
+};
+struct VmProgram
+{
+    uint16_t duration;
+    uint16_t length;
+    uint8_t code[VM_MAX_CODE];
+};
+struct VmInputs
+{
+    int32_t time, count, velocity, beat, color, bass, mid, high;
+    const uint32_t *palette;
+};
+// Double buffered per slot: a load fills the idle copy, then publishes it. A
+// frame pins the copy it runs (vmPin), and a load waits for the idle copy's
+// pins to drain before overwriting it, so two quick loads cannot rewrite a
+// program that is still running.
+VmProgram vmPrograms[2][2];
+atomic<VmProgram *> vmActive[2];
+atomic<uint8_t> vmPins[2][2];
+
+uint8_t vmOperandSize(uint8_t op)
+{
+    if (op == OP_PUSH16)
+        return 2;
+    if (op == OP_PUSH8 || op == OP_LD || op == OP_ST || op == OP_JZ || op == OP_JMP)
+        return 1;
+    return 0;
+}
+bool vmValidOp(uint8_t op)
+{
+    return op <= OP_ST || (op >= OP_T && op <= OP_HIGH) || (op >= OP_ADD && op <= OP_SHR) ||
+           (op >= OP_LT && op <= OP_NOT) || op == OP_JZ || op == OP_JMP ||
+           (op >= OP_SIN8 && op <= OP_CLAMP8) || (op >= OP_RGB && op <= OP_PAL);
+}
+// walk the code once so the interpreter can trust opcodes and jump targets
+bool vmVerify(const VmProgram &prog)
+{
+    for (uint16_t pc = 0; pc < prog.length;)
+    {
+        uint8_t op = prog.code[pc];
+        if (!vmValidOp(op) || pc + 1 + vmOperandSize(op) > prog.length)
+            return false;
+        if ((op == OP_LD || op == OP_ST) && prog.code[pc + 1] >= VM_REGS)
+            return false;
+        if ((op == OP_JZ || op == OP_JMP) && pc + 2 + prog.code[pc + 1] > prog.length)
+            return false;
+        pc += 1 + vmOperandSize(op);
+    }
+    return true;
+}
+// reads and verifies a program file
+bool vmReadProgram(const char *path, VmProgram &prog)
+{
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        Serial.print("Missing effect program ");
+        Serial.println(path);
+        return false;
+    }
+    uint8_t header[8];
+    bool ok = file.read(header, sizeof(header)) == sizeof(header) && memcmp(header, "FXB1", 4) == 0;
+    if (ok)
+    {
+        prog.duration = header[4] | header[5] << 8;
+        prog.length = header[6] | header[7] << 8;
+        ok = prog.length <= VM_MAX_CODE && file.read(prog.code, prog.length) == prog.length && vmVerify(prog);
+    }
+    file.close();
+    if (!ok)
+    {
+        Serial.print("Bad effect program ");
+        Serial.println(path);
+    }
+    return ok;
+}
+// the slot's program, NULL without one; vmUnpin() it after the frame
+const VmProgram *vmPin(uint8_t slot)
+{
+    while (VmProgram *prog = vmActive[slot].load())
+    {
+        atomic<uint8_t> &pins = vmPins[slot][prog - vmPrograms[slot]];
+        pins++;
+        if (vmActive[slot].load() == prog)
+            return prog;
+        pins--; // republished meanwhile
+    }
+    return NULL;
+}
+void vmUnpin(uint8_t slot, const VmProgram *prog)
+{
+    if (prog)
+        vmPins[slot][prog - vmPrograms[slot]]--;
+}
+VmProgram &vmIdle(uint8_t slot)
+{
+    uint8_t idle = vmActive[slot].load() == &vmPrograms[slot][0];
+    while (vmPins[slot][idle].load())
+        vTaskDelay(1);
+    return vmPrograms[slot][idle];
+}
+// copies an already verified program into the slot, NULL clears it
+void vmPublish(uint8_t slot, const VmProgram *prog)
+{
+    if (prog == NULL)
+    {
+        vmActive[slot].store(NULL);
+        return;
+    }
+    VmProgram &idle = vmIdle(slot);
+    idle = *prog;
+    vmActive[slot].store(&idle);
+}
+bool vmLoadProgram(uint8_t slot, const char *path)
+{
+    if (path == NULL || path[0] == 0)
+    {
+        vmActive[slot].store(NULL);
+        return true;
+    }
+    VmProgram &prog = vmIdle(slot);
+    bool ok = vmReadProgram(path, prog);
+    vmActive[slot].store(ok ? &prog : NULL);
+    return ok;
+}
+// colour of pixel `index`; `budget` is the frame's remaining instruction count
+uint32_t vmRun(const VmProgram &prog, const VmInputs &in, int32_t index, int32_t &budget)
+{
+    // three guard slots below the stack absorb an underflowing op's writes
+    // before the fault check after it
+    int32_t stackMem[VM_STACK + 3], regs[VM_REGS] = {0};
+    int32_t *stack = stackMem + 3;
+    int8_t sp = -1;
+    uint16_t pc = 0;
+    while (pc < prog.length)
+    {
+        if (--budget < 0)
+            return 0;
+        uint8_t op = prog.code[pc++];
+        // every op pops at most 3 and pushes at most 1
+        if (sp >= VM_STACK - 1 && op != OP_END)
+        {
+            vmFaults.store(vmFaults.load() + 1);
+            return 0;
+        }
+        int32_t a = sp >= 0 ? stack[sp] : 0, b = sp >= 1 ? stack[sp - 1] : 0, c = sp >= 2 ? stack[sp - 2] : 0;
+        switch (op)
+        {
+        case OP_END:
+            pc = prog.length;
+            break;
+        case OP_PUSH8:
+            stack[++sp] = (int8_t)prog.code[pc++];
+            break;
+        case OP_PUSH16:
+            stack[++sp] = (int16_t)(prog.code[pc] | prog.code[pc + 1] << 8);
+            pc += 2;
+            break;
+        case OP_DUP:
+            stack[++sp] = a;
+            break;
+        case OP_DROP:
+            sp--;
+            break;
+        case OP_SWAP:
+            stack[sp] = b;
+            stack[sp - 1] = a;
+            break;
+        case OP_OVER:
+            stack[++sp] = b;
+            break;
+        case OP_LD:
+            stack[++sp] = regs[prog.code[pc++]];
+            break;
+        case OP_ST:
+            regs[prog.code[pc++]] = a;
+            sp--;
+            break;
+        case OP_T:
+            stack[++sp] = in.time;
+            break;
+        case OP_I:
+            stack[++sp] = index;
+            break;
+        case OP_N:
+            stack[++sp] = in.count;
+            break;
+        case OP_V:
+            stack[++sp] = in.velocity;
+            break;
+        case OP_BEAT:
+            stack[++sp] = in.beat;
+            break;
+        case OP_COLOR:
+            stack[++sp] = in.color;
+            break;
+        case OP_BASS:
+            stack[++sp] = in.bass;
+            break;
+        case OP_MID:
+            stack[++sp] = in.mid;
+            break;
+        case OP_HIGH:
+            stack[++sp] = in.high;
+            break;
+        // arithmetic wraps like the uint32_t it is done in
+        case OP_NEG:
+            stack[sp] = 0u - (uint32_t)a;
+            break;
+        case OP_ABS:
+            stack[sp] = a < 0 ? 0u - (uint32_t)a : a;
+            break;
+        case OP_NOT:
+            stack[sp] = !a;
+            break;
+        case OP_SIN8:
+            stack[sp] = Adafruit_NeoPixel::sine8(a);
+            break;
+        case OP_TRI8:
+            stack[sp] = (a & 0x100) ? 255 - (a & 0xFF) : (a & 0xFF);
+            break;
+        case OP_CLAMP8:
+            stack[sp] = constrain(a, 0, 255);
+            break;
+        case OP_PAL:
+            stack[sp] = in.palette[a & 0xFF];
+            break;
+        case OP_JZ:
+            sp--;
+            if (a == 0)
+                pc += prog.code[pc];
+            pc++;
+            break;
+        case OP_JMP:
+            pc += prog.code[pc] + 1;
+            break;
+        case OP_RGB:
+            sp -= 2;
+            stack[sp] = (uint32_t)constrain(c, 0, 255) << 16 | constrain(b, 0, 255) << 8 | constrain(a, 0, 255);
+            break;
+        case OP_HSV:
+            sp -= 2;
+            stack[sp] = Adafruit_NeoPixel::gamma32(Adafruit_NeoPixel::ColorHSV(c, constrain(b, 0, 255), constrain(a, 0, 255)));
+            break;
+        default:
+            // binary operators: b op a
+            sp--;
+            switch (op)
             {
-                currentMenu.store(MENU_MAIN);
+            case OP_ADD:
+                stack[sp] = (uint32_t)b + (uint32_t)a;
+                break;
+            case OP_SUB:
+                stack[sp] = (uint32_t)b - (uint32_t)a;
+                break;
+            case OP_MUL:
+                stack[sp] = (uint32_t)b * (uint32_t)a;
+                break;
+            case OP_DIV:
+                // x / 0 is 0, and INT32_MIN / -1 wraps instead of trapping
+                stack[sp] = a == -1 ? 0u - (uint32_t)b : a ? b / a : 0;
+                break;
+            case OP_MOD:
+                stack[sp] = a == -1 || a == 0 ? 0 : b % a;
+                break;
+            case OP_MULQ:
+                stack[sp] = (int64_t)b * a >> 8;
+                break;
+            case OP_MIN:
+                stack[sp] = min(a, b);
+                break;
+            case OP_MAX:
+                stack[sp] = max(a, b);
+                break;
+            case OP_AND:
+                stack[sp] = b & a;
+                break;
+            case OP_OR:
+                stack[sp] = b | a;
+                break;
+            case OP_XOR:
+                stack[sp] = b ^ a;
+                break;
+            case OP_SHL:
+                stack[sp] = (uint32_t)b << (a & 31);
+                break;
+            case OP_SHR:
+                stack[sp] = b >> (a & 31);
+                break;
+            case OP_LT:
+                stack[sp] = b < a;
+                break;
+            case OP_GT:
+                stack[sp] = b > a;
+                break;
+            case OP_EQ:
+                stack[sp] = b == a;
+                break;
+            case OP_SCALE:
+            {
+                uint32_t k = constrain(a, 0, 255);
+                stack[sp] = (((b >> 16) & 0xFF) * k / 255) << 16 | (((b >> 8) & 0xFF) * k / 255) << 8 | ((b & 0xFF) * k / 255);
+                break;
             }
+            }
+        }
+        if (sp < -1)
+        {
+            vmFaults.store(vmFaults.load() + 1);
+            return 0;
+        }
+    }
+    return sp >= 0 ? (uint32_t)stack[sp] & 0xFFFFFF : 0;
+}
+void vmRender(LedSegment &strip, const VmProgram &prog, const VmInputs &in)
+{
+    int32_t budget = VM_MAX_OPS_PER_FRAME;
+    for (int i = 0; i < strip.numPixels(); i++)
+        strip.setPixelColor(i, vmRun(prog, in, i, budget));
+    if (budget < 0)
+        vmOverruns.store(vmOverruns.load() + 1);
+}
+
+// Effects. Each effect is a class with three static methods:
+//   begin(s)          once, when the effect starts (a hit, or a base switch)
+//   step(s)           advance to s.now; set s.next to when the frame next
+//                     changes (EFFECT_DONE ends a hit) and return whether to draw
+//   render(strip, s)  draw the current frame
+// and is registered in EffectId order in the Effects list below, which is
+// checked at compile time. The option flags only pick an effect when they
+// change; a frame is one indexed call through Effects::table.
+//
+// Effects are generated from the absolute millis() clock rather than by
+// sleeping between frames: every pad computes the same phase for the same
+// instant, a hit can cut in at any point, and the base picks up exactly where
+// the clock says it should be afterwards.
+#define EFFECT_DONE UINT32_MAX
+const uint32_t baseEffectInterval = 20;
+struct EffectParams
+{
+    uint8_t red, green, blue, brightness, speed, tail, velocity;
+    bool rainbow, strobe, sync;
+    Palette *palette;     // the preset's palette, or the hue wheel
+    uint32_t paletteTag;  // the expansion the effect began with
+    const uint32_t *lut;  // that table, valid while a PalettePin holds it
+    bool paletted;        // a palette was chosen, colour effects sample it
+};
+struct EffectState
+{
+    uint8_t effect;
+    EffectParams p;
+    uint16_t count;            // pixels in the segment
+    uint32_t start, now, next; // begin() time, frame time, next frame due
+    uint32_t frames;           // frames drawn since begin()
+    // effect defined
+    int32_t pos;
+    uint32_t color, mark;
+    uint8_t level;
+    bool gradient; // fill with the palette across the segment, not s.color
+    uint32_t seed; // per hit, for effects that vary from hit to hit
+    const struct FixedInputs *fixed; // NULL: the live inputs below
+};
+// Stand-ins for the live inputs some effects read (audio bands, beat clock,
+// host frames, effect programs), so goldenRun can render those effects too.
+// Effects reach the inputs through the helpers below, never directly.
+struct FixedInputs
+{
+    uint8_t bass, mid, high;
+    uint32_t beatMs;              // a locked tempo with a beat at t = 0
+    const uint8_t *frame;         // host frame, rgb per pixel of the segment
+    const VmProgram *programs[2]; // VM_BASE, VM_HIT
+};
+void effectAudio(const EffectState &s, uint8_t &bass, uint8_t &mid, uint8_t &high)
+{
+    bass = s.fixed ? s.fixed->bass : audioBass.load();
+    mid = s.fixed ? s.fixed->mid : audioMid.load();
+    high = s.fixed ? s.fixed->high : audioHigh.load();
+}
+// where `now` falls in the beat; returns whether the tempo is locked
+bool effectBeat(const EffectState &s, uint32_t now, uint32_t *phase, uint32_t *period)
+{
+    if (s.fixed)
+    {
+        *period = s.fixed->beatMs;
+        *phase = now % *period;
+        return true;
+    }
+    beatClock.beat(now, phase, period);
+    return beatClock.locked();
+}
+// the slot's program, NULL without one; effectProgramDone() after the frame
+const VmProgram *effectProgram(const EffectState &s, uint8_t slot)
+{
+    return s.fixed ? s.fixed->programs[slot] : vmPin(slot);
+}
+void effectProgramDone(const EffectState &s, uint8_t slot, const VmProgram *prog)
+{
+    if (!s.fixed)
+        vmUnpin(slot, prog);
+}
+VmInputs vmInputs(const EffectState &s, uint32_t time, LedSegment &strip, uint8_t velocity)
+{
+    uint32_t phase, period;
+    uint8_t bass, mid, high;
+    effectBeat(s, s.now, &phase, &period);
+    effectAudio(s, bass, mid, high);
+    VmInputs in = {(int32_t)time, strip.numPixels(), velocity, (int32_t)(phase * 256 / period),
+                   (int32_t)strip.Color(s.p.red, s.p.green, s.p.blue), bass, mid, high, s.p.lut};
+    return in;
+}
+// pins the state's palette table for one frame
+struct PalettePin
+{
+    EffectParams &p;
+    PalettePin(EffectParams &p) : p(p)
+    {
+        if (p.palette)
+            p.lut = p.palette->pin(p.paletteTag);
+    }
+    ~PalettePin()
+    {
+        if (p.palette)
+            p.palette->unpin(p.lut);
+    }
+};
+struct EffectEntry
+{
+    bool hit;
+    void (*begin)(EffectState &s);
+    bool (*step)(EffectState &s);
+    void (*render)(LedSegment &strip, const EffectState &s);
+};
+
+struct HitEffect
+{
+    static const bool hit = true;
+    static void begin(EffectState &) {}
+};
+struct BaseEffect
+{
+    static const bool hit = false;
+    static void begin(EffectState &) {}
+};
+// whole segment in s.color, or the palette gradient, at brightness s.level
+struct FillEffect : BaseEffect
+{
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        for (int i = 0; i < s.count; i++)
+            strip.setPixelColor(i, s.gradient ? s.p.lut[i * 256 / s.count] : s.color);
+        strip.setBrightness(s.level);
+    }
+};
+
+struct HitRainbowChase : HitEffect
+{
+    static const EffectId id = FX_HIT_RAINBOW_CHASE;
+    static const int tail = 7;
+    static bool step(EffectState &s)
+    {
+        // crosses the segment in 500 ms
+        uint32_t delayPerStep = max(1, 500 / s.count);
+        s.pos = (s.now - s.start) / delayPerStep;
+        s.next = s.pos < s.count ? s.start + (s.pos + 1) * delayPerStep : EFFECT_DONE;
+        return s.next != EFFECT_DONE;
+    }
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        uint8_t brightness = s.p.brightness;
+        strip.clear();
+        for (int i = 0; i < tail; i++)
+        {
+            int index = s.pos - i;
+            if (index < 0)
+                continue;
+            // seven bands across the palette, "rainbow7" gives the original colours
+            int level = max(0, brightness - (i * (brightness / tail)));
+            strip.setPixelColor(index, scaleColor(s.p.lut[(i % 7) * 256 / 7], level));
+        }
+        strip.setBrightness(brightness);
+    }
+};
+struct HitRainbow : HitEffect
+{
+    static const EffectId id = FX_HIT_RAINBOW;
+    static void begin(EffectState &s) { s.pos = (s.seed * 2654435761u) >> 24; }
+    static bool step(EffectState &s)
+    {
+        // one frame held for 100 ms
+        s.next = s.now - s.start < 100 ? s.start + 100 : EFFECT_DONE;
+        return s.frames == 0 && s.next != EFFECT_DONE;
+    }
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        for (int i = 0; i < s.count; i++)
+            strip.setPixelColor(i, s.p.lut[(s.pos + i * 256 / s.count) & 0xFF]);
+        strip.setBrightness(s.p.brightness);
+    }
+};
+struct HitChase : HitEffect
+{
+    static const EffectId id = FX_HIT_CHASE;
+    static bool step(EffectState &s)
+    {
+        // crosses the segment in 100 ms
+        uint32_t stepDelay = max(1, 100 / s.count);
+        s.pos = (s.now - s.start) / stepDelay;
+        s.next = s.pos < s.count ? s.start + (s.pos + 1) * stepDelay : EFFECT_DONE;
+        return s.next != EFFECT_DONE;
+    }
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        const EffectParams &p = s.p;
+        int stepDrop = p.brightness / max(1, p.tail - 1);
+        uint32_t color = strip.Color(p.red, p.green, p.blue);
+        strip.clear();
+        for (int i = 0; i < p.tail; i++)
+        {
+            int index = (s.pos - i + s.count) % s.count;
+            int level = max(0, p.brightness - i * stepDrop);
+            strip.setPixelColor(index, scaleColor(p.paletted ? p.lut[index * 256 / s.count] : color, level));
+        }
+        strip.setBrightness(p.brightness);
+    }
+};
+struct HitFade : HitEffect
+{
+    static const EffectId id = FX_HIT_FADE;
+    static const uint32_t holdMs = 20;    // time for which hit light is on
+    static const uint32_t frameMs = 5;
+    static bool step(EffectState &s)
+    {
+        // full colour, then a linear fade over tail * 100 ms, then one dark frame
+        uint32_t elapsed = s.now - s.start, fade = s.p.tail * 100;
+        if (elapsed < holdMs)
+        {
+            s.level = 255;
+            s.next = s.start + holdMs;
+            return s.frames == 0;
+        }
+        if (elapsed < holdMs + fade)
+        {
+            s.level = 255 - 255 * (elapsed - holdMs) / fade;
+            s.next = s.now + frameMs;
+            return true;
+        }
+        bool draw = s.level != 0;
+        s.level = 0;
+        s.next = draw ? s.now : EFFECT_DONE;
+        return draw;
+    }
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        uint32_t color = strip.Color(s.p.red, s.p.green, s.p.blue);
+        for (int i = 0; i < s.count; i++)
+            strip.setPixelColor(i, scaleColor(s.p.paletted ? s.p.lut[i * 256 / s.count] : color, s.level));
+        strip.setBrightness(s.p.brightness);
+    }
+};
+struct BaseRainbowStrobe : FillEffect
+{
+    static const EffectId id = FX_BASE_RAINBOW_STROBE;
+    static bool step(EffectState &s) { return strobeStep(s, true); }
+    static bool strobeStep(EffectState &s, bool rainbow)
+    {
+        const EffectParams &p = s.p;
+        uint32_t half, cycle, phase;
+        if (p.sync && beatClock.locked())
+        {
+            // 1, 2, 4 or 8 flashes per beat depending on speed
+            uint32_t beatPhase, beatPeriod;
+            uint32_t beatIndex = beatClock.beat(s.now, &beatPhase, &beatPeriod);
+            uint32_t flashes = 1 << (p.speed / 3);
+            uint32_t flashPeriod = beatPeriod / flashes;
+            half = flashPeriod / 2;
+            cycle = beatIndex * flashes + beatPhase / flashPeriod;
+            phase = beatPhase % flashPeriod;
+        }
+        else
+        {
+            half = rainbow ? 500 - (p.speed * 50) : 1000 - (p.speed * 100);
+            cycle = s.now / (2 * half);
+            phase = s.now % (2 * half);
+        }
+        bool on = phase < half;
+        if (!on)
+            s.color = 0;
+        else if (rainbow || p.paletted)
+            s.color = p.lut[(cycle * 32) & 0xFF]; // eight flashes per trip round the palette
+        else
+            s.color = Adafruit_NeoPixel::Color(p.red, p.green, p.blue);
+        s.level = p.brightness;
+        s.next = s.now - phase + (on ? half : 2 * half);
+        return true;
+    }
+};
+struct BaseStrobe : FillEffect
+{
+    static const EffectId id = FX_BASE_STROBE;
+    static bool step(EffectState &s) { return BaseRainbowStrobe::strobeStep(s, false); }
+};
+struct BaseRainbow : FillEffect
+{
+    static const EffectId id = FX_BASE_RAINBOW;
+    static bool step(EffectState &s)
+    {
+        const EffectParams &p = s.p;
+        uint16_t hue;
+        if (p.sync && beatClock.locked())
+        {
+            // 1-4 full hue cycles per four-beat bar
+            uint32_t beatPhase, beatPeriod;
+            uint32_t beatIndex = beatClock.beat(s.now, &beatPhase, &beatPeriod);
+            uint32_t cycles = 1 + p.speed / 3;
+            uint32_t inBar = (beatIndex % 4) * beatPeriod + beatPhase;
+            hue = (inBar * 256 * cycles / (4 * beatPeriod)) & 0xFF;
+            s.next = s.now + baseEffectInterval;
+        }
+        else
+        {
+            // one hue degree per step, redrawn at most every baseEffectInterval
+            uint32_t step = 19 - (p.speed * 2);
+            hue = (s.now / step) % 360 * 256 / 360;
+            s.next = s.now + max(step - s.now % step, baseEffectInterval);
+        }
+        s.color = p.lut[hue];
+        s.level = p.brightness;
+        return true;
+    }
+};
+struct BaseSolid : FillEffect
+{
+    static const EffectId id = FX_BASE_SOLID;
+    static bool step(EffectState &s)
+    {
+        s.color = Adafruit_NeoPixel::Color(s.p.red, s.p.green, s.p.blue);
+        s.gradient = s.p.paletted;
+        s.level = s.p.brightness;
+        s.next = s.now + baseEffectInterval;
+        return true;
+    }
+};
+struct BaseAudio : FillEffect
+{
+    static const EffectId id = FX_BASE_AUDIO;
+    static bool step(EffectState &s)
+    {
+        // bass -> brightness, mid -> hue (rainbow on), high -> strobe rate (strobe on)
+        const EffectParams &p = s.p;
+        uint8_t bass, mid, high;
+        effectAudio(s, bass, mid, high);
+        bool on = true;
+        if (p.strobe && high > 64)
+        {
+            uint32_t half = 20 + (255 - high);
+            on = (s.now / half) % 2 == 0;
+        }
+        if (!on)
+            s.color = 0;
+        else if (p.rainbow || p.paletted)
+            s.color = p.lut[mid];
+        else
+            s.color = Adafruit_NeoPixel::Color(p.red, p.green, p.blue);
+        s.level = p.brightness * (32 + bass) / (32 + 255);
+        s.next = s.now + 10;
+        return true;
+    }
+};
+struct BaseHeartbeat : FillEffect
+{
+    static const EffectId id = FX_BASE_HEARTBEAT;
+    static bool step(EffectState &s)
+    {
+        // steady until the tempo locks
+        uint8_t level = 255;
+        uint32_t phase, period;
+        if (effectBeat(s, s.now, &phase, &period))
+            level = heartbeatLevel(phase, period);
+        s.color = Adafruit_NeoPixel::Color(s.p.red, s.p.green, s.p.blue);
+        s.gradient = s.p.paletted;
+        s.level = s.p.brightness * level / 255;
+        s.next = s.now + baseEffectInterval;
+        return true;
+    }
+};
+struct BaseExternal : BaseEffect
+{
+    static const EffectId id = FX_BASE_EXTERNAL;
+    static void begin(EffectState &s) { s.mark = UINT32_MAX; }
+    static bool step(EffectState &s)
+    {
+        // poll for the next host frame, redraw only when one arrived
+        uint32_t frame = s.fixed ? 0 : extFrames.presented.load();
+        bool draw = frame != s.mark;
+        s.mark = frame;
+        s.next = s.now + 1;
+        return draw;
+    }
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        uint8_t rgb[3 * 32];
+        for (uint16_t i = 0; i < strip.numPixels(); i += 32)
+        {
+            uint16_t n = min<uint16_t>(32, strip.numPixels() - i);
+            if (s.fixed)
+                memcpy(rgb, s.fixed->frame + i * 3, n * 3);
+            else
+                extFrames.read(ledOutput.channelOffset[strip.channel] + strip.start + i, rgb, n);
+            for (uint16_t k = 0; k < n; k++)
+                strip.setPixelColor(i + k, rgb[k * 3], rgb[k * 3 + 1], rgb[k * 3 + 2]);
+        }
+        strip.setBrightness(255);
+    }
+};
+struct BaseProgram : BaseEffect
+{
+    static const EffectId id = FX_BASE_VM;
+    static bool step(EffectState &s)
+    {
+        s.next = s.now + baseEffectInterval;
+        return true;
+    }
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        const VmProgram *prog = effectProgram(s, VM_BASE);
+        if (prog)
+            vmRender(strip, *prog, vmInputs(s, s.now, strip, 127));
+        else
+            strip.clear();
+        effectProgramDone(s, VM_BASE, prog);
+        strip.setBrightness(s.p.brightness);
+    }
+};
+struct HitProgram : HitEffect
+{
+    static const EffectId id = FX_HIT_VM;
+    static bool step(EffectState &s)
+    {
+        // frames every 10 ms for the program's duration
+        const VmProgram *prog = effectProgram(s, VM_HIT);
+        s.next = prog && s.now - s.start <= prog->duration ? s.now + 10 : EFFECT_DONE;
+        effectProgramDone(s, VM_HIT, prog);
+        return s.next != EFFECT_DONE;
+    }
+    static void render(LedSegment &strip, const EffectState &s)
+    {
+        const VmProgram *prog = effectProgram(s, VM_HIT);
+        if (prog)
+            vmRender(strip, *prog, vmInputs(s, s.now - s.start, strip, s.p.velocity));
+        effectProgramDone(s, VM_HIT, prog);
+        strip.setBrightness(s.p.brightness);
+    }
+};
+
+template <uint8_t N>
+constexpr bool effectsInOrder() { return true; }
+template <uint8_t N, class E, class... Rest>
+constexpr bool effectsInOrder() { return E::id == N && effectsInOrder<N + 1, Rest...>(); }
+template <class... E>
+struct EffectRegistry
+{
+    static_assert(sizeof...(E) == FX_COUNT, "every EffectId needs an effect");
+    static_assert(effectsInOrder<0, E...>(), "effects must be listed in EffectId order");
+    static constexpr EffectEntry table[sizeof...(E)] = {{E::hit, E::begin, E::step, E::render}...};
+};
+template <class... E>
+constexpr EffectEntry EffectRegistry<E...>::table[sizeof...(E)];
+
+typedef EffectRegistry<HitRainbowChase, HitRainbow, HitChase, HitFade,
+                       BaseRainbowStrobe, BaseStrobe, BaseRainbow, BaseSolid, BaseAudio, BaseHeartbeat,
+                       BaseExternal, BaseProgram, HitProgram>
+    Effects;
+
+uint8_t effectByName(const char *name)
+{
+    for (uint8_t id = 0; name && id < FX_COUNT; id++)
+        if (strcmp(name, effectNames[id]) == 0)
+            return id;
+    return FX_NONE;
+}
+void selectBaseEffect(uint8_t id)
+{
+    if (id >= FX_COUNT || Effects::table[id].hit || (id == FX_BASE_VM && !vmActive[VM_BASE].load()))
+    {
+        bool rainbow = baseData.rainbow.load();
+        if (baseData.external.load())
+            id = FX_BASE_EXTERNAL;
+        else if (vmActive[VM_BASE].load())
+            id = FX_BASE_VM;
+        else if (baseData.audio.load())
+            id = FX_BASE_AUDIO;
+        else if (baseData.strobe.load())
+            id = rainbow ? FX_BASE_RAINBOW_STROBE : FX_BASE_STROBE;
+        else if (rainbow)
+            id = FX_BASE_RAINBOW;
+        else if (baseData.sync.load())
+            id = FX_BASE_HEARTBEAT;
+        else
+            id = FX_BASE_SOLID;
+    }
+    baseData.effect.store(id);
+}
+void selectHitEffect(uint8_t id)
+{
+    if (id >= FX_COUNT || !Effects::table[id].hit || (id == FX_HIT_VM && !vmActive[VM_HIT].load()))
+    {
+        bool rainbow = hitData.rainbow.load(), chase = hitData.chase.load();
+        if (vmActive[VM_HIT].load())
+            id = FX_HIT_VM;
+        else if (rainbow)
+            id = chase ? FX_HIT_RAINBOW_CHASE : FX_HIT_RAINBOW;
+        else
+            id = chase ? FX_HIT_CHASE : FX_HIT_FADE;
+    }
+    hitData.effect.store(id);
+}
+
+void baseParams(EffectParams &p)
+{
+    p.red = baseData.red.load();
+    p.green = baseData.green.load();
+    p.blue = baseData.blue.load();
+    p.brightness = baseData.brightness.load();
+    p.speed = baseData.speed.load();
+    p.tail = 0;
+    p.velocity = 127;
+    p.rainbow = baseData.rainbow.load();
+    p.strobe = baseData.strobe.load();
+    p.sync = baseData.sync.load();
+    p.palette = &palettes[LAYER_BASE];
+    p.paletteTag = p.palette->latest();
+    p.paletted = baseData.palette.load() != PALETTE_NONE;
+}
+void hitParams(EffectParams &p, uint8_t velocity)
+{
+    p.red = hitData.red.load();
+    p.green = hitData.green.load();
+    p.blue = hitData.blue.load();
+    p.brightness = hitData.brightness.load();
+    p.speed = 0;
+    p.tail = hitData.tail.load();
+    p.velocity = velocity;
+    p.rainbow = hitData.rainbow.load();
+    p.strobe = false;
+    p.sync = false;
+    p.palette = &palettes[LAYER_HIT];
+    p.paletteTag = p.palette->latest();
+    p.paletted = hitData.palette.load() != PALETTE_NONE;
+}
+void beginEffect(EffectState &s, uint8_t effect, LedSegment &strip, uint32_t now)
+{
+    s.effect = effect;
+    s.count = strip.numPixels();
+    s.start = s.now = now;
+    s.frames = 0;
+    s.gradient = false;
+    PalettePin pin(s.p);
+    Effects::table[effect].begin(s);
+}
+// one indexed call per frame; returns when the frame next changes
+uint32_t runEffect(EffectState &s, LedSegment &strip, uint32_t now)
+{
+    const EffectEntry &fx = Effects::table[s.effect];
+    s.now = now;
+    PalettePin pin(s.p);
+    if (fx.step(s))
+    {
+        strip.beginFrame(s.effect);
+        fx.render(strip, s);
+        strip.show();
+        s.frames++;
+    }
+    return s.next;
+}
+// Preset crossfade. A recall snapshots the outgoing parameters and effect
+// before the new preset lands. For the fade's duration the frame loop eases
+// colours and brightness from the snapshot to the new values; when the
+// effect, speed, options or palette changed as well it renders the outgoing
+// and incoming effects into the same frame and mixes them per pixel. Nothing
+// blocks: the mix is just a function of the time since the recall.
+const uint32_t crossfadeFrameInterval = 20;
+class Crossfade
+{
+public:
+    void begin(const EffectParams &p, uint8_t effect, uint32_t ms, uint32_t at)
+    {
+        portENTER_CRITICAL(&mux);
+        from = p;
+        fromEffect = effect;
+        start = at;
+        duration = ms;
+        generation++;
+        portEXIT_CRITICAL(&mux);
+    }
+    // copies out a recall newer than `seen`
+    bool poll(uint32_t &seen, EffectParams &p, uint8_t &effect, uint32_t &at, uint32_t &ms)
+    {
+        bool fresh = false;
+        portENTER_CRITICAL(&mux);
+        if (generation != seen)
+        {
+            seen = generation;
+            p = from;
+            effect = fromEffect;
+            at = start;
+            ms = duration;
+            fresh = true;
         }
-        else if (currentMenu.load() == RGB_SCREEN)
+        portEXIT_CRITICAL(&mux);
+        return fresh;
+    }
+
+private:
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t generation = 0;
+    EffectParams from;
+    uint8_t fromEffect;
+    uint32_t start, duration;
+};
+Crossfade presetFades[2];
+
+// called by a recall before it stores the new preset; `at` may be a little
+// in the past when a cue fired between polls
+void beginPresetFade(uint8_t layer, uint32_t ms, uint32_t at)
+{
+    EffectParams p;
+    if (layer == LAYER_BASE)
+    {
+        baseParams(p);
+        presetFades[layer].begin(p, baseData.effect.load(), ms, at);
+    }
+    else
+    {
+        hitParams(p, 127);
+        presetFades[layer].begin(p, hitData.effect.load(), ms, at);
+    }
+}
+// 0 = all `from`, 255 = all `to`
+uint8_t lerp8(uint8_t from, uint8_t to, uint8_t mix)
+{
+    return from + ((int)to - from) * mix / 255;
+}
+void lerpParams(EffectParams &to, const EffectParams &from, uint8_t mix)
+{
+    to.red = lerp8(from.red, to.red, mix);
+    to.green = lerp8(from.green, to.green, mix);
+    to.blue = lerp8(from.blue, to.blue, mix);
+    to.brightness = lerp8(from.brightness, to.brightness, mix);
+    to.tail = lerp8(from.tail, to.tail, mix);
+}
+// whether easing the parameters alone gets from one look to the other
+bool sameLook(const EffectState &a, const EffectState &b)
+{
+    const EffectParams &p = a.p, &q = b.p;
+    return a.effect == b.effect && p.speed == q.speed && p.rainbow == q.rainbow && p.strobe == q.strobe &&
+           p.sync == q.sync && p.palette == q.palette && p.paletteTag == q.paletteTag && p.paletted == q.paletted;
+}
+// one frame of both effects, each with its own brightness baked in, mixed
+// into the segment; `scratch` holds the outgoing frame
+uint32_t runCrossfade(EffectState &out, EffectState &in, LedSegment &strip, uint32_t now, uint8_t mix,
+                      uint32_t *scratch)
+{
+    const EffectEntry &a = Effects::table[out.effect], &b = Effects::table[in.effect];
+    out.now = in.now = now;
+    PalettePin outPin(out.p), inPin(in.p);
+    a.step(out);
+    b.step(in);
+    strip.beginFrame(in.effect);
+    a.render(strip, out);
+    uint8_t outLevel = strip.brightness * (255 - mix) / 255;
+    for (int i = 0; i < in.count; i++)
+        scratch[i] = scaleColor(strip.getPixelColor(i), outLevel);
+    b.render(strip, in);
+    uint8_t inLevel = strip.brightness * mix / 255;
+    for (int i = 0; i < in.count; i++)
+    {
+        uint32_t c = scaleColor(strip.getPixelColor(i), inLevel);
+        // the two weights sum to at most 255, so channels cannot carry
+        strip.setPixelColor(i, c + scratch[i]);
+    }
+    strip.setBrightness(255);
+    strip.show();
+    in.frames++;
+    return now + crossfadeFrameInterval;
+}
+// Golden-frame self-test. Every effect is rendered off-screen on a virtual
+// clock: hit effects through a fixed hit script, base effects for three
+// seconds. Effects that read live inputs get goldenInputs() instead: fixed
+// audio bands, a locked 120 bpm, a fixed host frame and two small built-in
+// programs. Each drawn frame (time, pixels and brightness) is FNV-1a hashed
+// into a chain per effect. Record stores the chains in GOLDEN_FILE and
+// prints them; verify compares against it, so a rewrite of an effect kernel
+// can be shown bit-exact. data/golden.json holds the chains for a
+// PAD_LEDS 14 build and is checked on the host by test/test_golden.
+#define GOLDEN_FILE "/golden.json"
+#define GOLDEN_MAX_STEPS 2000
+const uint32_t goldenHits[] = {0, 230, 260, 900}; // ms, includes a re-hit mid-effect
+const uint32_t goldenEnd = 3000;
+struct GoldenResult
+{
+    uint32_t hash, frames;
+};
+uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (len--)
+        hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+// hue along the strip and moving with time, pulsed by the beat
+const uint8_t goldenBaseCode[] = {OP_I, OP_PUSH16, 0x00, 0x10, OP_MUL, OP_T, OP_PUSH8, 64, OP_MUL, OP_ADD,
+                                  OP_PUSH16, 0xFF, 0x00, OP_V, OP_DUP, OP_ADD, OP_CLAMP8, OP_HSV, OP_BEAT,
+                                  OP_SCALE};
+// the palette scrolled by time, scaled by velocity and fading out
+const uint8_t goldenHitCode[] = {OP_I, OP_PUSH8, 16, OP_MUL, OP_T, OP_PUSH8, 2, OP_SHR, OP_ADD, OP_PAL,
+                                 OP_V, OP_DUP, OP_ADD, OP_PUSH16, 0x58, 0x02, OP_T, OP_SUB, OP_PUSH8, 2,
+                                 OP_SHR, OP_MIN, OP_CLAMP8, OP_SCALE};
+const FixedInputs &goldenInputs()
+{
+    static uint8_t frame[PAD_LEDS * 3];
+    static VmProgram programs[2];
+    static const FixedInputs in = {200, 96, 180, 500, frame, {&programs[VM_BASE], &programs[VM_HIT]}};
+    if (programs[VM_BASE].length == 0)
+    {
+        for (int k = 0; k < PAD_LEDS * 3; k++)
+            frame[k] = k * 37 + 11;
+        programs[VM_BASE].length = sizeof(goldenBaseCode);
+        memcpy(programs[VM_BASE].code, goldenBaseCode, sizeof(goldenBaseCode));
+        programs[VM_HIT].duration = 600;
+        programs[VM_HIT].length = sizeof(goldenHitCode);
+        memcpy(programs[VM_HIT].code, goldenHitCode, sizeof(goldenHitCode));
+    }
+    return in;
+}
+GoldenResult goldenRun(uint8_t id)
+{
+    static uint8_t pixels[PAD_LEDS * 3];
+    static Palette wheel;
+    LedSegment strip;
+    strip.attachBuffer(pixels, PAD_LEDS);
+    const EffectEntry &fx = Effects::table[id];
+    const uint8_t hitCount = sizeof(goldenHits) / sizeof(goldenHits[0]);
+
+    EffectState s = {};
+    s.p = {200, 40, 10, 180, 4, 3, 100, false, false, false, &wheel, wheel.latest(), NULL, false};
+    s.seed = 0x5EED;
+    s.fixed = &goldenInputs();
+    GoldenResult r = {2166136261u, 0};
+    uint8_t hit = 0;
+    bool active = false;
+    uint32_t next = fx.hit ? goldenHits[0] : 0;
+    for (uint32_t steps = 0; next <= goldenEnd && steps < GOLDEN_MAX_STEPS; steps++)
+    {
+        uint32_t t = next;
+        if (!fx.hit && !active)
         {
-            if (buttonState[up].load() || buttonState[down].load())
-            {
-                if (buttonState[up].load())
-                    updateSelectedIndex(selectedRGBIndex, RGBItemCount, 1);
-                else if (buttonState[down].load())
-                    updateSelectedIndex(selectedRGBIndex, RGBItemCount, 0);
-            }
-            else if (buttonState[ok].load())
-            {
-                currentMenu.store(SELECTED_RGB);
-            }
-            else if (buttonState[back].load())
-            {
-                if (base.load())
-                    currentMenu.store(BASEMENU);
-                else if (hit.load())
-                    currentMenu.store(HITMENU);
-            }
+            beginEffect(s, id, strip, t);
+            active = true;
         }
-        else if (currentMenu.load() == SELECTED_RGB)
+        if (fx.hit && hit < hitCount && goldenHits[hit] <= t)
         {
-            if (buttonState[up].load())
-            {
-                adjustRGBValue(+1);
-            }
+            beginEffect(s, id, strip, t);
+            active = true;
+            hit++;
+        }
+        next = fx.hit && hit < hitCount ? goldenHits[hit] : UINT32_MAX;
+        if (!active)
+            continue;
+        s.now = t;
+        if (fx.step(s))
+        {
+            fx.render(strip, s);
+            r.hash = fnv1a(r.hash, &t, sizeof(t));
+            r.hash = fnv1a(r.hash, pixels, sizeof(pixels));
+            r.hash = fnv1a(r.hash, &strip.brightness, 1);
+            s.frames++;
+            r.frames++;
+        }
+        if (s.next == EFFECT_DONE)
+            active = false;
+        else
+            next = min(next, s.next);
+    }
+    return r;
+}
+// returns the number of mismatches, -1 without a golden file to verify against
+int effectSelfTest(bool record)
+{
+    JsonDocument golden(&jsonPool);
+    if (!record)
+    {
+        StorageLock lock;
+        if (!readJsonFile(GOLDEN_FILE, golden) || !golden.is<JsonObject>())
+        {
+            Serial.println("No golden frames, record them first");
+            return -1;
+        }
+    }
+    int failed = 0;
+    for (uint8_t id = 0; id < FX_COUNT; id++)
+    {
+        GoldenResult r = goldenRun(id);
+        char hash[11];
+        snprintf(hash, sizeof(hash), "0x%08x", (unsigned)r.hash);
+        if (record)
+        {
+            golden[effectNames[id]]["hash"] = hash;
+            golden[effectNames[id]]["frames"] = r.frames;
+            continue;
+        }
+        bool match = strcmp(golden[effectNames[id]]["hash"] | "", hash) == 0;
+        failed += !match;
+        Serial.printf("%-20s %s %s (%u frames)\n", effectNames[id], match ? "ok  " : "FAIL", hash, (unsigned)r.frames);
+    }
+    if (record)
+    {
+        {
+            StorageLock lock;
+            writeJsonFile(GOLDEN_FILE, golden);
+        }
+        serializeJsonPretty(golden, Serial);
+        Serial.println();
+    }
+    else
+        Serial.printf("Golden frames: %d mismatches\n", failed);
+    return failed;
+}
 
-            if (buttonState[down].load())
-            {
-                adjustRGBValue(-1);
-            }
+// Show sequencer. A song is a cue list in flash (listed under "shows" in
+// settings.json), e.g.
+//   {"control_pad": 1,
+//    "cues": [{"base": 1, "hit": 1},
+//             {"base": 2, "fade": 2000, "beats": 32},
+//             {"hit": 3, "hits": 24},
+//             {"base": 3, "ms": 45000},
+//             {"base": 1, "hit": 2, "pad": true}]}
+// Each cue recalls a base and/or hit preset (1-3) with an optional fade in
+// ms, once its trigger is met counting from the previous cue: elapsed ms,
+// beats of the beat clock, hits on any pad, or a hit on the control pad; no
+// trigger fires straight away. Presets and the control pad count from 1; a
+// list whose control pad is not scanned does not load. Loading a song parses the list and copies
+// the presets (and their effect programs) it uses into RAM, so nothing
+// touches the file system while it plays. The copies live for the whole
+// song, so they get their own SHOW_PRESET_POOL arena instead of jsonPool's;
+// a song whose presets do not fit does not load. service() is polled from the
+// preset task and costs one switch per poll; a cue's crossfade starts at the
+// moment its trigger was met, not when the poll noticed, so the render
+// clock sees it to the millisecond.
+#define SHOW_MAX_CUES 64
+enum CueTrigger
+{
+    CUE_NOW,
+    CUE_MS,
+    CUE_BEATS,
+    CUE_HITS,
+    CUE_PAD
+};
+struct Cue
+{
+    int8_t base, hit; // preset 0-5, -1 for none
+    int32_t fade;     // ms, -1 for the preset's own
+    uint8_t trigger;
+    uint32_t count;
+};
+class ShowSequencer
+{
+public:
+    // any task: start song `index`, or stop with -1
+    void request(int8_t index) { requested.store(index); }
+    // sensorTask, for every hit
+    void onHit(uint8_t pad, uint32_t now)
+    {
+        lastHitAt.store(now);
+        hits.store(hits.load() + 1);
+        if (pad == controlPad.load())
+            padHits.store(padHits.load() + 1);
+    }
+    // presetTask
+    void service(uint32_t now)
+    {
+        int8_t r = requested.exchange(SHOW_NO_REQUEST);
+        if (r != SHOW_NO_REQUEST && (r < 0 || !load(r)))
+            stop();
+        uint32_t at;
+        while (running && ready(cues[next], now, at))
+            fire(at);
+    }
 
-            else if (buttonState[ok].load())
-            {
-                currentMenu.store(RGB_SCREEN);
-            }
-            else if (buttonState[back])
-            {
-                currentMenu.store(RGB_SCREEN);
-            }
+private:
+    static const int8_t SHOW_NO_REQUEST = -2;
+    Cue cues[SHOW_MAX_CUES];
+    uint16_t cueCount = 0, next = 0;
+    atomic<uint8_t> controlPad{0xFF}; // 0-based, 0xFF for none
+    bool running = false;
+    JsonDocument presets{&showPresetPool};
+    VmProgram programs[6];
+    bool hasProgram[6];
+    // counted from the previous cue
+    uint32_t cueAt = 0, beats = 0, lastDownbeat = 0, hitsAtCue = 0, padHitsAtCue = 0;
+    atomic<uint32_t> hits{0}, padHits{0}, lastHitAt{0};
+    atomic<int8_t> requested{SHOW_NO_REQUEST};
+
+    bool load(uint8_t index)
+    {
+        stop();
+        if (index >= showCount)
+            return false;
+        StorageLock lock;
+        JsonDocument list(&jsonPool), settings(&jsonPool), filter(&jsonPool);
+        filter["base"][0] = true;
+        filter["hit"][0] = true;
+        if (!readJsonFile(showPaths[index], list) || !list["cues"].is<JsonArray>())
+        {
+            Serial.print("Bad cue list ");
+            Serial.println(showPaths[index]);
+            return false;
         }
-        else if (currentMenu.load() == SELECTED_BASE)
+        if (!readJsonFile(JSON_FILE, settings, &filter))
+            return false;
+
+        int pad = list["control_pad"] | 0;
+        if (!list["control_pad"].isNull() && (pad < 1 || pad > NUM_PADS))
         {
-            // if (selectedBaseIndex == static_cast<int>(BaseMenu::BRIGHTNESS) && buttonState[up])
-            // {
-            //     baseData.brightness.store(baseData.brightness.load() + 22.5);
-            // }
-            // else if (selectedBaseIndex == static_cast<int>(BaseMenu::BRIGHTNESS) && buttonState[down])
-            // {
-            //     baseData.brightness.store(baseData.brightness.load() - 22.5);
-            // }
-            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::BRIGHTNESS))
-            {
-                adjustValueHold(baseData.brightness, isUpPressed, isDownPressed, 0, 255, 22.5);
-            }
-            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::SPEED) && buttonState[up])
-            {
-                uint8_t speed = baseData.speed.load() + 1;
-                if (speed > 9)
-                    speed = 9;
-                else if (speed < 0)
-                    speed = 0;
-                baseData.speed.store(speed);
-            }
-            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::SPEED) && buttonState[down])
-            {
-                uint8_t speed = baseData.speed.load() - 1;
-                if (speed > 9)
-                    speed = 9;
-                else if (speed < 0)
-                    speed = 0;
-                baseData.speed.store(speed);
-            }
-            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::STROBE) && buttonState[up])
-            {
-                baseData.strobe.store(true);
-            }
-            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::STROBE) && buttonState[down])
-            {
-                baseData.strobe.store(false);
-            }
-            if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::RAINBOW) && buttonState[up])
-            {
-                baseData.rainbow.store(true);
-            }
-            else if (selectedBaseIndex.load() == static_cast<int>(BaseMenu::RAINBOW) && buttonState[down])
-            {
-                baseData.rainbow.store(false);
-            }
-            if (buttonState[ok].load())
-            {
-                currentMenu.store(BASEMENU);
-            }
-            else if (buttonState[back].load())
-            {
-                currentMenu.store(BASEMENU);
-            }
+            Serial.printf("Cue list control_pad must be 1-%u\n", NUM_PADS);
+            return false;
         }
-        else if (currentMenu.load() == SELECTED_HIT)
+        controlPad.store(pad - 1);
+        cueCount = 0;
+        bool used[6] = {false};
+        for (JsonObjectConst c : list["cues"].as<JsonArrayConst>())
         {
-            // if (selectedHitIndex == static_cast<int>(HitMenu::BRIGHTNESS) && buttonState[up])
-            // {
-            //     hitData.brightness.store(hitData.brightness.load() + 22.5);
-            // }
-            // else if (selectedHitIndex == static_cast<int>(HitMenu::BRIGHTNESS) && buttonState[down])
-            // {
-            //     hitData.brightness.store(hitData.brightness.load() - 22.5);
-            // }
-            if (selectedHitIndex.load() == static_cast<int>(HitMenu::BRIGHTNESS))
-            {
-                adjustValueHold(hitData.brightness, isUpPressed, isDownPressed, 0, 255, 22.5);
-            }
-            if (selectedHitIndex.load() == static_cast<int>(HitMenu::TAIL) && buttonState[up].load())
-            {
-                uint8_t tail = hitData.tail.load() + 1;
-                if (tail > 9)
-                    tail = 9;
-                else if (tail < 0)
-                    tail = 0;
-                hitData.tail.store(tail);
-            }
-            else if (selectedHitIndex.load() == static_cast<int>(HitMenu::TAIL) && buttonState[down].load())
-            {
-                uint8_t tail = hitData.tail.load() - 1;
-                if (tail > 9)
-                    tail = 9;
-                else if (tail < 0)
-                    tail = 0;
-                hitData.tail.store(tail);
-            }
-            if (selectedHitIndex.load() == static_cast<int>(HitMenu::CHASE) && buttonState[up].load())
-            {
-                hitData.chase.store(1);
-            }
-            else if (selectedHitIndex.load() == static_cast<int>(HitMenu::CHASE) && buttonState[down].load())
-            {
-                hitData.chase.store(0);
-            }
-            if (selectedHitIndex.load() == static_cast<int>(HitMenu::RAINBOW) && buttonState[up].load())
-            {
-                hitData.rainbow.store(1);
-            }
-            else if (selectedHitIndex.load() == static_cast<int>(HitMenu::RAINBOW) && buttonState[down].load())
-            {
-                hitData.rainbow.store(0);
-            }
-            if (buttonState[ok].load())
+            if (cueCount == SHOW_MAX_CUES)
+                break;
+            Cue &cue = cues[cueCount++];
+            int base = c["base"] | 0, hit = c["hit"] | 0;
+            cue.base = base >= 1 && base <= 3 ? base - 1 : -1;
+            cue.hit = hit >= 1 && hit <= 3 ? hit + 2 : -1;
+            cue.fade = c["fade"] | -1;
+            cue.trigger = CUE_NOW;
+            cue.count = 0;
+            if (c["ms"].is<uint32_t>())
+                cue.trigger = CUE_MS, cue.count = c["ms"];
+            else if (c["beats"].is<uint32_t>())
+                cue.trigger = CUE_BEATS, cue.count = c["beats"];
+            else if (c["hits"].is<uint32_t>())
+                cue.trigger = CUE_HITS, cue.count = c["hits"];
+            else if (c["pad"] | false)
             {
-                currentMenu.store(HITMENU);
+                if (controlPad.load() == 0xFF)
+                {
+                    Serial.println("Cue list has a pad cue but no control_pad");
+                    return false;
+                }
+                cue.trigger = CUE_PAD;
             }
-            else if (buttonState[back].load())
+            if (cue.base >= 0)
+                used[cue.base] = true;
+            if (cue.hit >= 0)
+                used[cue.hit] = true;
+        }
+        presets.clear();
+        for (uint8_t i = 0; i < 6; i++)
+        {
+            JsonVariant item = presets.add<JsonVariant>();
+            hasProgram[i] = false;
+            if (!used[i])
+                continue;
+            item.set(presetItem(settings, i));
+            if (const char *error = presetError(i, item))
             {
-                currentMenu.store(HITMENU);
+                Serial.printf("Cue list preset %u: %s\n", i + 1, error);
+                continue;
             }
+            const char *path = item["program"] | "";
+            if (path[0])
+                hasProgram[i] = vmReadProgram(path, programs[i]);
+            if (!hasProgram[i])
+                item.remove("program"); // never read it mid-song
         }
-        while (pressed)
+        if (presets.overflowed())
+        {
+            Serial.println("Cue list presets do not fit SHOW_PRESET_POOL");
+            presets.clear();
+            return false;
+        }
+        showSong.store(index);
+        start(millis());
+        return true;
+    }
+    void stop()
+    {
+        showSong.store(-1);
+        showCue.store(-1);
+        running = false;
+    }
+    void start(uint32_t now)
+    {
+        next = 0;
+        cueAt = now;
+        running = cueCount > 0;
+        rearm();
+    }
+    void rearm()
+    {
+        beats = 0;
+        lastDownbeat = 0;
+        hitsAtCue = hits.load();
+        padHitsAtCue = padHits.load();
+    }
+    bool ready(const Cue &c, uint32_t now, uint32_t &at)
+    {
+        switch (c.trigger)
         {
-            pressed = false;
-            fo4
+        case CUE_MS:
+            at = cueAt + c.count;
+            return now - cueAt >= c.count;
+        case CUE_BEATS:
+        {
+            // count downbeats as they pass; the clock's anchor moves with
+            // the drummer, so its beat index is not stable across cues
+            if (!beatClock.locked())
+                return false;
+            uint32_t phase, period;
+            beatClock.beat(now, &phase, &period);
+            uint32_t downbeat = now - phase;
+            if ((int32_t)(downbeat - cueAt) > 0 && downbeat - lastDownbeat > period / 2)
             {
-                buttonState[i].store(!digitalRead(btnPins[i]));
-                if (buttonState[i].load())
-                    pressed = true;
+                lastDownbeat = downbeat;
+                beats++;
             }
-            vTaskDelay(pdMS_TO_TICKS(1));
+            at = lastDownbeat;
+            return beats >= c.count;
+        }
+        case CUE_HITS:
+            at = lastHitAt.load();
+            return hits.load() - hitsAtCue >= c.count;
+        case CUE_PAD:
+            at = lastHitAt.load();
+            return padHits.load() != padHitsAtCue;
+        default:
+            at = cueAt;
+            return true;
         }
-        vTaskDelay(pdMS_TO_TICKS(1));
     }
-}
-
-void heartbeatEffect(uint8_t red, uint8_t green, uint8_t blue, uint8_t brightness)
-{
-    const int ledCount = 14;
-    const int pulseDelay1 = 100;
-    const int pulseDelay2 = 200;
-    const int fadeDelay = 15;
-    const int fadeSteps = 30;
-
-    strip.setBrightness(brightness);
-    for (int i = 0; i < ledCount; i++)
+    void fire(uint32_t at)
     {
-        strip.setPixelColor(i, strip.Color(red, green, blue));
+        const Cue &c = cues[next];
+        if (c.base >= 0)
+            applyPreset(c.base, presets[c.base].as<JsonObjectConst>(), hasProgram[c.base] ? &programs[c.base] : NULL, c.fade, at);
+        if (c.hit >= 0)
+            applyPreset(c.hit, presets[c.hit].as<JsonObjectConst>(), hasProgram[c.hit] ? &programs[c.hit] : NULL, c.fade, at);
+        showCue.store(next);
+        cueAt = at;
+        rearm();
+        if (++next == cueCount)
+            running = false; // the last look stays up
     }
-    strip.show();
-    vTaskDelay(pdMS_TO_TICKS(pulseDelay1));
-
-    // Off between beats
-    strip.clear();
-    strip.show();
-    vTaskDelay(pdMS_TO_TICKS(pulseDelay1 / 2));
+};
+ShowSequencer showSequencer;
 
-    // Pulse 2
-    strip.setBrightness(brightness);
-    for (int i = 0; i < ledCount; i++)
-    {
-        strip.setPixelColor(i, strip.Color(red, green, blue));
-    }
-    strip.show();
-    vTaskDelay(pdMS_TO_TICKS(pulseDelay2));
+void requestShow(int8_t song)
+{
+    showSequencer.request(song);
+}
+// Hit recorder. While recording, sensorTask posts each hit to a queue
+// without waiting; the recorder task packs them into 4-byte records and
+// appends them to REC_FILE a batch at a time, so flash never holds up
+// detection. Replay reads the log back in batches and hands the hits to
+// sensorTask at their recorded times, which dispatches them like live ones, sped up by `speed`
+// (0: back to back), to rehearse looks or profile effects against real
+// drumming. tools/hitlog.py dumps a log on the host.
+// File: "HREC", then records of u16 ms since the previous record, u8 pad,
+// u8 velocity; pad REC_GAP records only carry time across gaps > 65535 ms.
+#define REC_FILE "/take.hit"
+#define REC_BATCH 256 // bytes per flash write
+#define REC_FLUSH_MS 1000
+#define REC_QUEUE 64
+#define REC_GAP 0xFF
+struct RecHit
+{
+    uint8_t pad, velocity;
+    uint32_t ms;
+};
+atomic<int8_t> recRequest{-1}; // RecState to switch to, -1 for none
+atomic<uint8_t> recSpeed{1};
+QueueHandle_t recQueue = NULL;
 
-    // Fade out slowly
-    for (int step = fadeSteps; step >= 0; step--)
+void requestRecorder(uint8_t state, uint8_t speed)
+{
+    recSpeed.store(speed);
+    recRequest.store(state);
+}
+// sensorTask
+void recordHit(uint8_t pad, uint8_t velocity, uint32_t now)
+{
+    if (recState.load() != REC_RECORDING)
+        return;
+    RecHit hit = {pad, velocity, now};
+    if (xQueueSend(recQueue, &hit, 0) != pdTRUE)
+        recDropped.store(recDropped.load() + 1);
+}
+// sensorTask only: its pads, midiReceive and the hit inbox
+void dispatchHit(uint8_t pad, uint16_t level, uint8_t velocity, uint32_t now, uint8_t source)
+{
+    HitEvent event = {pad, level, velocity, (uint32_t)micros()};
+    if (source != HIT_MIDI)
+        midiHit(pad, velocity, now);
+    if (hitQueues[pad] != NULL)
+        xQueueOverwrite(hitQueues[pad], &event);
+    beatClock.onHit(now);
+    showSequencer.onHit(pad, now);
+    if (source != HIT_REPLAY)
+        recordHit(pad, velocity, now);
+    noteActivity();
+}
+// any task; false when the inbox is full
+bool queueHit(uint8_t pad, uint8_t velocity, uint8_t source)
+{
+    QueuedHit hit = {pad, velocity, source};
+    return xQueueSend(hitInbox, &hit, 0) == pdTRUE;
+}
+// sensorTask: the hits other tasks queued since its last pass
+void dispatchInbox(uint32_t now)
+{
+    QueuedHit queued;
+    while (xQueueReceive(hitInbox, &queued, 0) == pdTRUE)
+        dispatchHit(queued.pad, map(queued.velocity, 1, 127, 10, 4095), queued.velocity, now, queued.source);
+}
+// packs one hit into the batch, writing the batch out when it is full
+void recPack(File &file, uint8_t *batch, size_t &used, uint32_t &last, const RecHit &hit)
+{
+    for (uint32_t dt = hit.ms - last; true; dt -= 0xFFFF)
     {
-        uint8_t fadeBrightness = (brightness * step) / fadeSteps;
-        strip.setBrightness(fadeBrightness);
-        strip.show();
-        vTaskDelay(pdMS_TO_TICKS(fadeDelay));
+        bool gap = dt > 0xFFFF;
+        if (used + 4 > REC_BATCH)
+        {
+            file.write(batch, used);
+            used = 0;
+        }
+        uint16_t step = gap ? 0xFFFF : dt;
+        batch[used++] = step;
+        batch[used++] = step >> 8;
+        batch[used++] = gap ? REC_GAP : hit.pad;
+        batch[used++] = gap ? 0 : hit.velocity;
+        if (!gap)
+            break;
     }
-
-    // Wait before next beat
-    vTaskDelay(pdMS_TO_TICKS(500));
+    last = hit.ms;
+    recEvents.store(recEvents.load() + 1);
 }
-void ledTask(void *pvParameters)
+// recorderTask's state; service() is one pass of its loop
+class Recorder
 {
-    // heartbeatEffect(100, 100, 100, 100);
-    static uint32_t lastHitTime = 0;
-    static uint32_t lastBaseEffectTime = 0;
-    const uint32_t hitCooldown = 50;
-    const uint32_t baseEffectInterval = 20;
-    static uint8_t hue = 0;
-    LedTaskParams *params = (LedTaskParams *)pvParameters;
-    uint8_t piezoPin = params->piezoPin;
+public:
+    void service();
 
-    while (true)
+private:
+    uint8_t batch[REC_BATCH];
+    size_t used = 0, pos = 0;
+    uint32_t last = 0, firstBuffered = 0, due = 0;
+    bool scheduled = false;
+    File file;
+};
+void Recorder::service()
+{
+    int8_t request = recRequest.exchange(-1);
+    if (request >= 0)
     {
-        int isHit = 0;
-        unsigned long currentTime = millis();
-        isHit = analogRead(piezoPin);
-        Serial.print(piezoPin);
-        Serial.print("  ");
-        Serial.println(isHit);
-
-        // if (1)
-        if (isHit > 10 && (currentTime - lastHitTime > hitCooldown))
-        {
-            lastHitTime = currentTime;
-            uint8_t red = hitData.red.load(),
-                    green = hitData.green.load(),
-                    blue = hitData.blue.load(),
-                    brightness = hitData.brightness.load(),
-                    tail = hitData.tail.load();
-            bool rainbow = hitData.rainbow.load(),
-                 chase = hitData.chase.load();
-
-            const int ledCount = strip.numPixels();
-
-            if (rainbow && chase)
-            {
-                static int pos = 0;
-                const int numLEDs = strip.numPixels();
-                uint32_t colors[7] = {
-                    strip.Color(255, 0, 0),   // Red
-                    strip.Color(255, 127, 0), // Orange
-                    strip.Color(255, 255, 0), // Yellow
-                    strip.Color(0, 255, 0),   // Green
-                    strip.Color(0, 255, 255), // Cyan
-                    strip.Color(0, 0, 255),   // Blue
-                    strip.Color(148, 0, 211)  // Violet
-                };
-
-                int tail = 7;
-                int delayPerStep = 500 / numLEDs;
-                while (pos < numLEDs)
-                {
-                    for (int i = 0; i < numLEDs; i++)
-                        strip.setPixelColor(i, 0);
-
-                    for (int i = 0; i < tail; i++)
-                    {
-                        int index = pos - i;
-                        if (index < 0)
-                            continue;
-                        uint32_t color = colors[i % 7];
-
-                        uint8_t r = (uint8_t)((color >> 16) & 0xFF);
-                        uint8_t g = (uint8_t)((color >> 8) & 0xFF);
-                        uint8_t b = (uint8_t)(color & 0xFF);
-
-                        int level = brightness - (i * (brightness / tail));
-                        if (level < 0)
-                            level = 0;
-
-                        r = (r * level) / 255;
-                        g = (g * level) / 255;
-                        b = (b * level) / 255;
-
-                        strip.setPixelColor(index, r, g, b);
-                    }
-
-                    strip.setBrightness(brightness);
-                    strip.show();
-
-                    pos++;
-                    vTaskDelay(pdMS_TO_TICKS(delayPerStep));
-                }
-                pos = 0;
+        // stop whatever is running first; a take keeps the hits still
+        // queued when it stops
+        bool recording = recState.load() == REC_RECORDING;
+        recState.store(REC_IDLE);
+        if (recording)
+        {
+            RecHit hit;
+            while (xQueueReceive(recQueue, &hit, 0) == pdTRUE)
+                recPack(file, batch, used, last, hit);
+            if (used)
+                file.write(batch, used);
+        }
+        if (file)
+            file.close();
+        used = pos = 0;
+        scheduled = false;
+        if (request == REC_RECORDING)
+        {
+            xQueueReset(recQueue);
+            file = SPIFFS.open(REC_FILE, FILE_WRITE);
+            if (file && file.write((const uint8_t *)"HREC", 4) == 4)
+            {
+                recEvents.store(0);
+                recDropped.store(0);
+                last = millis();
+                recState.store(REC_RECORDING);
             }
-            else if (rainbow && !chase)
+        }
+        else if (request == REC_REPLAYING)
+        {
+            uint8_t magic[4];
+            file = SPIFFS.open(REC_FILE, FILE_READ);
+            if (file && file.read(magic, 4) == 4 && memcmp(magic, "HREC", 4) == 0)
             {
-                int numLEDs = strip.numPixels();
-
-                uint16_t offset = random(0, 360);
+                recEvents.store(0);
+                due = millis();
+                recState.store(REC_REPLAYING);
+            }
+        }
+        if (recState.load() == REC_IDLE && file)
+            file.close();
+    }
 
-                for (int i = 0; i < numLEDs; i++)
-                {
-                    uint16_t hue = (offset + (i * 360) / numLEDs) % 360;
-                    uint32_t color = strip.gamma32(strip.ColorHSV(hue * 182));
-                    strip.setPixelColor(i, color);
-                }
-                strip.setBrightness(brightness);
-                strip.show();
-                vTaskDelay(pdMS_TO_TICKS(100));
+    if (recState.load() == REC_RECORDING)
+    {
+        // wait for the first hit only and take at most a queue's worth, so
+        // dense playing can't keep a stop request or the flush waiting
+        RecHit hit;
+        for (uint16_t n = 0; n < REC_QUEUE && recRequest.load() < 0 &&
+                             xQueueReceive(recQueue, &hit, n ? 0 : pdMS_TO_TICKS(20)) == pdTRUE;
+             n++)
+        {
+            if (used == 0)
+                firstBuffered = millis();
+            recPack(file, batch, used, last, hit);
+        }
+        if (used && millis() - firstBuffered > REC_FLUSH_MS)
+        {
+            file.write(batch, used);
+            file.flush();
+            used = 0;
+        }
+    }
+    else if (recState.load() == REC_REPLAYING)
+    {
+        if (pos + 4 > used)
+        {
+            used = file.read(batch, REC_BATCH) & ~3;
+            pos = 0;
+            if (used == 0)
+            {
+                file.close();
+                recState.store(REC_IDLE);
             }
-            else if (!rainbow && chase)
+        }
+        if (used)
+        {
+            const uint8_t *r = batch + pos;
+            uint8_t speed = recSpeed.load();
+            if (!scheduled)
             {
-
-                uint16_t numLeds = strip.numPixels();
-
-                // How long to wait per step so we finish in timeLimitMs
-                uint16_t stepDelay = 100 / numLeds;
-
-                int pos = 0; // always start from 0
-
-                while (pos < numLeds)
-                {
-                    // Clear strip
-                    for (int i = 0; i < numLeds; i++)
-                        strip.setPixelColor(i, 0);
-
-                    int steps = tail - 1;
-                    int stepDrop = brightness / max(1, steps);
-
-                    // Draw tail
-                    for (int i = 0; i < tail; i++)
-                    {
-                        int index = (pos - i + numLeds) % numLeds;
-                        int level = brightness - i * stepDrop;
-                        if (level < 0)
-                            level = 0;
-
-                        uint8_t scaledRed = (red * level) / 255;
-                        uint8_t scaledGreen = (green * level) / 255;
-                        uint8_t scaledBlue = (blue * level) / 255;
-
-                        strip.setPixelColor(index, scaledRed, scaledGreen, scaledBlue);
-                    }
-
-                    strip.setBrightness(brightness);
-                    strip.show();
-
-                    pos++;
-                    vTaskDelay(pdMS_TO_TICKS(stepDelay));
-                }
+                due += speed ? (r[0] | r[1] << 8) / speed : 0;
+                scheduled = true;
             }
+            // wait in short steps so a stop request gets through
+            int32_t wait = due - millis();
+            if (wait > 0)
+                vTaskDelay(pdMS_TO_TICKS(min<int32_t>(wait, 20)));
             else
             {
-
-                uint8_t currentRed = red;
-                uint8_t currentGreen = green;
-                uint8_t currentBlue = blue;
-
-                for (int i = 0; i < strip.numPixels(); i++)
-                {
-                    strip.setPixelColor(i, strip.Color(currentRed, currentGreen, currentBlue));
-                }
-                strip.setBrightness(brightness);
-                strip.show();
-                vTaskDelay(pdMS_TO_TICKS(20)); // time for which hit light is on
-
-                int fadeSteps = tail * 100;
-                int stepDelay = max(1, tail * 100 / fadeSteps);
-
-                for (int step = 1; step <= fadeSteps; step++)
+                uint8_t pad = r[2], velocity = r[3];
+                bool hit = pad < NUM_PADS && velocity;
+                if (hit && !queueHit(pad, velocity, HIT_REPLAY))
                 {
-                    uint8_t r = currentRed - (currentRed * step) / fadeSteps;
-                    uint8_t g = currentGreen - (currentGreen * step) / fadeSteps;
-                    uint8_t b = currentBlue - (currentBlue * step) / fadeSteps;
-
-                    for (int i = 0; i < strip.numPixels(); i++)
-                    {
-                        strip.setPixelColor(i, strip.Color(r, g, b));
-                    }
-                    strip.setBrightness(brightness);
-                    strip.show();
-                    vTaskDelay(pdMS_TO_TICKS(stepDelay));
+                    vTaskDelay(1); // sensorTask is behind, try again
+                    return;
                 }
-                for (int i = 0; i < strip.numPixels(); i++)
-                    strip.setPixelColor(i, 0);
-                strip.setBrightness(brightness);
-                strip.show();
+                if (hit)
+                    recEvents.store(recEvents.load() + 1);
+                pos += 4;
+                scheduled = false;
+                if (speed == 0)
+                    vTaskDelay(1); // flat out is one hit per tick, the idle task still runs
             }
         }
+    }
+    else
+        vTaskDelay(pdMS_TO_TICKS(20));
+}
+Recorder recorder;
+void recorderTask(void *pvParameters)
+{
+    while (true)
+    {
+        profileLoopBegin(PROFILE_RECORDER);
+        recorder.service();
+        profileLoopEnd(PROFILE_RECORDER);
+    }
+}
 
-        else
-        {
-            // if (1)
-            if (currentTime - lastBaseEffectTime > baseEffectInterval)
-            {
-                lastBaseEffectTime = currentTime;
-                uint8_t red = baseData.red.load(),
-                        green = baseData.green.load(),
-                        blue = baseData.blue.load(),
-                        brightness = baseData.brightness.load(),
-                        speed = baseData.speed.load();
-                bool rainbow = baseData.rainbow.load();
-                bool strobe = baseData.strobe.load();
+void ledTask(void *pvParameters)
+{
+    LedTaskParams *params = (LedTaskParams *)pvParameters;
+    uint8_t pad = params - taskParams;
+    LedSegment &strip = padSegments[pad];
+    EffectState base = {}, hitFx = {};
+    base.effect = FX_NONE;
+    bool hitActive = false;
+    uint32_t nextFrame = 0;
 
-                if (rainbow && strobe)
-                {
-                    // add nhardcode values for color
-                    static uint16_t hue = 0;
-                    const int ledCount = strip.numPixels();
+    // preset crossfades: the outgoing base, and the outgoing hit parameters
+    EffectState fadeOut = {};
+    EffectParams hitFrom = {};
+    uint32_t fadeSeen[2] = {0}, fadeStart[2] = {0}, fadeMs[2] = {0};
+    uint32_t *scratch = (uint32_t *)calloc(strip.numPixels(), sizeof(uint32_t));
 
-                    uint32_t color = strip.gamma32(strip.ColorHSV(hue * 182));
-                    for (int i = 0; i < ledCount; i++)
-                        strip.setPixelColor(i, color);
+    while (true)
+    {
+        // sleep until the next frame is due or a hit arrives
+        int32_t wait = nextFrame - millis();
+        HitEvent event;
+        bool isHit = xQueueReceive(hitQueues[pad], &event, pdMS_TO_TICKS(max<int32_t>(0, wait))) == pdTRUE;
+        profileLoopBegin(PROFILE_LED + pad);
+        uint32_t currentTime = millis();
 
-                    strip.setBrightness(brightness);
-                    strip.show();
+        bool external = baseData.external.load();
+        if (isHit && external && !baseData.composite.load())
+            isHit = false; // host owns the LEDs
 
-                    vTaskDelay(pdMS_TO_TICKS(500 - (speed * 50)));
+        if (isHit)
+        {
+            // a new hit restarts the effect
+            strip.hitTime = event.time;
+            strip.composite = external;
+            hitParams(hitFx.p, event.velocity);
+            uint8_t fromEffect;
+            presetFades[LAYER_HIT].poll(fadeSeen[LAYER_HIT], hitFrom, fromEffect, fadeStart[LAYER_HIT], fadeMs[LAYER_HIT]);
+            uint32_t since = currentTime - fadeStart[LAYER_HIT];
+            if (since < fadeMs[LAYER_HIT])
+                lerpParams(hitFx.p, hitFrom, since * 255 / fadeMs[LAYER_HIT]);
+            hitFx.seed = event.time;
+            beginEffect(hitFx, hitData.effect.load(), strip, currentTime);
+            hitActive = true;
+        }
 
-                    for (int i = 0; i < ledCount; i++)
-                        strip.setPixelColor(i, 0);
-                    strip.setBrightness(brightness);
-                    strip.show();
-                    vTaskDelay(pdMS_TO_TICKS(500 - (speed * 50)));
+        if (hitActive)
+        {
+            nextFrame = runEffect(hitFx, strip, currentTime);
+            if (nextFrame == EFFECT_DONE)
+            {
+                // hand the segment straight back to the base, which redraws
+                hitActive = false;
+                strip.composite = false;
+                base.effect = FX_NONE;
+                nextFrame = currentTime;
+            }
+        }
+        else if ((int32_t)(currentTime - nextFrame) >= 0)
+        {
+            uint8_t effect = baseData.effect.load();
+            if (effect != base.effect)
+                beginEffect(base, effect, strip, currentTime);
+            baseParams(base.p);
 
-                    hue = (hue + 45) % 360;
-                }
-                else if (!rainbow && strobe)
-                {
-                    for (int i = 0; i < LED_COUNT; i++)
-                    {
-                        strip.setPixelColor(i, strip.Color(red, green, blue));
-                    }
-                    strip.setBrightness(brightness);
-                    strip.show();
-                    vTaskDelay(pdMS_TO_TICKS(1000 - (speed * 100)));
-                    for (int i = 0; i < LED_COUNT; i++)
-                    {
-                        strip.setPixelColor(i, 0);
-                    }
-                    strip.show();
-                    vTaskDelay(pdMS_TO_TICKS(1000 - (speed * 100)));
-                }
-                else if (rainbow && !strobe)
+            uint8_t fromEffect;
+            if (presetFades[LAYER_BASE].poll(fadeSeen[LAYER_BASE], fadeOut.p, fromEffect, fadeStart[LAYER_BASE], fadeMs[LAYER_BASE]))
+                beginEffect(fadeOut, fromEffect, strip, fadeStart[LAYER_BASE]);
+            uint32_t since = currentTime - fadeStart[LAYER_BASE];
+            if (since < fadeMs[LAYER_BASE])
+            {
+                uint8_t mix = since * 255 / fadeMs[LAYER_BASE];
+                if (sameLook(fadeOut, base))
                 {
-                    // make it fast
-                    static uint16_t hue = 0;
-                    uint32_t color = strip.gamma32(strip.ColorHSV(hue * 182));
-                    for (int i = 0; i < strip.numPixels(); i++)
-                    {
-                        strip.setPixelColor(i, color);
-                    }
-
-                    strip.setBrightness(brightness);
-                    strip.show();
-
-                    hue = (hue + 1) % 360;
-                    vTaskDelay(pdMS_TO_TICKS(19 - (speed * 2)));
+                    lerpParams(base.p, fadeOut.p, mix);
+                    nextFrame = min(runEffect(base, strip, currentTime), currentTime + crossfadeFrameInterval);
                 }
                 else
-                {
-                    for (int i = 0; i < LED_COUNT; i++)
-                    {
-                        strip.setPixelColor(i, strip.Color(red, green, blue));
-                    }
-                    strip.setBrightness(brightness);
-                    strip.show();
-                    vTaskDelay(pdMS_TO_TICKS(1));
-                }
+                    nextFrame = runCrossfade(fadeOut, base, strip, currentTime, mix, scratch);
+            }
+            else
+                nextFrame = runEffect(base, strip, currentTime);
+        }
+        profileLoopEnd(PROFILE_LED + pad);
+    }
+}
+// idleService parks sensorTask at the top of its loop, where it holds
+// neither the ADC nor the UART2 TX lock, instead of suspending it mid-read
+atomic<bool> sensorPause{false}, sensorParked{false};
+void parkSensorTask()
+{
+    sensorPause.store(true);
+    while (!sensorParked.load())
+        vTaskDelay(1);
+}
+void unparkSensorTask()
+{
+    sensorPause.store(false);
+    xTaskNotifyGive(sensorTaskHandle);
+}
+void sensorTask(void *pvParameters)
+{
+    uint32_t lastHitTime[NUM_SENSORS] = {0};
+    int32_t baseline[NUM_SENSORS]; // resting level, 16.16 fixed point
+    uint32_t aboveSince[NUM_SENSORS] = {0};
+    fo10 baseline[i] = analogRead(piezoPins[i]) << 16;
+
+    while (true)
+    {
+        while (sensorPause.load())
+        {
+            sensorParked.store(true);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+        sensorParked.store(false);
+        profileLoopBegin(PROFILE_SENSOR);
+        uint32_t currentTime = millis();
+        fo10
+        {
+            int raw = analogRead(piezoPins[i]);
+            int level = max(0, raw - (int)(baseline[i] >> 16));
+            uint16_t threshold = padCal[i].threshold.load();
+            if (level <= threshold)
+                aboveSince[i] = 0;
+            else if (!aboveSince[i])
+                aboveSince[i] = currentTime | 1;
+            if (!aboveSince[i] || currentTime - aboveSince[i] > PIEZO_HOLD_MS)
+                baseline[i] += ((raw << 16) - baseline[i]) >> PIEZO_BASELINE_SHIFT;
+#ifdef DEBUG_PIEZO
+            Serial.print(piezoPins[i]);
+            Serial.print("  ");
+            Serial.print(raw);
+            Serial.print("  ");
+            Serial.println(level);
+#endif
+            padCalibrator.feed(i, level, currentTime);
+            if (level > threshold && (currentTime - lastHitTime[i] > hitCooldown))
+            {
+                lastHitTime[i] = currentTime;
+                dispatchHit(i, level, hitVelocity(i, level), currentTime, HIT_PIEZO);
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(10));
+        dispatchInbox(currentTime);
+        midiReceive(currentTime);
+        midiService(currentTime);
+        profileLoopEnd(PROFILE_SENSOR);
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+}
+// Idle governor, run from presetTask. With no hit, button, MIDI note or
+// host frame for IDLE_DIM_MS the clock drops to IDLE_CPU_MHZ and LEDs and
+// OLED dim; after IDLE_SLEEP_MS both go dark and the chip light-sleeps.
+// Pads wake it through their GPIO going high (the ESP32 has no analog
+// comparator wake), buttons by going low and MIDI through the RX line
+// leaving its idle high level (the byte that wakes it is lost). The pad that
+// woke it is played as a hit. If no pad can be armed it stays dark but awake
+// until the next activity. A running show, recording, audio, sync or
+// external mode holds the governor awake. wakeAtUs is picked up by the next
+// LedOutput::show() as the wake-to-first-frame latency.
+bool idleHeld()
+{
+    return showSong.load() >= 0 || recState.load() != REC_IDLE || baseData.audio.load() ||
+           baseData.sync.load() || baseData.external.load();
+}
+void setIdleStage(uint8_t stage)
+{
+    if (stage == idleStage.load())
+        return;
+    // the level first, so frames drawn during the clock switch are lit
+    idleLevel.store(stage == IDLE_ACTIVE ? 255 : stage == IDLE_DIM ? IDLE_LED_LEVEL : 0);
+    idleStage.store(stage);
+    setCpuFrequencyMhz(stage == IDLE_ACTIVE ? 240 : IDLE_CPU_MHZ);
+    ledOutput.request(); // static looks are not redrawn, push the new level
+}
+// arms `pin` to wake us when it reaches `level`, unless it is there already
+bool armWakePin(int pin, gpio_int_type_t level)
+{
+    if (digitalRead(pin) == (level == GPIO_INTR_HIGH_LEVEL ? HIGH : LOW))
+        return false;
+    esp_err_t err = gpio_wakeup_enable((gpio_num_t)pin, level);
+    if (err != ESP_OK)
+        Serial.printf("Wake pin %d: error %d\n", pin, err);
+    return err == ESP_OK;
+}
+// false if no pad can wake us. Pads are switched to digital inputs for this;
+// the caller keeps sensorTask parked until they are analog again.
+bool armWakePins()
+{
+    bool pad = false;
+    fo10
+    {
+        pinMode(piezoPins[i], INPUT);
+        pad |= armWakePin(piezoPins[i], GPIO_INTR_HIGH_LEVEL);
+    }
+    fo4 armWakePin(btnPins[i], GPIO_INTR_LOW_LEVEL);
+    fo6 armWakePin(presetPins[i], GPIO_INTR_LOW_LEVEL);
+    if (midiInEnabled)
+        armWakePin(MIDI_RX_PIN, GPIO_INTR_LOW_LEVEL); // a start bit
+    esp_err_t err = esp_sleep_enable_gpio_wakeup();
+    if (err != ESP_OK)
+        Serial.printf("GPIO wake: error %d\n", err);
+    return pad && err == ESP_OK;
+}
+void disarmWakePins()
+{
+    fo10 gpio_wakeup_disable((gpio_num_t)piezoPins[i]);
+    fo4 gpio_wakeup_disable((gpio_num_t)btnPins[i]);
+    fo6 gpio_wakeup_disable((gpio_num_t)presetPins[i]);
+    if (midiInEnabled)
+        gpio_wakeup_disable((gpio_num_t)MIDI_RX_PIN);
+}
+void idleService(uint32_t now)
+{
+    if (idleHeld())
+        noteActivity();
+    uint32_t idle = now - lastActivity.load();
+    if (idle < IDLE_DIM_MS)
+    {
+        setIdleStage(IDLE_ACTIVE);
+        return;
+    }
+    if (IDLE_SLEEP_MS == 0 || idle < IDLE_SLEEP_MS)
+    {
+        setIdleStage(IDLE_DIM);
+        return;
+    }
+    // the rest runs once on entering the stage
+    if (idleStage.load() == IDLE_SLEEP)
+        return;
+    setIdleStage(IDLE_SLEEP);
+    vTaskDelay(pdMS_TO_TICKS(IDLE_OLED_MS * 2)); // let oledTask switch the panel off
+    parkSensorTask();
+    bool armed = armWakePins();
+    uint32_t wokeAt = 0;
+    int8_t wakePad = -1;
+    if (armed)
+    {
+        Serial.flush();
+        esp_light_sleep_start();
+        wokeAt = micros();
+        // light sleep keeps no per-pin wake status on the ESP32, so look
+        // while the pulse is still there
+        fo10 if (wakePad < 0 && digitalRead(piezoPins[i]) == HIGH) wakePad = i;
+    }
+    disarmWakePins();
+    piezoAnalogMode();
+    if (armed)
+    {
+        // lit and marked active before sensorTask can draw a frame
+        noteActivity();
+        wakeAtUs.store(wokeAt);
+        setIdleStage(IDLE_ACTIVE);
+        if (wakePad >= 0)
+            queueHit(wakePad, IDLE_WAKE_VELOCITY, HIT_PIEZO);
     }
+    unparkSensorTask();
 }
 void presetTask(void *pvParameters)
 {
 
     while (true)
     {
+        profileLoopBegin(PROFILE_PRESET);
         bool pressed = false;
         fo6
         {
             presetState[i].store(!digitalRead(presetPins[i]));
             if (presetState[i].load())
+            {
                 pressed = true;
+                noteActivity();
+            }
             if (presetState[i].load() && (currentMenu.load() == MENU_MAIN))
             {
                 if (i < 3)
@@ -1027,6 +5154,10 @@ void presetTask(void *pvParameters)
                 vTaskDelay(pdMS_TO_TICKS(1));
             }
         }
+        serviceProtoJob();
+        showSequencer.service(millis());
+        idleService(millis());
+        profileLoopEnd(PROFILE_PRESET);
 
         vTaskDelay(pdMS_TO_TICKS(1));
     }
@@ -1039,57 +5170,94 @@ void restartLedTask()
         vTaskDelete(ledTaskHandle);
         ledTaskHandle = NULL;
     }
-    xTaskCreate(ledTask, "LED Task", 2048, NULL, 1, &ledTaskHandle);
+    xTaskCreatePinnedToCore(ledTask, "LED Task", LED_TASK_STACK, &taskParams[0], RENDER_TASK_PRIORITY, &ledTaskHandle, RENDER_TASK_CORE);
 }
 
-void setup()
+// Staged boot: the first stage brings up only what the renderer needs, so
+// the compiled-in HitData/BaseData look is on the LEDs within a frame of
+// reset. Input follows, then storage and the display come up in their own
+// tasks; the stages are recorded with bootMark().
+void bootTask(void *pvParameters)
 {
-    WiFi.disconnect(true);
-    WiFi.mode(WIFI_OFF);
-
-    btStop();
-    Serial.begin(9600);
-
-    if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C))
-    {
-        Serial.println("SSD1306 init failed");
-        while (true)
-            ;
-    }
-
-    fo4
-    {
-        pinMode(btnPins[i], INPUT_PULLUP);
-        buttonState[i].store(false);
-    }
-    fo6 pinMode(presetPins[i], INPUT_PULLUP);
     if (!SPIFFS.begin(true))
     {
         Serial.println("SPIFFS mount failed");
     }
-    fo10 pinMode(piezoPins[i], INPUT_PULLUP);
-    strip.begin();
-    strip.show();
-    xTaskCreate(oledTask, "OLED Task", 4096, NULL, 1, NULL);
-    xTaskCreate(buttonTask, "Task Task", 4096, NULL, 1, NULL);
-    // xTaskCreate(ledTask, "LED Task", 2048, NULL, 1, &ledTaskHandle);
+    bootMark("spiffs");
+    loadSettings();
+    bootMark("settings");
+    // fade from the default look into the first preset of each list
+    loadPresetToJson(0);
+    loadPresetToJson(3);
+    bootMark("presets");
+    xTaskCreatePinnedToCore(presetTask, "Preset Task", 4096, NULL, STORAGE_TASK_PRIORITY, &presetTaskHandle, STORAGE_TASK_CORE);
+    xTaskCreatePinnedToCore(serialTask, "Serial Task", 4096, NULL, UI_TASK_PRIORITY, &serialTaskHandle, UI_TASK_CORE);
+    xTaskCreatePinnedToCore(recorderTask, "Recorder Task", 4096, NULL, STORAGE_TASK_PRIORITY, &recorderTaskHandle, STORAGE_TASK_CORE);
+    bootMark("ready");
+    printBootTimeline();
+    vTaskDelete(NULL);
+}
+void setup()
+{
+    bootMark("setup");
+    Serial.setRxBufferSize(SERIAL_RX_BUFFER);
+    Serial.begin(SERIAL_BAUD);
+    storageMutex = xSemaphoreCreateMutex();
+
+    // stage 1: light
+    ledOutput.begin();
+    extFrames.begin(ledOutput.totalPixels);
+    xTaskCreatePinnedToCore(ledOutputTask, "LED Output", 4096, NULL, RENDER_TASK_PRIORITY, &ledOutput.task, RENDER_TASK_CORE);
     fo10
     {
+        taskParams[i] = padMap[i];
         taskParams[i].piezoPin = piezoPins[i];
-        taskParams[i].ledStart = i * 10;
-        taskParams[i].ledCount = 10;
-        xTaskCreate(
+        padSegments[i].attach(taskParams[i].ledChannel, taskParams[i].ledStart, taskParams[i].ledCount);
+        hitQueues[i] = xQueueCreate(1, sizeof(HitEvent));
+        xTaskCreatePinnedToCore(
             ledTask,
             "LED Task",
-            2048,
+            LED_TASK_STACK,
             &taskParams[i],
-            1,
-            &ledTaskHandles[i]);
+            RENDER_TASK_PRIORITY,
+            &ledTaskHandles[i],
+            RENDER_TASK_CORE);
+    }
+    bootMark("leds");
+
+    // stage 2: pads, buttons, MIDI
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_OFF);
+
+    btStop();
+    fo4
+    {
+        pinMode(btnPins[i], INPUT_PULLUP);
+        buttonState[i].store(false);
     }
-    xTaskCreate(presetTask, "Preset Task", 4096, NULL, 1, NULL);
+    fo6 pinMode(presetPins[i], INPUT_PULLUP);
+    buildNoteMap();
+    Serial2.setRxBufferSize(MIDI_RX_BUFFER);
+    Serial2.setTxBufferSize(MIDI_TX_BUFFER);
+    Serial2.begin(MIDI_BAUD, SERIAL_8N1, midiInEnabled ? MIDI_RX_PIN : -1, MIDI_TX_PIN);
+    analogReadResolution(12);
+    piezoAnalogMode();
+    recQueue = xQueueCreate(REC_QUEUE, sizeof(RecHit));
+    hitInbox = xQueueCreate(HIT_INBOX, sizeof(QueuedHit));
+    xTaskCreatePinnedToCore(sensorTask, "Sensor Task", 2048, NULL, SENSE_TASK_PRIORITY, &sensorTaskHandle, SENSE_TASK_CORE);
+    xTaskCreatePinnedToCore(audioTask, "Audio Task", 4096, NULL, AUDIO_TASK_PRIORITY, &audioTaskHandle, AUDIO_TASK_CORE);
+    xTaskCreatePinnedToCore(buttonTask, "Task Task", 4096, NULL, UI_TASK_PRIORITY, &buttonTaskHandle, UI_TASK_CORE);
+    bootMark("input");
+
+    // stage 3: storage and display in the background
+    xTaskCreatePinnedToCore(bootTask, "Boot Task", 4096, NULL, STORAGE_TASK_PRIORITY, NULL, STORAGE_TASK_CORE);
+    xTaskCreatePinnedToCore(oledTask, "OLED Task", 4096, NULL, UI_TASK_PRIORITY, &oledTaskHandle, UI_TASK_CORE);
 }
 void loop()
 {
+    // everything runs in the pinned tasks above; free the Arduino loop task
+    // so it does not round-robin with the renderer on core 1
+    vTaskDelete(NULL);
 }
 
 void menu_screen()
@@ -1111,6 +5279,20 @@ void menu_screen()
 
         display.setCursor(2, y);
         display.print(mainMenuItems[i]);
+        if (i == static_cast<int>(MainMenu::TAP))
+        {
+            display.setCursor(102, y);
+            display.print(beatClock.bpm());
+        }
+        else if (i == static_cast<int>(MainMenu::SHOW))
+        {
+            display.setCursor(84, y);
+            int8_t song = showSong.load();
+            if (song < 0)
+                display.print("off");
+            else
+                display.printf("%d:%d", song + 1, showCue.load() + 1);
+        }
     }
     display.display();
 }
@@ -1118,9 +5300,11 @@ void base_screen(int selectedWidth)
 {
     display.clearDisplay();
 
-    for (int i = 0; i < baseItemCount; i++)
+    // six rows fit on the screen, scroll once the selection goes past them
+    int first = max(0, selectedBaseIndex.load() - 5);
+    for (int i = first; i < baseItemCount; i++)
     {
-        int y = i * 10;
+        int y = (i - first) * 10;
         if (i == selectedBaseIndex.load())
         {
             display.fillRect(selectedWidth, y, SCREEN_WIDTH, 10, SSD1306_WHITE);
@@ -1152,6 +5336,14 @@ void base_screen(int selectedWidth)
         {
             line += String(baseData.rainbow.load() ? "On" : "Off");
         }
+        else if (i == static_cast<int>(BaseMenu::AUDIO))
+        {
+            line += String(baseData.audio.load() ? "On" : "Off");
+        }
+        else if (i == static_cast<int>(BaseMenu::SYNC))
+        {
+            line += String(baseData.sync.load() ? "On" : "Off");
+        }
 
         display.print(line);
     }
@@ -1286,4 +5478,56 @@ void mem_screen(String line)
     display.setCursor(0, 20);
     display.print(line);
     display.display();
-}
\ No newline at end of file
+}
+void diag_screen()
+{
+    display.clearDisplay();
+    display.setTextColor(SSD1306_WHITE);
+    display.setCursor(0, 0);
+    display.print("Task  CPU  jms stack");
+    int y = 10;
+    for (uint8_t id = 0; id < PROFILE_COUNT && y < SCREEN_HEIGHT; id++)
+    {
+        TaskProfile &p = profiles[id];
+        if (p.handle == NULL)
+            continue;
+        char line[24];
+        snprintf(line, sizeof(line), "%-5.5s %3u%% %4u %5u", p.name, p.cpuPercent.load(),
+                 (unsigned)min<uint32_t>(9999, p.jitterUs.load() / 1000),
+                 (unsigned)uxTaskGetStackHighWaterMark(p.handle));
+        display.setCursor(0, y);
+        display.print(line);
+        y += 10;
+    }
+    display.display();
+}
+void cal_screen()
+{
+    static const char *prompts[] = {"ok: start", "keep still", "hit softly", "hit hard", "ok: save"};
+    uint8_t step = padCalibrator.step.load();
+    uint8_t pad = step == CAL_IDLE ? selectedCalPad.load() : padCalibrator.pad.load();
+    display.clearDisplay();
+    display.setTextColor(SSD1306_WHITE);
+    display.setCursor(0, 0);
+    display.printf("Calibrate pad %u", pad + 1);
+    display.setCursor(0, 14);
+    display.print(prompts[step]);
+    if (step == CAL_SOFT || step == CAL_HARD)
+        display.printf(" %u/%u", padCalibrator.strikes.load() + 1, CAL_STRIKES);
+    display.setCursor(0, 28);
+    if (step == CAL_DONE)
+    {
+        uint16_t threshold, low, high;
+        padCalibrator.result(threshold, low, high);
+        display.printf("thr %u vel %u-%u", threshold, low, high);
+    }
+    else
+        display.printf("thr %u vel %u-%u", padCal[pad].threshold.load(), padCal[pad].low.load(),
+                       padCal[pad].high.load());
+    if (step != CAL_IDLE)
+    {
+        display.setCursor(0, 42);
+        display.printf("noise %u", padCalibrator.noise.load());
+    }
+    display.display();
+}
@@ -0,0 +1,5 @@
+# libFuzzer comes with clang; the sanitizers have to be linked in as well
+Import("env")
+
+env.Replace(CC="clang", CXX="clang++", LINK="clang++")
+env.Append(LINKFLAGS=["-fsanitize=fuzzer,address,undefined"])
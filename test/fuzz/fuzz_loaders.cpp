@@ -0,0 +1,74 @@
+// libFuzzer target for everything read back from flash: settings.json
+// through loadSettings() and the preset loader (readJsonFile, presetError,
+// applyPreset), effect programs through vmReadProgram() and vmRun(), and
+// cue lists through the show sequencer. The first input byte picks which
+// file the rest of the input becomes; the corpus has one seed of each.
+#include "main.cpp"
+
+// presets for the cue lists to recall, and the list itself at /fuzz.json
+const char fuzzSettings[] =
+    "{\"shows\": [\"/fuzz.json\"],"
+    " \"base\": [{\"red\": 255, \"green\": 0, \"blue\": 0, \"brightness\": 200, \"speed\": 1},"
+    "            {\"red\": 0, \"green\": 255, \"blue\": 0, \"brightness\": 200, \"speed\": 2, \"palette\": \"fire\"},"
+    "            {\"red\": 0, \"green\": 0, \"blue\": 255, \"brightness\": 200, \"speed\": 3, \"program\": \"/fx/fuzz.fxb\"}],"
+    " \"hit\": [{\"red\": 255, \"green\": 255, \"blue\": 255, \"brightness\": 255, \"tail\": 3},"
+    "           {\"red\": 255, \"green\": 0, \"blue\": 255, \"brightness\": 255, \"tail\": 1, \"chase\": true},"
+    "           {\"red\": 0, \"green\": 255, \"blue\": 255, \"brightness\": 255, \"tail\": 9, \"palette\": [[0, 0, 0, 0], [255, 255, 0, 0]]}]}";
+
+enum FuzzTarget
+{
+    FUZZ_SETTINGS,
+    FUZZ_PROGRAM,
+    FUZZ_CUE_LIST,
+    FUZZ_TARGETS
+};
+
+void fuzzProgram(const uint8_t *data, size_t size)
+{
+    static uint32_t lut[256];
+    VmProgram prog;
+    SPIFFS.put("/fuzz.fxb", data, size);
+    if (!vmReadProgram("/fuzz.fxb", prog))
+        return;
+    VmInputs in = {(int32_t)millis(), PAD_LEDS, 127, 128, 0xFF8000, 200, 100, 50, lut};
+    int32_t budget = VM_MAX_OPS_PER_FRAME;
+    for (int32_t i = 0; i < PAD_LEDS; i++)
+        vmRun(prog, in, i, budget);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size == 0)
+        return 0;
+    SPIFFS.format();
+    Serial.tx.clear();
+    const uint8_t *body = data + 1;
+    size -= 1;
+    switch (data[0] % FUZZ_TARGETS)
+    {
+    case FUZZ_SETTINGS:
+        SPIFFS.put(JSON_FILE, body, size);
+        loadSettings();
+        for (uint8_t i = 0; i < 6; i++)
+            loadPresetToJson(i);
+        break;
+    case FUZZ_PROGRAM:
+        fuzzProgram(body, size);
+        break;
+    case FUZZ_CUE_LIST:
+        SPIFFS.put(JSON_FILE, fuzzSettings, sizeof(fuzzSettings) - 1);
+        SPIFFS.put("/fuzz.json", body, size);
+        loadSettings();
+        showSequencer.request(0);
+        for (uint8_t poll = 0; poll < 8; poll++)
+        {
+            showSequencer.service(millis());
+            dispatchHit(0, 2000, 100, millis(), HIT_PIEZO);
+            shim::advanceMs(100);
+        }
+        showSequencer.request(-1);
+        showSequencer.service(millis());
+        break;
+    }
+    return 0;
+}
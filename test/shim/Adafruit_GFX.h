@@ -0,0 +1,19 @@
+// display drawing for the host shim goes nowhere
+#pragma once
+#include <Arduino.h>
+
+class Adafruit_GFX : public Print
+{
+public:
+    using Print::write;
+    size_t write(uint8_t) override { return 1; }
+    void setTextSize(uint8_t) {}
+    void setTextColor(uint16_t) {}
+    void setTextColor(uint16_t, uint16_t) {}
+    void setCursor(int16_t, int16_t) {}
+    void fillRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+    void drawRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+    void drawFastHLine(int16_t, int16_t, int16_t, uint16_t) {}
+    void drawFastVLine(int16_t, int16_t, int16_t, uint16_t) {}
+    void drawPixel(int16_t, int16_t, uint16_t) {}
+};
@@ -0,0 +1,79 @@
+// The colour helpers of Adafruit NeoPixel for the host shim. main.cpp drives
+// the strips itself and only uses these; the tables are built with the
+// generator snippets given in the library's header, so frames hash the same
+// on the host as on the board.
+#pragma once
+#include <Arduino.h>
+
+#define NEO_GRB 0x52
+#define NEO_KHZ800 0x0000
+
+class Adafruit_NeoPixel
+{
+public:
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return (uint32_t)r << 16 | (uint32_t)g << 8 | b; }
+    static uint32_t ColorHSV(uint16_t hue, uint8_t sat = 255, uint8_t val = 255)
+    {
+        uint8_t r, g, b;
+        hue = (hue * 1530L + 32768) / 65536;
+        if (hue < 510)
+        {
+            b = 0;
+            if (hue < 255)
+                r = 255, g = hue;
+            else
+                r = 510 - hue, g = 255;
+        }
+        else if (hue < 1020)
+        {
+            r = 0;
+            if (hue < 765)
+                g = 255, b = hue - 510;
+            else
+                g = 1020 - hue, b = 255;
+        }
+        else if (hue < 1530)
+        {
+            g = 0;
+            if (hue < 1275)
+                r = hue - 1020, b = 255;
+            else
+                r = 255, b = 1530 - hue;
+        }
+        else
+            r = 255, g = b = 0;
+        uint32_t v1 = 1 + val;
+        uint16_t s1 = 1 + sat;
+        uint8_t s2 = 255 - sat;
+        return ((((((r * s1) >> 8) + s2) * v1) & 0xff00) << 8) | (((((g * s1) >> 8) + s2) * v1) & 0xff00) |
+               (((((b * s1) >> 8) + s2) * v1) >> 8);
+    }
+    static uint8_t sine8(uint8_t x) { return table().sine[x]; }
+    static uint8_t gamma8(uint8_t x) { return table().gamma[x]; }
+    static uint32_t gamma32(uint32_t x)
+    {
+        uint8_t *y = (uint8_t *)&x;
+        for (uint8_t i = 0; i < 4; i++)
+            y[i] = gamma8(y[i]);
+        return x;
+    }
+
+private:
+    struct Tables
+    {
+        uint8_t sine[256], gamma[256];
+        Tables()
+        {
+            for (int x = 0; x < 256; x++)
+            {
+                sine[x] = (uint8_t)((sin(x / 128.0 * PI) + 1.0) * 127.5 + 0.5);
+                gamma[x] = (uint8_t)(pow(x / 255.0, 2.6) * 255.0 + 0.5);
+            }
+        }
+    };
+    static const Tables &table()
+    {
+        static Tables t;
+        return t;
+    }
+};
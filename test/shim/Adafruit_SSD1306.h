@@ -0,0 +1,19 @@
+#pragma once
+#include <Adafruit_GFX.h>
+
+#define SSD1306_WHITE 1
+#define SSD1306_BLACK 0
+#define SSD1306_SWITCHCAPVCC 2
+#define SSD1306_DISPLAYOFF 0xAE
+#define SSD1306_DISPLAYON 0xAF
+#define SSD1306_SETCONTRAST 0x81
+class Adafruit_SSD1306 : public Adafruit_GFX
+{
+public:
+    Adafruit_SSD1306(uint8_t, uint8_t, TwoWire *, int8_t) {}
+    bool begin(uint8_t, uint8_t) { return true; }
+    void clearDisplay() {}
+    void display() {}
+    void ssd1306_command(uint8_t) {}
+    void dim(bool) {}
+};
@@ -0,0 +1,255 @@
+// Host shim for the native test and fuzz environments. Just enough of the
+// Arduino-ESP32 core for src/main.cpp to build and run on a PC: a virtual
+// clock the tests advance, pin levels they set, and serial ports backed by
+// byte buffers. Everything is header-only; each test includes main.cpp.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+
+#define ARDUINO 10800
+#define IRAM_ATTR
+#define HIGH 1
+#define LOW 0
+#define INPUT 1
+#define OUTPUT 2
+#define INPUT_PULLUP 5
+#define ANALOG 0xC0
+#define SERIAL_8N1 0
+#define PROGMEM
+#define PI 3.1415926535897932384626433832795
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_ptr(p) (*(void *const *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_float(p) (*(const float *)(p))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define ARDUINOJSON_ENABLE_PROGMEM 0 // no flash strings on a PC
+
+typedef bool boolean;
+typedef uint8_t byte;
+using std::max;
+using std::min;
+
+namespace shim
+{
+inline uint64_t nowUs = 0;
+inline int analogLevel[40];
+inline int digitalLevel[40];
+inline uint32_t cpuMhz = 240;
+// benchmarks set this to time real work: micros() and millis() then follow
+// the host's steady clock instead of nowUs
+inline bool realClock = false;
+inline void advanceMs(uint32_t ms) { nowUs += (uint64_t)ms * 1000; }
+inline uint64_t clockUs()
+{
+    if (!realClock)
+        return nowUs;
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+} // namespace shim
+
+inline unsigned long millis() { return shim::clockUs() / 1000; }
+inline unsigned long micros() { return shim::clockUs(); }
+inline void delay(unsigned long ms) { shim::advanceMs(ms); }
+inline void delayMicroseconds(unsigned int us) { shim::nowUs += us; }
+inline int analogRead(uint8_t pin) { return shim::analogLevel[pin % 40]; }
+inline int digitalRead(uint8_t pin) { return shim::digitalLevel[pin % 40]; }
+inline void digitalWrite(uint8_t pin, uint8_t level) { shim::digitalLevel[pin % 40] = level; }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void analogReadResolution(uint8_t) {}
+inline void analogSetPinAttenuation(uint8_t, int) {}
+enum
+{
+    ADC_0db,
+    ADC_2_5db,
+    ADC_6db,
+    ADC_11db
+};
+inline bool setCpuFrequencyMhz(uint32_t mhz)
+{
+    shim::cpuMhz = mhz;
+    return true;
+}
+inline uint32_t getCpuFrequencyMhz() { return shim::cpuMhz; }
+inline long random(long high) { return high > 0 ? rand() % high : 0; }
+inline long random(long low, long high) { return high > low ? low + rand() % (high - low) : low; }
+inline long map(long x, long inMin, long inMax, long outMin, long outMax)
+{
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+// glibc before 2.38 has no strlcpy
+inline size_t shimStrlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size)
+    {
+        size_t n = min(len, size - 1);
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+#define strlcpy shimStrlcpy
+
+class String
+{
+public:
+    String(const char *s = "") : s(s ? s : "") {}
+    String(int v) : s(std::to_string(v)) {}
+    String(unsigned v) : s(std::to_string(v)) {}
+    String(long v) : s(std::to_string(v)) {}
+    String(unsigned long v) : s(std::to_string(v)) {}
+    String(double v, int digits = 2)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", digits, v);
+        s = buf;
+    }
+    String operator+(const String &o) const { return String((s + o.s).c_str()); }
+    String &operator+=(const String &o)
+    {
+        s += o.s;
+        return *this;
+    }
+    const char *c_str() const { return s.c_str(); }
+    unsigned length() const { return s.size(); }
+    bool concat(const char *p, unsigned n)
+    {
+        s.append(p, n);
+        return true;
+    }
+    bool concat(const char *p) { return concat(p, strlen(p)); }
+    bool concat(char c) { return concat(&c, 1); }
+    bool operator==(const char *p) const { return s == p; }
+    bool startsWith(const char *p) const { return s.rfind(p, 0) == 0; }
+    bool endsWith(const char *p) const
+    {
+        size_t n = strlen(p);
+        return s.size() >= n && s.compare(s.size() - n, n, p) == 0;
+    }
+
+private:
+    std::string s;
+};
+inline String operator+(const char *a, const String &b) { return String(a) + b; }
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *data, size_t n)
+    {
+        size_t done = 0;
+        while (done < n && write(data[done]))
+            done++;
+        return done;
+    }
+    size_t write(const char *text, size_t n) { return write((const uint8_t *)text, n); }
+    size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t print(const String &text) { return print(text.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(unsigned v) { return printf("%u", v); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+    size_t println() { return print("\r\n"); }
+    template <class T>
+    size_t println(T v)
+    {
+        size_t n = print(v);
+        return n + println();
+    }
+    size_t println(double v, int digits) { return print(v, digits) + println(); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buf[512];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        return n > 0 ? write((const uint8_t *)buf, min<size_t>(n, sizeof(buf) - 1)) : 0;
+    }
+};
+class Printable
+{
+public:
+    virtual size_t printTo(Print &) const = 0;
+};
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    size_t readBytes(uint8_t *buf, size_t n)
+    {
+        size_t got = 0;
+        for (int c; got < n && (c = read()) >= 0;)
+            buf[got++] = c;
+        return got;
+    }
+    size_t readBytes(char *buf, size_t n) { return readBytes((uint8_t *)buf, n); }
+    void setTimeout(unsigned long) {}
+};
+
+// `rx` is what the port will read, `tx` collects what was written; Serial
+// also echoes to stdout when `echo` is set
+class HardwareSerial : public Stream
+{
+public:
+    std::deque<uint8_t> rx;
+    std::string tx;
+    bool echo = false;
+    size_t txRoom = 128;
+
+    HardwareSerial(int) {}
+    void begin(unsigned long, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1) {}
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t n) override
+    {
+        tx.append((const char *)data, n);
+        if (echo)
+            fwrite(data, 1, n, stdout);
+        return n;
+    }
+    int available() override { return rx.size(); }
+    int read() override
+    {
+        if (rx.empty())
+            return -1;
+        int c = rx.front();
+        rx.pop_front();
+        return c;
+    }
+    int peek() override { return rx.empty() ? -1 : rx.front(); }
+    int availableForWrite() { return txRoom; }
+    size_t setRxBufferSize(size_t n) { return n; }
+    size_t setTxBufferSize(size_t n) { return n; }
+    void flush() {}
+    void feed(const uint8_t *data, size_t n) { rx.insert(rx.end(), data, data + n); }
+};
+inline HardwareSerial Serial(0);
+inline HardwareSerial Serial1(1);
+inline HardwareSerial Serial2(2);
+
+class TwoWire
+{
+public:
+    bool begin(int = -1, int = -1, uint32_t = 0) { return true; }
+    void setClock(uint32_t) {}
+};
+inline TwoWire Wire;
+
+#include "freertos/FreeRTOS.h"
@@ -0,0 +1,120 @@
+// An in-memory file system for the host shim. Files are shared byte
+// vectors, so an open File keeps its data when the name is removed or
+// renamed, as on SPIFFS.
+#pragma once
+#include <Arduino.h>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+typedef std::shared_ptr<std::vector<uint8_t>> ShimFileData;
+class File : public Stream
+{
+public:
+    File() {}
+    File(ShimFileData data, const char *path, bool writable)
+        : data(data), name_(path), writable(writable), pos(writable ? data->size() : 0) {}
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t n) override
+    {
+        if (!data || !writable)
+            return 0;
+        data->insert(data->end(), buf, buf + n);
+        return n;
+    }
+    int available() override { return data ? data->size() - pos : 0; }
+    int read() override { return available() > 0 ? (*data)[pos++] : -1; }
+    int peek() override { return available() > 0 ? (*data)[pos] : -1; }
+    size_t read(uint8_t *buf, size_t n)
+    {
+        n = min<size_t>(n, available());
+        if (n)
+            memcpy(buf, data->data() + pos, n);
+        pos += n;
+        return n;
+    }
+    bool seek(uint32_t to)
+    {
+        if (!data || to > data->size())
+            return false;
+        pos = to;
+        return true;
+    }
+    size_t position() const { return pos; }
+    size_t size() const { return data ? data->size() : 0; }
+    void flush() {}
+    void close() { data.reset(); }
+    operator bool() const { return (bool)data; }
+    bool isDirectory() { return false; }
+    File openNextFile() { return File(); }
+    const char *name() const { return name_.c_str(); }
+    const char *path() const { return name_.c_str(); }
+
+private:
+    ShimFileData data;
+    std::string name_;
+    bool writable = false;
+    size_t pos = 0;
+};
+
+namespace fs
+{
+class FS
+{
+public:
+    std::unordered_map<std::string, ShimFileData> files;
+
+    File open(const char *path, const char *mode = FILE_READ)
+    {
+        auto it = files.find(path);
+        if (mode[0] == 'r')
+            return it == files.end() ? File() : File(it->second, path, false);
+        if (mode[0] == 'w' || it == files.end())
+            files[path] = std::make_shared<std::vector<uint8_t>>();
+        return File(files[path], path, true);
+    }
+    File open(const String &path, const char *mode = FILE_READ) { return open(path.c_str(), mode); }
+    bool exists(const char *path) { return files.count(path) != 0; }
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path) { return files.erase(path) != 0; }
+    bool rename(const char *from, const char *to)
+    {
+        auto it = files.find(from);
+        if (it == files.end())
+            return false;
+        ShimFileData data = it->second;
+        files.erase(it);
+        files[to] = data;
+        return true;
+    }
+    // test helpers: put bytes or a host file at `path`, read a file back
+    void put(const char *path, const void *bytes, size_t n)
+    {
+        const uint8_t *p = (const uint8_t *)bytes;
+        files[path] = std::make_shared<std::vector<uint8_t>>(p, p + n);
+    }
+    bool load(const char *path, const char *hostPath)
+    {
+        FILE *f = fopen(hostPath, "rb");
+        if (!f)
+            return false;
+        std::vector<uint8_t> bytes;
+        uint8_t buf[4096];
+        for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;)
+            bytes.insert(bytes.end(), buf, buf + n);
+        fclose(f);
+        put(path, bytes.data(), bytes.size());
+        return true;
+    }
+    std::string contents(const char *path)
+    {
+        auto it = files.find(path);
+        return it == files.end() ? std::string() : std::string(it->second->begin(), it->second->end());
+    }
+};
+} // namespace fs
@@ -0,0 +1,8 @@
+#pragma once
+#define WIFI_OFF 0
+struct WiFiClass
+{
+    bool disconnect(bool = false) { return true; }
+    bool mode(int) { return true; }
+};
+inline WiFiClass WiFi;
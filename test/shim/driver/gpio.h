@@ -0,0 +1,11 @@
+#pragma once
+#include "driver/rmt.h"
+
+typedef enum
+{
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_LOW_LEVEL = 4,
+    GPIO_INTR_HIGH_LEVEL = 5
+} gpio_int_type_t;
+inline esp_err_t gpio_wakeup_enable(gpio_num_t, gpio_int_type_t) { return ESP_OK; }
+inline esp_err_t gpio_wakeup_disable(gpio_num_t) { return ESP_OK; }
@@ -0,0 +1,72 @@
+// RMT for the host shim: configuration succeeds and writes are only counted
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+typedef int gpio_num_t;
+typedef enum
+{
+    RMT_CHANNEL_0,
+    RMT_CHANNEL_1,
+    RMT_CHANNEL_2,
+    RMT_CHANNEL_3,
+    RMT_CHANNEL_4,
+    RMT_CHANNEL_5,
+    RMT_CHANNEL_6,
+    RMT_CHANNEL_7,
+    RMT_CHANNEL_MAX
+} rmt_channel_t;
+typedef struct
+{
+    union
+    {
+        struct
+        {
+            uint32_t duration0 : 15;
+            uint32_t level0 : 1;
+            uint32_t duration1 : 15;
+            uint32_t level1 : 1;
+        };
+        uint32_t val;
+    };
+} rmt_item32_t;
+typedef struct
+{
+    int rmt_mode;
+    rmt_channel_t channel;
+    gpio_num_t gpio_num;
+    uint8_t clk_div;
+    uint8_t mem_block_num;
+    uint32_t flags;
+    struct
+    {
+        bool carrier_en;
+        bool loop_en;
+        bool idle_output_en;
+        int idle_level;
+    } tx_config;
+} rmt_config_t;
+#define RMT_DEFAULT_CONFIG_TX(gpio, channel_id) {0, channel_id, gpio, 80, 1, 0, {false, false, true, 0}}
+typedef void (*sample_to_rmt_t)(const void *, rmt_item32_t *, size_t, size_t, size_t *, size_t *);
+
+inline esp_err_t rmt_config(const rmt_config_t *) { return ESP_OK; }
+inline esp_err_t rmt_driver_install(rmt_channel_t, size_t, int) { return ESP_OK; }
+inline esp_err_t rmt_translator_init(rmt_channel_t, sample_to_rmt_t) { return ESP_OK; }
+namespace shim
+{
+inline uint32_t rmtWrites = 0; // rmt_write_sample calls, all channels
+}
+inline esp_err_t rmt_write_sample(rmt_channel_t, const uint8_t *, size_t, bool)
+{
+    shim::rmtWrites++;
+    return ESP_OK;
+}
+inline esp_err_t rmt_wait_tx_done(rmt_channel_t, uint32_t) { return ESP_OK; }
+inline esp_err_t rmt_get_counter_clock(rmt_channel_t, uint32_t *hz)
+{
+    *hz = 40000000;
+    return ESP_OK;
+}
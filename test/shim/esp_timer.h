@@ -0,0 +1,23 @@
+// esp_timer for the host shim: the clock is the virtual one, timers never fire
+#pragma once
+#include <Arduino.h>
+
+typedef void *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *);
+typedef struct
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    int dispatch_method;
+    const char *name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+inline int64_t esp_timer_get_time() { return shim::nowUs; }
+inline int esp_timer_create(const esp_timer_create_args_t *, esp_timer_handle_t *timer)
+{
+    *timer = NULL;
+    return 0;
+}
+inline int esp_timer_start_periodic(esp_timer_handle_t, uint64_t) { return 0; }
+inline int esp_timer_start_once(esp_timer_handle_t, uint64_t) { return 0; }
+inline int esp_timer_stop(esp_timer_handle_t) { return 0; }
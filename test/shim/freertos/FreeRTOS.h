@@ -0,0 +1,39 @@
+// FreeRTOS for the host shim: a single thread, so tasks are never started,
+// critical sections are no-ops and a delay just moves the virtual clock.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portTICK_PERIOD_MS 1
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+
+struct portMUX_TYPE
+{
+    int owner;
+};
+#define portMUX_INITIALIZER_UNLOCKED {0}
+inline void portENTER_CRITICAL(portMUX_TYPE *) {}
+inline void portEXIT_CRITICAL(portMUX_TYPE *) {}
+
+// queues and semaphores share one type, as they do in FreeRTOS
+struct ShimQueue
+{
+    size_t itemSize, length;
+    std::deque<std::vector<uint8_t>> items;
+};
+typedef ShimQueue *QueueHandle_t;
+typedef ShimQueue *SemaphoreHandle_t;
@@ -0,0 +1,43 @@
+#pragma once
+#include "FreeRTOS.h"
+
+// nothing else runs while a call would block, so timeouts are not waited out
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    return new ShimQueue{itemSize, length, {}};
+}
+inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t)
+{
+    if (q->items.size() >= q->length)
+        return pdFALSE;
+    const uint8_t *p = (const uint8_t *)item;
+    q->items.emplace_back(p, p + q->itemSize);
+    return pdTRUE;
+}
+inline BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t wait)
+{
+    return xQueueSend(q, item, wait);
+}
+inline BaseType_t xQueueSendFromISR(QueueHandle_t q, const void *item, BaseType_t *)
+{
+    return xQueueSend(q, item, 0);
+}
+inline BaseType_t xQueueOverwrite(QueueHandle_t q, const void *item)
+{
+    q->items.clear();
+    return xQueueSend(q, item, 0);
+}
+inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t)
+{
+    if (q->items.empty())
+        return pdFALSE;
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    return pdTRUE;
+}
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) { return q->items.size(); }
+inline BaseType_t xQueueReset(QueueHandle_t q)
+{
+    q->items.clear();
+    return pdPASS;
+}
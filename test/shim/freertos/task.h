@@ -0,0 +1,54 @@
+#pragma once
+#include "FreeRTOS.h"
+#include <Arduino.h>
+
+namespace shim
+{
+struct CreatedTask
+{
+    std::string name;
+    TaskFunction_t fn;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+// every task created so far, in order; an entry's address is its handle
+inline std::deque<CreatedTask> tasks;
+} // namespace shim
+
+// tests call task bodies' helpers directly; created tasks never run
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t, void *,
+                                          UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    shim::tasks.push_back({name, fn, priority, core});
+    if (handle)
+        *handle = &shim::tasks.back();
+    return pdPASS;
+}
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t priority,
+                              TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack, arg, priority, handle, tskNO_AFFINITY);
+}
+inline void vTaskDelay(TickType_t ticks) { shim::advanceMs(ticks); }
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskSuspend(TaskHandle_t) {}
+inline void vTaskResume(TaskHandle_t) {}
+inline void vTaskPrioritySet(TaskHandle_t, UBaseType_t) {}
+inline TickType_t xTaskGetTickCount() { return millis(); }
+inline void vTaskDelayUntil(TickType_t *last, TickType_t period)
+{
+    *last += period;
+    if ((int32_t)(*last - millis()) > 0)
+        shim::advanceMs(*last - millis());
+}
+inline BaseType_t xTaskDelayUntil(TickType_t *last, TickType_t period)
+{
+    vTaskDelayUntil(last, period);
+    return pdTRUE;
+}
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 0; }
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return NULL; }
+inline void taskYIELD() {}
+inline BaseType_t xPortGetCoreID() { return 1; }
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+inline BaseType_t xTaskNotifyGive(TaskHandle_t) { return pdPASS; }
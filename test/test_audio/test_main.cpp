@@ -0,0 +1,205 @@
+// Audio path: the Q15 FFT against a float DFT, and synthesised ADC blocks
+// (tones, a kick pattern) through band energies and the band followers.
+#include <unity.h>
+#include "main.cpp"
+
+#define N AUDIO_FFT_SIZE
+int16_t re[N], im[N];
+
+// 12-bit ADC samples around mid-rail: a tone of `amp` counts at `hz`, plus
+// optional noise; `decay` (per sample) shapes a drum-like envelope
+void tone(int16_t *block, float hz, float amp, uint32_t first = 0, float decay = 1.0f, int noise = 0)
+{
+    float env = 1.0f;
+    for (int k = 0; k < N; k++, env *= decay)
+    {
+        float v = amp * env * sinf(2 * PI * hz * (first + k) / AUDIO_SAMPLE_RATE);
+        block[k] = 2048 + (int16_t)v + (noise ? rand() % (2 * noise + 1) - noise : 0);
+    }
+}
+uint8_t loudestBand(const int16_t *block)
+{
+    uint64_t energy[3];
+    audioEnergy(block, energy);
+    uint8_t best = 0;
+    for (uint8_t b = 1; b < 3; b++)
+        if (energy[b] > energy[best])
+            best = b;
+    // and by a wide margin
+    for (uint8_t b = 0; b < 3; b++)
+        if (b != best)
+            TEST_ASSERT_LESS_THAN(energy[best] / 20 + 1, energy[b]);
+    return best;
+}
+
+void setUp()
+{
+    fftInit();
+    srand(3);
+}
+void tearDown() {}
+
+void test_cosine_lands_in_its_bin()
+{
+    for (int k = 0; k < N; k++)
+    {
+        re[k] = 16384 * cos(2 * PI * 16 * k / N);
+        im[k] = 0;
+    }
+    fftQ15(re, im);
+    // each stage halves, so a bin holds amplitude / 2
+    TEST_ASSERT_INT_WITHIN(16, 8192, re[16]);
+    TEST_ASSERT_INT_WITHIN(16, 8192, re[N - 16]);
+    for (int k = 0; k < N; k++)
+        if (k != 16 && k != N - 16)
+            TEST_ASSERT_INT_WITHIN(8, 0, abs(re[k]) + abs(im[k]));
+}
+
+void test_sine_is_imaginary()
+{
+    for (int k = 0; k < N; k++)
+    {
+        re[k] = 16384 * sin(2 * PI * 40 * k / N);
+        im[k] = 0;
+    }
+    fftQ15(re, im);
+    TEST_ASSERT_INT_WITHIN(16, -8192, im[40]);
+    TEST_ASSERT_INT_WITHIN(16, 8192, im[N - 40]);
+    TEST_ASSERT_INT_WITHIN(16, 0, re[40]);
+}
+
+void test_impulse_is_flat_and_full_scale_does_not_overflow()
+{
+    memset(re, 0, sizeof(re));
+    memset(im, 0, sizeof(im));
+    re[0] = 32767;
+    fftQ15(re, im);
+    for (int k = 0; k < N; k++)
+        TEST_ASSERT_INT_WITHIN(2, 128, re[k]);
+
+    for (int k = 0; k < N; k++)
+    {
+        re[k] = k & 1 ? -32768 : 32767; // Nyquist at full scale
+        im[k] = 0;
+    }
+    fftQ15(re, im);
+    TEST_ASSERT_INT_WITHIN(8, 32767, re[N / 2]);
+    TEST_ASSERT_INT_WITHIN(8, 0, re[0]);
+}
+
+void test_matches_a_float_dft_on_noise()
+{
+    double wantRe[N], wantIm[N];
+    for (int k = 0; k < N; k++)
+    {
+        re[k] = rand() % 16001 - 8000;
+        im[k] = rand() % 16001 - 8000;
+    }
+    for (int f = 0; f < N; f++)
+    {
+        wantRe[f] = wantIm[f] = 0;
+        for (int k = 0; k < N; k++)
+        {
+            double a = -2 * PI * f * k / N;
+            wantRe[f] += (re[k] * cos(a) - im[k] * sin(a)) / N;
+            wantIm[f] += (re[k] * sin(a) + im[k] * cos(a)) / N;
+        }
+    }
+    fftQ15(re, im);
+    for (int f = 0; f < N; f++)
+    {
+        TEST_ASSERT_INT_WITHIN(6, lround(wantRe[f]), re[f]);
+        TEST_ASSERT_INT_WITHIN(6, lround(wantIm[f]), im[f]);
+    }
+}
+
+void test_tones_fall_in_their_band()
+{
+    int16_t block[N];
+    tone(block, 125, 1500, 0, 1.0f, 20);
+    TEST_ASSERT_EQUAL(0, loudestBand(block));
+    tone(block, 1000, 1500, 0, 1.0f, 20);
+    TEST_ASSERT_EQUAL(1, loudestBand(block));
+    tone(block, 3000, 1500, 0, 1.0f, 20);
+    TEST_ASSERT_EQUAL(2, loudestBand(block));
+}
+
+void test_dc_offset_is_removed()
+{
+    int16_t block[N];
+    for (int k = 0; k < N; k++)
+        block[k] = 3900;
+    uint64_t energy[3];
+    audioEnergy(block, energy);
+    TEST_ASSERT_EQUAL(0, energy[0] + energy[1] + energy[2]);
+}
+
+void test_log2q_steps()
+{
+    TEST_ASSERT_EQUAL(0, log2q(0));
+    TEST_ASSERT_EQUAL(0, log2q(1));
+    TEST_ASSERT_EQUAL(8, log2q(4));
+    TEST_ASSERT_EQUAL(10, log2q(6));
+    TEST_ASSERT_EQUAL(63 * 4 + 3, log2q(UINT64_MAX));
+    for (uint64_t e = 1, last = 0; e < (1ull << 62); e = e * 3 / 2 + 1)
+    {
+        TEST_ASSERT_GREATER_OR_EQUAL(last, log2q(e));
+        last = log2q(e);
+    }
+}
+
+// a kick every 16 blocks (~0.5 s) over a quiet hi-hat bed, as the task
+// would see it: bass jumps on every kick and falls back in between
+void test_bass_follows_a_kick_pattern()
+{
+    int16_t block[N];
+    BandFollower bass, high;
+    uint8_t kickLevel = 255, gapLevel = 0, hatLevel = 0;
+    for (int b = 0; b < 16 * 12; b++)
+    {
+        bool kick = b % 16 == 0;
+        tone(block, kick ? 60 : 3500, kick ? 1800 : 120, b * N, kick ? 0.995f : 1.0f, 4);
+        uint64_t energy[3];
+        audioEnergy(block, energy);
+        uint8_t level = bass.update(log2q(energy[0]));
+        uint8_t hat = high.update(log2q(energy[2]));
+        if (b < 16 * 4)
+            continue; // let the followers settle
+        if (kick)
+            kickLevel = min(kickLevel, level);
+        else if (b % 16 == 15)
+            gapLevel = max(gapLevel, level);
+        else if (b % 16 == 8)
+            hatLevel = max(hatLevel, hat);
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(200, kickLevel);
+    TEST_ASSERT_LESS_THAN(64, gapLevel);
+    TEST_ASSERT_GREATER_THAN(0, hatLevel);
+}
+
+void test_follower_attacks_fast_and_releases_slowly()
+{
+    BandFollower f;
+    for (int k = 0; k < 50; k++)
+        f.update(40);
+    TEST_ASSERT_EQUAL(255, f.update(200));
+    uint8_t a = f.update(40), b = f.update(40);
+    TEST_ASSERT_LESS_THAN(255, a);
+    TEST_ASSERT_GREATER_OR_EQUAL(255 - 255 / 8 - 1, a); // at most an eighth per block
+    TEST_ASSERT_LESS_THAN(a, b);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_cosine_lands_in_its_bin);
+    RUN_TEST(test_sine_is_imaginary);
+    RUN_TEST(test_impulse_is_flat_and_full_scale_does_not_overflow);
+    RUN_TEST(test_matches_a_float_dft_on_noise);
+    RUN_TEST(test_tones_fall_in_their_band);
+    RUN_TEST(test_dc_offset_is_removed);
+    RUN_TEST(test_log2q_steps);
+    RUN_TEST(test_bass_follows_a_kick_pattern);
+    RUN_TEST(test_follower_attacks_fast_and_releases_slowly);
+    return UNITY_END();
+}
@@ -0,0 +1,141 @@
+// Beat clock: locking onto hit onsets, following tempo changes, tap tempo
+// and the phase the base effects sync to.
+#include <unity.h>
+#include "main.cpp"
+
+// `count` onsets `period` ms apart from `start`, each off by up to `jitter`;
+// returns the time of the last one
+uint32_t play(BeatClock &clock, uint32_t start, uint32_t period, int count, int jitter = 0)
+{
+    uint32_t t = start;
+    for (int k = 0; k < count; k++)
+    {
+        t = start + k * period;
+        clock.onHit(t + (jitter ? rand() % (2 * jitter + 1) - jitter : 0));
+    }
+    return t;
+}
+uint32_t phaseAt(BeatClock &clock, uint32_t now)
+{
+    uint32_t phase, period;
+    clock.beat(now, &phase, &period);
+    return min(phase, period - phase); // distance to the nearest beat
+}
+
+void setUp() { srand(7); }
+void tearDown() {}
+
+void test_locks_on_a_steady_beat()
+{
+    BeatClock clock;
+    TEST_ASSERT_FALSE(clock.locked());
+    uint32_t last = play(clock, 1000, 500, 4);
+    TEST_ASSERT_TRUE(clock.locked());
+    TEST_ASSERT_EQUAL(120, clock.bpm());
+    TEST_ASSERT_LESS_OR_EQUAL(2, phaseAt(clock, last + 500));
+}
+
+void test_follows_a_tempo_change()
+{
+    BeatClock clock;
+    uint32_t last = play(clock, 1000, 500, 8);
+    last = play(clock, last + 600, 600, 16);
+    TEST_ASSERT_TRUE(clock.locked());
+    TEST_ASSERT_UINT_WITHIN(1, 100, clock.bpm());
+    TEST_ASSERT_LESS_OR_EQUAL(5, phaseAt(clock, last + 600));
+}
+
+void test_drifts_with_a_slowing_player()
+{
+    BeatClock clock;
+    uint32_t t = 1000;
+    for (uint32_t period = 500; period <= 540; period += 2)
+    {
+        clock.onHit(t);
+        t += period;
+    }
+    TEST_ASSERT_TRUE(clock.locked());
+    TEST_ASSERT_UINT_WITHIN(2, 112, clock.bpm());
+}
+
+void test_holds_through_jitter()
+{
+    BeatClock clock;
+    play(clock, 1000, 500, 64, 15);
+    TEST_ASSERT_TRUE(clock.locked());
+    TEST_ASSERT_UINT_WITHIN(2, 120, clock.bpm());
+}
+
+void test_eighth_notes_and_flams_keep_the_tempo()
+{
+    BeatClock clock;
+    uint32_t last = play(clock, 1000, 500, 8);
+    for (int k = 1; k <= 16; k++)
+    {
+        clock.onHit(last + k * 250);
+        clock.onHit(last + k * 250 + 20); // flam: a second pad 20 ms later
+    }
+    TEST_ASSERT_TRUE(clock.locked());
+    TEST_ASSERT_EQUAL(120, clock.bpm());
+}
+
+void test_tap_tempo_sets_the_period_and_restarts_after_a_pause()
+{
+    BeatClock clock;
+    for (int k = 0; k < 5; k++)
+        clock.tap(10000 + k * 400);
+    TEST_ASSERT_TRUE(clock.locked());
+    TEST_ASSERT_EQUAL(150, clock.bpm());
+    TEST_ASSERT_EQUAL(0, phaseAt(clock, 10000 + 4 * 400));
+
+    clock.tap(20000); // a fresh start, keeps the old tempo
+    TEST_ASSERT_EQUAL(150, clock.bpm());
+    clock.tap(20750);
+    TEST_ASSERT_EQUAL(80, clock.bpm());
+}
+
+void test_tap_tempo_clamps_to_range()
+{
+    BeatClock clock;
+    clock.tap(10000);
+    clock.tap(10100);
+    TEST_ASSERT_EQUAL(60000 / BeatClock::MIN_PERIOD, clock.bpm());
+}
+
+void test_beat_index_and_phase()
+{
+    BeatClock clock;
+    clock.tap(10000);
+    clock.tap(10500);
+    uint32_t phase, period;
+    TEST_ASSERT_EQUAL(2, clock.beat(11600, &phase, &period));
+    TEST_ASSERT_EQUAL(100, phase);
+    TEST_ASSERT_EQUAL(500, period);
+    // just before the anchor the phase still runs forward
+    TEST_ASSERT_EQUAL(0, clock.beat(10400, &phase, &period));
+    TEST_ASSERT_EQUAL(400, phase);
+}
+
+void test_survives_the_millis_wrap()
+{
+    BeatClock clock;
+    uint32_t last = play(clock, UINT32_MAX - 2000, 500, 10);
+    TEST_ASSERT_TRUE(clock.locked());
+    TEST_ASSERT_EQUAL(120, clock.bpm());
+    TEST_ASSERT_LESS_OR_EQUAL(2, phaseAt(clock, last + 500));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_locks_on_a_steady_beat);
+    RUN_TEST(test_follows_a_tempo_change);
+    RUN_TEST(test_drifts_with_a_slowing_player);
+    RUN_TEST(test_holds_through_jitter);
+    RUN_TEST(test_eighth_notes_and_flams_keep_the_tempo);
+    RUN_TEST(test_tap_tempo_sets_the_period_and_restarts_after_a_pause);
+    RUN_TEST(test_tap_tempo_clamps_to_range);
+    RUN_TEST(test_beat_index_and_phase);
+    RUN_TEST(test_survives_the_millis_wrap);
+    return UNITY_END();
+}
@@ -0,0 +1,155 @@
+// Pad calibration wizard: a simulated pad (noise, then soft and hard strikes)
+// fed sample by sample as sensorTask would, the result applied to velocity,
+// and the calibration round-tripped through settings.json.
+#include <unity.h>
+#include "main.cpp"
+
+PadCalibrator cal;
+uint32_t now;
+
+// one sample a millisecond of pad `pad`
+void feedFor(uint8_t pad, uint32_t ms, uint16_t level)
+{
+    for (uint32_t end = now + ms; now != end; now++)
+        cal.feed(pad, level, now);
+}
+// a strike: a 5 ms rise to `peak`, 10 ms decay, then quiet until rearmed
+void strike(uint8_t pad, uint16_t peak, uint16_t floor)
+{
+    for (int k = 1; k <= 5; k++)
+        cal.feed(pad, peak * k / 5, now++);
+    for (int k = 9; k >= 0; k--)
+        cal.feed(pad, floor + (peak - floor) * k / 10, now++);
+    feedFor(pad, CAL_REARM_MS + 50, floor);
+}
+void runWizard(uint8_t pad, uint16_t noise, const uint16_t soft[CAL_STRIKES], const uint16_t hard[CAL_STRIKES])
+{
+    cal.start(pad);
+    for (uint32_t end = now + CAL_NOISE_MS + 10; now != end; now++)
+        cal.feed(pad, now % 7 ? noise / 2 : noise, now); // spiky noise
+    TEST_ASSERT_EQUAL(CAL_SOFT, cal.step.load());
+    for (int k = 0; k < CAL_STRIKES; k++)
+        strike(pad, soft[k], noise / 2);
+    TEST_ASSERT_EQUAL(CAL_HARD, cal.step.load());
+    for (int k = 0; k < CAL_STRIKES; k++)
+        strike(pad, hard[k], noise / 2);
+}
+
+void setUp()
+{
+    cal.cancel();
+    now = 10000;
+    for (uint8_t i = 0; i < NUM_SENSORS; i++)
+        setPadCal(i, 10, 10, 4095);
+    SPIFFS.format();
+}
+void tearDown() {}
+
+void test_wizard_measures_noise_soft_and_hard()
+{
+    const uint16_t soft[] = {420, 380, 400, 450}, hard[] = {2900, 3100, 3000, 3000};
+    runWizard(0, 60, soft, hard);
+    TEST_ASSERT_EQUAL(CAL_DONE, cal.step.load());
+    TEST_ASSERT_EQUAL(60, cal.noise.load());
+    TEST_ASSERT_EQUAL(380, cal.soft.load());
+    TEST_ASSERT_EQUAL(3000, cal.hard.load());
+    uint16_t threshold, low, high;
+    cal.result(threshold, low, high);
+    TEST_ASSERT_EQUAL((60 + 380) / 2, threshold);
+    TEST_ASSERT_EQUAL(threshold, low);
+    TEST_ASSERT_EQUAL(3000, high);
+}
+
+void test_weak_pad_keeps_a_usable_range()
+{
+    // strikes barely over the noise, and no harder when hit hard
+    const uint16_t soft[] = {85, 85, 85, 85}, hard[] = {85, 85, 85, 85};
+    runWizard(0, 60, soft, hard);
+    TEST_ASSERT_EQUAL(CAL_DONE, cal.step.load());
+    uint16_t threshold, low, high;
+    cal.result(threshold, low, high);
+    TEST_ASSERT_EQUAL((60 + 85) / 2, threshold);
+    TEST_ASSERT_GREATER_OR_EQUAL(60 + CAL_MARGIN / 2, threshold);
+    TEST_ASSERT_EQUAL(low + 16, high); // the narrowest velocity range
+}
+
+void test_apply_sets_detection_and_velocity()
+{
+    const uint16_t soft[] = {400, 400, 400, 400}, hard[] = {3000, 3000, 3000, 3000};
+    runWizard(0, 40, soft, hard);
+    cal.apply();
+    TEST_ASSERT_EQUAL(CAL_IDLE, cal.step.load());
+    TEST_ASSERT_EQUAL(220, padCal[0].threshold.load());
+    TEST_ASSERT_EQUAL(1, hitVelocity(0, 220));
+    TEST_ASSERT_EQUAL(127, hitVelocity(0, 3000));
+    TEST_ASSERT_EQUAL(127, hitVelocity(0, 4095));
+    TEST_ASSERT_UINT_WITHIN(1, 64, hitVelocity(0, (220 + 3000) / 2));
+}
+
+void test_strikes_inside_the_rearm_time_count_once()
+{
+    cal.start(0);
+    feedFor(0, CAL_NOISE_MS + 10, 20);
+    for (int k = 0; k < 3; k++)
+    {
+        // a double bounce: two peaks 40 ms apart
+        cal.feed(0, 500, now++);
+        feedFor(0, CAL_PEAK_MS + 5, 20);
+        cal.feed(0, 480, now++);
+        feedFor(0, CAL_REARM_MS + 50, 20);
+    }
+    TEST_ASSERT_EQUAL(CAL_SOFT, cal.step.load());
+    TEST_ASSERT_EQUAL(3, cal.strikes.load());
+}
+
+void test_start_takes_effect_on_the_pads_next_sample()
+{
+    const uint16_t soft[] = {400, 400, 400, 400}, hard[] = {3000, 3000, 3000, 3000};
+    runWizard(0, 40, soft, hard);
+    cal.start(1);
+    TEST_ASSERT_EQUAL(CAL_IDLE, cal.step.load());
+    TEST_ASSERT_EQUAL(3000, cal.hard.load()); // untouched until pad 1 samples
+    cal.feed(0, 4000, now++);                 // other pads are ignored
+    TEST_ASSERT_EQUAL(CAL_IDLE, cal.step.load());
+    cal.feed(1, 30, now++);
+    TEST_ASSERT_EQUAL(CAL_NOISE, cal.step.load());
+    TEST_ASSERT_EQUAL(0, cal.hard.load());
+    TEST_ASSERT_EQUAL(30, cal.noise.load());
+}
+
+void test_cancel_drops_a_pending_start()
+{
+    cal.start(0);
+    cal.cancel();
+    feedFor(0, 10, 30);
+    TEST_ASSERT_EQUAL(CAL_IDLE, cal.step.load());
+}
+
+void test_calibration_round_trips_through_settings()
+{
+    for (uint8_t i = 0; i < NUM_SENSORS; i++)
+        setPadCal(i, 100 + i, 100 + i, 2000 + i);
+    savePadCalibration();
+    for (uint8_t i = 0; i < NUM_SENSORS; i++)
+        setPadCal(i, 10, 10, 4095);
+    loadSettings();
+    for (uint8_t i = 0; i < NUM_SENSORS; i++)
+    {
+        TEST_ASSERT_EQUAL(100 + i, padCal[i].threshold.load());
+        TEST_ASSERT_EQUAL(2000 + i, padCal[i].high.load());
+    }
+}
+
+int main()
+{
+    storageMutex = xSemaphoreCreateMutex();
+    UNITY_BEGIN();
+    RUN_TEST(test_wizard_measures_noise_soft_and_hard);
+    RUN_TEST(test_weak_pad_keeps_a_usable_range);
+    RUN_TEST(test_apply_sets_detection_and_velocity);
+    RUN_TEST(test_strikes_inside_the_rearm_time_count_once);
+    RUN_TEST(test_start_takes_effect_on_the_pads_next_sample);
+    RUN_TEST(test_cancel_drops_a_pending_start);
+    RUN_TEST(test_calibration_round_trips_through_settings);
+    return UNITY_END();
+}
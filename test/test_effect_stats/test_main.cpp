@@ -0,0 +1,159 @@
+// Per-effect frame cost: the histogram buckets, the beginFrame/show
+// instrumentation and the output task batching segments into one show(),
+// then a host benchmark that runs every effect through runEffect on the real
+// clock and prints the same report as the device.
+#include <unity.h>
+#include "main.cpp"
+
+#define BENCH_MS 3000 // effect time per effect
+
+LedSegment segment;
+
+uint32_t total(const uint32_t *hist)
+{
+    uint32_t n = 0;
+    for (uint8_t b = 0; b < FX_HIST_BUCKETS; b++)
+        n += hist[b];
+    return n;
+}
+
+void setUp()
+{
+    memset(effectStats, 0, sizeof(effectStats));
+    shim::realClock = false;
+    shim::nowUs = 1000000;
+}
+void tearDown() { shim::realClock = false; }
+
+void test_bucket_edges()
+{
+    TEST_ASSERT_EQUAL(0, histBucket(0));
+    TEST_ASSERT_EQUAL(0, histBucket(63));
+    for (uint8_t b = 1; b < FX_HIST_BUCKETS - 1; b++)
+    {
+        TEST_ASSERT_EQUAL(b, histBucket(32u << b));
+        TEST_ASSERT_EQUAL(b, histBucket((64u << b) - 1));
+    }
+    TEST_ASSERT_EQUAL(FX_HIST_BUCKETS - 1, histBucket(32u << (FX_HIST_BUCKETS - 1)));
+    TEST_ASSERT_EQUAL(FX_HIST_BUCKETS - 1, histBucket(UINT32_MAX));
+}
+
+void test_record_counts_and_keeps_the_worst()
+{
+    recordEffectFrame(FX_HIT_FADE, 100, 700, 0);
+    recordEffectFrame(FX_HIT_FADE, 3000, 650, 20000);
+    recordEffectFrame(FX_COUNT, 100, 100, 100); // ignored
+    recordEffectFrame(FX_NONE, 100, 100, 100);
+    const EffectStats &e = effectStats[FX_HIT_FADE];
+    TEST_ASSERT_EQUAL(2, e.frames);
+    TEST_ASSERT_EQUAL(3000, e.computeMaxUs);
+    TEST_ASSERT_EQUAL(700, e.showMaxUs);
+    TEST_ASSERT_EQUAL(1, e.compute[histBucket(100)]);
+    TEST_ASSERT_EQUAL(1, e.compute[histBucket(3000)]);
+    TEST_ASSERT_EQUAL(2, e.show[histBucket(650)]);
+    TEST_ASSERT_EQUAL(1, total(e.interval)); // the first frame has no interval
+}
+
+void test_segment_times_compute_and_interval()
+{
+    static uint8_t pixels[PAD_LEDS * 3];
+    LedSegment strip;
+    strip.attachBuffer(pixels, PAD_LEDS);
+    strip.beginFrame(FX_BASE_SOLID);
+    shim::nowUs += 150;
+    strip.show();
+    shim::nowUs += 20000 - 150;
+    strip.beginFrame(FX_BASE_SOLID);
+    shim::nowUs += 40;
+    strip.show();
+    const EffectStats &e = effectStats[FX_BASE_SOLID];
+    TEST_ASSERT_EQUAL(2, e.frames);
+    TEST_ASSERT_EQUAL(150, e.computeMaxUs);
+    TEST_ASSERT_EQUAL(1, e.interval[histBucket(20000)]);
+    // switching effect restarts the interval
+    shim::nowUs += 20000; // show() waits out the WS2812 reset gap
+    strip.beginFrame(FX_BASE_RAINBOW);
+    strip.show();
+    TEST_ASSERT_EQUAL(0, total(effectStats[FX_BASE_RAINBOW].interval));
+}
+
+// every pad that drew since the last frame goes out in one show(); a frame
+// replaced before it was sent is not counted, its hit still is
+void test_one_show_per_frame()
+{
+    static LedSegment other; // a second pad with no LEDs, the default kit has one
+    if (other.slot == 0xFF)
+        other.attach(0, PAD_LEDS, 0);
+    shim::nowUs += 20000;
+    ledOutput.show(); // nothing pending
+    memset(effectStats, 0, sizeof(effectStats));
+    hitLatencyLastUs.store(0);
+    uint32_t writes = shim::rmtWrites;
+
+    segment.hitTime = micros();
+    segment.beginFrame(FX_HIT_FADE);
+    segment.show();
+    segment.beginFrame(FX_HIT_FADE);
+    segment.show(); // replaces the first
+    other.beginFrame(FX_BASE_SOLID);
+    other.show();
+    shim::nowUs += 500;
+    ledOutput.show();
+    TEST_ASSERT_EQUAL(writes + LED_CHANNELS, shim::rmtWrites);
+    TEST_ASSERT_EQUAL(1, effectStats[FX_HIT_FADE].frames);
+    TEST_ASSERT_EQUAL(1, effectStats[FX_BASE_SOLID].frames);
+    TEST_ASSERT_EQUAL(500, effectStats[FX_BASE_SOLID].showMaxUs);
+    TEST_ASSERT_EQUAL(500, hitLatencyLastUs.load()); // from the first frame's hit
+
+    // a frame with nothing new records nothing
+    shim::nowUs += 20000;
+    ledOutput.show();
+    TEST_ASSERT_EQUAL(1, effectStats[FX_HIT_FADE].frames);
+    TEST_ASSERT_EQUAL(500, hitLatencyLastUs.load());
+}
+
+void test_bench_every_effect()
+{
+    static Palette wheel;
+    shim::realClock = true;
+    for (uint8_t id = 0; id < FX_COUNT; id++)
+    {
+        EffectState s = {};
+        s.p = {200, 40, 10, 180, 4, 3, 100, false, false, false, &wheel, wheel.latest(), NULL, false};
+        s.seed = 0x5EED;
+        s.fixed = &goldenInputs();
+        beginEffect(s, id, segment, 0);
+        for (uint32_t t = 0; t < BENCH_MS;)
+        {
+            uint32_t next = runEffect(s, segment, t);
+            ledOutput.show(); // the output task's frame
+            if (next == EFFECT_DONE)
+            {
+                beginEffect(s, id, segment, t + 1); // hit effects: hit again
+                next = t + 1;
+            }
+            t = max(next, t + 1);
+        }
+        const EffectStats &e = effectStats[id];
+        TEST_ASSERT_GREATER_THAN_MESSAGE(0, e.frames, effectNames[id]);
+        TEST_ASSERT_EQUAL(e.frames, total(e.compute));
+        TEST_ASSERT_EQUAL(e.frames, total(e.show));
+    }
+    shim::realClock = false;
+    Serial.echo = true;
+    printEffectStats();
+    Serial.echo = false;
+}
+
+int main()
+{
+    ledOutput.begin();
+    segment.attach(0, 0, PAD_LEDS);
+    UNITY_BEGIN();
+    RUN_TEST(test_bucket_edges);
+    RUN_TEST(test_record_counts_and_keeps_the_worst);
+    RUN_TEST(test_segment_times_compute_and_interval);
+    RUN_TEST(test_one_show_per_frame);
+    RUN_TEST(test_bench_every_effect);
+    return UNITY_END();
+}
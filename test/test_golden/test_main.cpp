@@ -0,0 +1,89 @@
+// Golden frames on the host: every effect rendered by goldenRun must hash to
+// its chain in data/golden.json. After an intended change to an effect, run
+// once with GOLDEN_RECORD set in the environment to rewrite the file.
+#include <unity.h>
+#include "main.cpp"
+
+// data/golden.json, relative to this file so the test runs from any directory
+std::string projectPath(const char *path)
+{
+    std::string here = __FILE__;
+    return here.substr(0, here.rfind("test/")) + path;
+}
+
+void setUp() { SPIFFS.format(); }
+void tearDown() {}
+
+void test_golden_programs_verify()
+{
+    const FixedInputs &in = goldenInputs();
+    TEST_ASSERT_TRUE(vmVerify(*in.programs[VM_BASE]));
+    TEST_ASSERT_TRUE(vmVerify(*in.programs[VM_HIT]));
+}
+
+void test_every_effect_draws()
+{
+    for (uint8_t id = 0; id < FX_COUNT; id++)
+        TEST_ASSERT_GREATER_THAN_MESSAGE(0, goldenRun(id).frames, effectNames[id]);
+}
+
+void test_golden_run_is_repeatable()
+{
+    for (uint8_t id = 0; id < FX_COUNT; id++)
+        TEST_ASSERT_EQUAL_HEX32(goldenRun(id).hash, goldenRun(id).hash);
+}
+
+void test_effects_match_golden_file()
+{
+    std::string path = projectPath("data/golden.json");
+    if (getenv("GOLDEN_RECORD"))
+    {
+        TEST_ASSERT_EQUAL(0, effectSelfTest(true));
+        FILE *out = fopen(path.c_str(), "w");
+        TEST_ASSERT_NOT_NULL(out);
+        std::string json = SPIFFS.contents(GOLDEN_FILE);
+        fwrite(json.data(), 1, json.size(), out);
+        fclose(out);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(SPIFFS.load(GOLDEN_FILE, path.c_str()), "data/golden.json missing");
+    TEST_ASSERT_EQUAL(0, effectSelfTest(false));
+}
+
+// CMD_SELFTEST comes back from a worker task, not from serialTask
+void test_selftest_command_runs_on_a_worker()
+{
+    TEST_ASSERT_TRUE(SPIFFS.load(GOLDEN_FILE, projectPath("data/golden.json").c_str()));
+    uint8_t frame[8] = {CMD_SELFTEST, 0}, wire[16];
+    uint16_t crc = crc16(frame, 2);
+    frame[2] = crc & 0xFF;
+    frame[3] = crc >> 8;
+    size_t tasks = shim::tasks.size();
+    Serial.tx.clear();
+    handleFrame(wire, cobsEncode(frame, 4, wire));
+    TEST_ASSERT_EQUAL(0, Serial.tx.size());
+    TEST_ASSERT_EQUAL(tasks + 1, shim::tasks.size());
+    TEST_ASSERT_TRUE(shim::tasks.back().fn == selfTestTask);
+    TEST_ASSERT_EQUAL(STORAGE_TASK_PRIORITY, shim::tasks.back().priority);
+
+    shim::tasks.back().fn(NULL);
+    // the reply frame follows the printed summary
+    std::string tx = Serial.tx.substr(Serial.tx.find('\0'));
+    uint8_t reply[16];
+    memcpy(reply, tx.data() + 1, tx.size() - 2);
+    TEST_ASSERT_EQUAL(5, cobsDecode(reply, tx.size() - 2));
+    TEST_ASSERT_EQUAL_HEX8(CMD_SELFTEST | 0x80, reply[0]);
+    TEST_ASSERT_EQUAL(PROTO_OK, reply[1]);
+    TEST_ASSERT_EQUAL(0, reply[2]);
+    TEST_ASSERT_EQUAL(0, protoJob.load());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_golden_programs_verify);
+    RUN_TEST(test_every_effect_draws);
+    RUN_TEST(test_golden_run_is_repeatable);
+    RUN_TEST(test_effects_match_golden_file);
+    RUN_TEST(test_selftest_command_runs_on_a_worker);
+    return UNITY_END();
+}
@@ -0,0 +1,272 @@
+// JSON arena and flash file I/O: JsonPool's block discipline, the refusals in
+// readJsonFile, and a storage benchmark over the shipped settings.json.
+#include <unity.h>
+#include "main.cpp"
+
+#define BENCH_RUNS 200
+
+std::string projectPath(const char *path)
+{
+    std::string here = __FILE__;
+    return here.substr(0, here.rfind("test/")) + path;
+}
+void loadData(const char *path, const char *file)
+{
+    TEST_ASSERT_TRUE_MESSAGE(SPIFFS.load(path, projectPath(file).c_str()), file);
+}
+void putText(const char *path, const std::string &text) { SPIFFS.put(path, text.data(), text.size()); }
+
+void setUp()
+{
+    SPIFFS.format();
+    shim::realClock = false;
+}
+void tearDown() { shim::realClock = false; }
+
+void test_blocks_stack_and_rewind()
+{
+    static JsonPool pool;
+    uint8_t *a = (uint8_t *)pool.allocate(10), *b = (uint8_t *)pool.allocate(3);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)a % 8);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)b % 8);
+    TEST_ASSERT_EQUAL(24, b - a); // header + 10 rounded to 16
+    pool.deallocate(b);
+    TEST_ASSERT_TRUE(pool.allocate(3) == b); // the top block is given back
+    void *c = pool.allocate(100);
+    pool.deallocate(b); // not on top: stays carved until everything is freed
+    TEST_ASSERT_TRUE((uint8_t *)pool.allocate(1) > (uint8_t *)c);
+    pool.deallocate(NULL);
+    pool.deallocate(a);
+    pool.deallocate(c);
+    TEST_ASSERT_EQUAL(0, pool.failures());
+    void *last = NULL;
+    for (uint8_t *p; (p = (uint8_t *)pool.allocate(1)) != NULL;)
+        last = p;
+    TEST_ASSERT_EQUAL(1, pool.failures());
+    // full to within one 16-byte block
+    TEST_ASSERT_GREATER_THAN(JSON_POOL_SIZE - 16, pool.peakBytes());
+    TEST_ASSERT_LESS_OR_EQUAL(JSON_POOL_SIZE, pool.peakBytes());
+    TEST_ASSERT_NOT_NULL(last);
+}
+
+void test_a_freed_arena_starts_over()
+{
+    static JsonPool pool;
+    uint8_t *first = (uint8_t *)pool.allocate(8);
+    pool.allocate(64);
+    pool.allocate(64);
+    pool.deallocate(first); // out of order
+    TEST_ASSERT_NULL(pool.allocate(JSON_POOL_SIZE));
+    void *second = pool.allocate(1);
+    TEST_ASSERT_NOT_NULL(second);
+}
+
+void test_reallocate_grows_the_top_in_place_and_moves_the_rest()
+{
+    static JsonPool pool;
+    uint8_t *a = (uint8_t *)pool.allocate(16);
+    memset(a, 0xAB, 16);
+    TEST_ASSERT_TRUE(pool.reallocate(a, 200) == a);
+    TEST_ASSERT_TRUE(pool.reallocate(a, 40) == a);
+    uint8_t *b = (uint8_t *)pool.allocate(8);
+    TEST_ASSERT_EQUAL(48, b - a);
+    uint8_t *moved = (uint8_t *)pool.reallocate(a, 400);
+    TEST_ASSERT_TRUE(moved > b);
+    TEST_ASSERT_EQUAL(0xAB, moved[15]);
+    TEST_ASSERT_TRUE(pool.reallocate(b, 4) == b); // shrinking never moves
+    TEST_ASSERT_NULL(pool.reallocate(b, JSON_POOL_SIZE));
+    TEST_ASSERT_NOT_NULL(pool.reallocate(NULL, 8));
+}
+
+void test_settings_parse_in_the_pool_and_give_it_all_back()
+{
+    static JsonPool pool;
+    loadData(JSON_FILE, "data/settings.json");
+    void *mark = pool.allocate(8);
+    pool.deallocate(mark);
+    {
+        JsonDocument doc(&pool);
+        TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc));
+        TEST_ASSERT_EQUAL(3, doc["base"].size());
+        TEST_ASSERT_EQUAL(3, doc["hit"].size());
+    }
+    TEST_ASSERT_TRUE(pool.allocate(8) == mark);
+    TEST_ASSERT_EQUAL(0, pool.failures());
+    TEST_ASSERT_LESS_THAN(JSON_POOL_SIZE / 2, pool.peakBytes());
+}
+
+void test_a_filter_keeps_the_peak_down()
+{
+    static JsonPool whole, filtered;
+    loadData(JSON_FILE, "data/settings.json");
+    {
+        JsonDocument doc(&whole);
+        TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc));
+    }
+    {
+        JsonDocument doc(&filtered), filter(&filtered);
+        filter["hit"][0] = true;
+        TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc, &filter));
+        TEST_ASSERT_TRUE(doc["base"].isNull());
+        TEST_ASSERT_EQUAL(3, doc["hit"].size());
+    }
+    TEST_ASSERT_LESS_THAN(whole.peakBytes(), filtered.peakBytes());
+}
+
+void test_bad_files_are_refused()
+{
+    JsonDocument doc(&jsonPool);
+    TEST_ASSERT_TRUE(readJsonFile("/missing.json", doc));
+    TEST_ASSERT_TRUE(doc.isNull());
+
+    putText("/big.json", "[" + std::string(JSON_MAX_FILE, ' ') + "]");
+    TEST_ASSERT_FALSE(readJsonFile("/big.json", doc));
+
+    putText("/deep.json", std::string(JSON_MAX_NESTING + 1, '[') + std::string(JSON_MAX_NESTING + 1, ']'));
+    TEST_ASSERT_FALSE(readJsonFile("/deep.json", doc));
+    putText("/deep.json", std::string(JSON_MAX_NESTING, '[') + std::string(JSON_MAX_NESTING, ']'));
+    TEST_ASSERT_TRUE(readJsonFile("/deep.json", doc));
+
+    putText("/cut.json", "{\"base\": [{\"red\": 25");
+    TEST_ASSERT_FALSE(readJsonFile("/cut.json", doc));
+    TEST_ASSERT_TRUE(doc.isNull());
+}
+
+void test_running_out_of_arena_fails_the_parse_cleanly()
+{
+    static JsonPool pool;
+    std::string many = "[";
+    for (int k = 0; k < 4000; k++)
+        many += "1,";
+    many += "1]";
+    putText("/many.json", many);
+    void *mark = pool.allocate(8);
+    pool.deallocate(mark);
+    {
+        JsonDocument doc(&pool);
+        TEST_ASSERT_FALSE(readJsonFile("/many.json", doc));
+    }
+    TEST_ASSERT_GREATER_THAN(0, pool.failures());
+    TEST_ASSERT_TRUE(pool.allocate(8) == mark);
+}
+
+void test_write_replaces_the_file_whole()
+{
+    JsonDocument doc(&jsonPool);
+    doc["crossfade_ms"] = 750;
+    TEST_ASSERT_TRUE(writeJsonFile(JSON_FILE, doc));
+    TEST_ASSERT_FALSE(SPIFFS.exists(JSON_FILE ".tmp"));
+    doc.clear();
+    TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc));
+    TEST_ASSERT_EQUAL(750, doc["crossfade_ms"].as<int>());
+}
+
+// power lost between the remove and the rename of writeJsonFile leaves only
+// the copy: the next read gets it and puts it in place
+void test_an_interrupted_swap_is_recovered_on_read()
+{
+    putText(JSON_FILE ".tmp", "{\"crossfade_ms\": 640}");
+    JsonDocument doc(&jsonPool);
+    TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc));
+    TEST_ASSERT_EQUAL(640, doc["crossfade_ms"].as<int>());
+    TEST_ASSERT_TRUE(SPIFFS.exists(JSON_FILE));
+    TEST_ASSERT_FALSE(SPIFFS.exists(JSON_FILE ".tmp"));
+    TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc));
+    TEST_ASSERT_EQUAL(640, doc["crossfade_ms"].as<int>());
+
+    // a first save cut short mid-write: nothing to recover
+    SPIFFS.format();
+    putText(JSON_FILE ".tmp", "{\"crossfade_ms\": 6");
+    TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc));
+    TEST_ASSERT_TRUE(doc.isNull());
+    TEST_ASSERT_FALSE(SPIFFS.exists(JSON_FILE));
+    TEST_ASSERT_FALSE(SPIFFS.exists(JSON_FILE ".tmp"));
+}
+
+// a song keeps its presets for as long as it plays, in an arena of its own
+// that a reload reuses, so jsonPool still rewinds between I/O calls
+void test_song_presets_stay_out_of_the_pool()
+{
+    loadData(JSON_FILE, "data/settings.json");
+    loadData("/shows/example.json", "data/shows/example.json");
+    loadSettings();
+    void *mark = jsonPool.allocate(8);
+    jsonPool.deallocate(mark);
+    showSequencer.request(0);
+    showSequencer.service(millis());
+    TEST_ASSERT_EQUAL(0, showSong.load());
+    TEST_ASSERT_TRUE(jsonPool.allocate(8) == mark);
+    jsonPool.deallocate(mark);
+    size_t peak = showPresetPool.peakBytes();
+    TEST_ASSERT_GREATER_THAN(0, peak);
+    TEST_ASSERT_EQUAL(0, showPresetPool.failures());
+    showSequencer.request(0);
+    showSequencer.service(millis());
+    TEST_ASSERT_EQUAL(0, showSong.load());
+    TEST_ASSERT_EQUAL(peak, showPresetPool.peakBytes());
+    char line[80];
+    snprintf(line, sizeof(line), "song presets %u of %u bytes", (unsigned)peak, SHOW_PRESET_POOL);
+    TEST_MESSAGE(line);
+    showSequencer.request(-1);
+    showSequencer.service(millis());
+}
+
+// host timings, for comparing changes to the storage path rather than as
+// device numbers
+void test_bench_storage()
+{
+    loadData(JSON_FILE, "data/settings.json");
+    loadData("/fx/plasma.fxb", "data/fx/plasma.fxb");
+    loadData("/fx/ripple.fxb", "data/fx/ripple.fxb");
+    shim::realClock = true;
+    const char *names[] = {"parse settings.json", "load preset", "save preset"};
+    for (uint8_t kind = 0; kind < 3; kind++)
+    {
+        uint32_t total = 0, worst = 0;
+        for (int run = 0; run < BENCH_RUNS; run++)
+        {
+            uint32_t start = micros();
+            if (kind == 0)
+            {
+                JsonDocument doc(&jsonPool);
+                TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc));
+            }
+            else if (kind == 1)
+                loadPresetToJson(run % 6);
+            else
+                savePresetToJson(run % 6);
+            uint32_t took = micros() - start;
+            total += took;
+            worst = max(worst, took);
+        }
+        char line[80];
+        snprintf(line, sizeof(line), "%s: mean %u us, max %u us", names[kind], (unsigned)(total / BENCH_RUNS),
+                 (unsigned)worst);
+        TEST_MESSAGE(line);
+    }
+    shim::realClock = false;
+    char line[80];
+    snprintf(line, sizeof(line), "pool peak %u of %u bytes", (unsigned)jsonPool.peakBytes(), JSON_POOL_SIZE);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_EQUAL(0, jsonPool.failures());
+    JsonDocument doc(&jsonPool);
+    TEST_ASSERT_TRUE(readJsonFile(JSON_FILE, doc)); // still a good file after 200 saves
+}
+
+int main()
+{
+    storageMutex = xSemaphoreCreateMutex();
+    UNITY_BEGIN();
+    RUN_TEST(test_blocks_stack_and_rewind);
+    RUN_TEST(test_a_freed_arena_starts_over);
+    RUN_TEST(test_reallocate_grows_the_top_in_place_and_moves_the_rest);
+    RUN_TEST(test_settings_parse_in_the_pool_and_give_it_all_back);
+    RUN_TEST(test_a_filter_keeps_the_peak_down);
+    RUN_TEST(test_bad_files_are_refused);
+    RUN_TEST(test_running_out_of_arena_fails_the_parse_cleanly);
+    RUN_TEST(test_write_replaces_the_file_whole);
+    RUN_TEST(test_an_interrupted_swap_is_recovered_on_read);
+    RUN_TEST(test_song_presets_stay_out_of_the_pool);
+    RUN_TEST(test_bench_storage);
+    return UNITY_END();
+}
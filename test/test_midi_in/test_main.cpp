@@ -0,0 +1,149 @@
+// MIDI in: the byte-at-a-time parser, and midiReceive turning a UART byte
+// stream into pad hits.
+#include <unity.h>
+#include "main.cpp"
+
+void feedSerial2(std::initializer_list<uint8_t> bytes)
+{
+    Serial2.feed(bytes.begin(), bytes.size());
+}
+bool nextHit(HitEvent &event) { return xQueueReceive(hitQueues[0], &event, 0) == pdTRUE; }
+
+void setUp()
+{
+    midiIn = MidiParser();
+    midiChannel = 9;
+    buildNoteMap();
+    Serial2.rx.clear();
+    Serial2.tx.clear();
+    if (hitQueues[0] == NULL)
+        hitQueues[0] = xQueueCreate(1, sizeof(HitEvent));
+    xQueueReset(hitQueues[0]);
+}
+void tearDown() {}
+
+void test_note_on_completes_on_its_last_byte()
+{
+    TEST_ASSERT_FALSE(midiIn.feed(0x99));
+    TEST_ASSERT_FALSE(midiIn.feed(38));
+    TEST_ASSERT_TRUE(midiIn.feed(100));
+    TEST_ASSERT_EQUAL_HEX8(0x99, midiIn.status);
+    TEST_ASSERT_EQUAL(38, midiIn.data[0]);
+    TEST_ASSERT_EQUAL(100, midiIn.data[1]);
+}
+
+void test_running_status_carries_over()
+{
+    const uint8_t stream[] = {0x99, 38, 100, 42, 90, 36, 0};
+    int messages = 0;
+    for (uint8_t b : stream)
+        messages += midiIn.feed(b);
+    TEST_ASSERT_EQUAL(3, messages);
+    TEST_ASSERT_EQUAL_HEX8(0x99, midiIn.status);
+    TEST_ASSERT_EQUAL(36, midiIn.data[0]);
+    TEST_ASSERT_EQUAL(0, midiIn.data[1]);
+}
+
+void test_realtime_bytes_do_not_break_a_message()
+{
+    const uint8_t stream[] = {0x99, 0xF8, 38, 0xFE, 0xFA, 100};
+    int messages = 0;
+    for (uint8_t b : stream)
+        messages += midiIn.feed(b);
+    TEST_ASSERT_EQUAL(1, messages);
+    TEST_ASSERT_EQUAL(38, midiIn.data[0]);
+    TEST_ASSERT_EQUAL(100, midiIn.data[1]);
+}
+
+void test_system_messages_cancel_running_status()
+{
+    const uint8_t stream[] = {0x99, 38, 100, 0xF0, 0x7E, 0x01, 0xF7, 38, 100};
+    int messages = 0;
+    for (uint8_t b : stream)
+        messages += midiIn.feed(b);
+    TEST_ASSERT_EQUAL(1, messages);
+    TEST_ASSERT_EQUAL(0, midiIn.status);
+}
+
+void test_data_before_any_status_is_ignored()
+{
+    TEST_ASSERT_FALSE(midiIn.feed(38));
+    TEST_ASSERT_FALSE(midiIn.feed(100));
+    TEST_ASSERT_FALSE(midiIn.feed(0x99));
+    TEST_ASSERT_FALSE(midiIn.feed(38));
+    TEST_ASSERT_TRUE(midiIn.feed(100));
+}
+
+void test_program_change_takes_one_data_byte()
+{
+    TEST_ASSERT_FALSE(midiIn.feed(0xC9));
+    TEST_ASSERT_TRUE(midiIn.feed(5));
+    TEST_ASSERT_TRUE(midiIn.feed(6)); // running status
+    TEST_ASSERT_FALSE(midiIn.feed(0xD9));
+    TEST_ASSERT_TRUE(midiIn.feed(64));
+}
+
+void test_a_status_byte_restarts_a_partial_message()
+{
+    TEST_ASSERT_FALSE(midiIn.feed(0x99));
+    TEST_ASSERT_FALSE(midiIn.feed(38));
+    TEST_ASSERT_FALSE(midiIn.feed(0x89));
+    TEST_ASSERT_FALSE(midiIn.feed(42));
+    TEST_ASSERT_TRUE(midiIn.feed(0));
+    TEST_ASSERT_EQUAL_HEX8(0x89, midiIn.status);
+    TEST_ASSERT_EQUAL(42, midiIn.data[0]);
+}
+
+void test_receive_turns_a_note_into_a_pad_hit()
+{
+    feedSerial2({0x99, 38, 100});
+    midiReceive(1000);
+    HitEvent event;
+    TEST_ASSERT_TRUE(nextHit(event));
+    TEST_ASSERT_EQUAL(0, event.pad);
+    TEST_ASSERT_EQUAL(100, event.velocity);
+    TEST_ASSERT_EQUAL(map(100, 1, 127, 10, 4095), event.level);
+    TEST_ASSERT_EQUAL(0, Serial2.available());
+    // a MIDI-in hit is not echoed back out
+    TEST_ASSERT_EQUAL(0, Serial2.tx.size());
+}
+
+void test_receive_skips_what_is_not_a_pad_note_on()
+{
+    feedSerial2({0x99, 38, 0});    // note off as velocity 0
+    feedSerial2({0x98, 38, 100});  // another channel
+    feedSerial2({0x89, 38, 100});  // note off
+    feedSerial2({0x99, 60, 100});  // no pad plays note 60
+    feedSerial2({0xB9, 38, 100});  // controller
+    midiReceive(1000);
+    HitEvent event;
+    TEST_ASSERT_FALSE(nextHit(event));
+}
+
+void test_receive_keeps_running_status_across_polls()
+{
+    feedSerial2({0x99, 38});
+    midiReceive(1000);
+    HitEvent event;
+    TEST_ASSERT_FALSE(nextHit(event));
+    feedSerial2({90, 0xF8, 38, 50});
+    midiReceive(1001);
+    TEST_ASSERT_TRUE(nextHit(event)); // the queue keeps only the latest hit
+    TEST_ASSERT_EQUAL(50, event.velocity);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_note_on_completes_on_its_last_byte);
+    RUN_TEST(test_running_status_carries_over);
+    RUN_TEST(test_realtime_bytes_do_not_break_a_message);
+    RUN_TEST(test_system_messages_cancel_running_status);
+    RUN_TEST(test_data_before_any_status_is_ignored);
+    RUN_TEST(test_program_change_takes_one_data_byte);
+    RUN_TEST(test_a_status_byte_restarts_a_partial_message);
+    RUN_TEST(test_receive_turns_a_note_into_a_pad_hit);
+    RUN_TEST(test_receive_skips_what_is_not_a_pad_note_on);
+    RUN_TEST(test_receive_keeps_running_status_across_polls);
+    return UNITY_END();
+}
@@ -0,0 +1,96 @@
+// MIDI out: Note On per hit with one running status byte, Note Off after the
+// gate, and drops instead of blocking when the UART TX ring is full.
+#include <unity.h>
+#include "main.cpp"
+
+std::string bytes(std::initializer_list<uint8_t> b) { return std::string(b.begin(), b.end()); }
+
+void setUp()
+{
+    midiChannel = 9;
+    midiRunningStatus = 0;
+    midiDropped.store(0);
+    memset(midiNoteOffAt, 0, sizeof(midiNoteOffAt));
+    Serial2.tx.clear();
+    Serial2.txRoom = 128;
+}
+void tearDown() {}
+
+void test_first_hit_sends_status_then_running_status()
+{
+    midiHit(0, 100, 1000);
+    midiHit(2, 64, 1001);
+    TEST_ASSERT_TRUE(Serial2.tx == bytes({0x99, 38, 100, 48, 64}));
+}
+
+void test_note_off_follows_after_the_gate()
+{
+    midiHit(0, 100, 1000);
+    Serial2.tx.clear();
+    midiService(1000 + MIDI_GATE_MS - 1);
+    TEST_ASSERT_EQUAL(0, Serial2.tx.size());
+    midiService(1000 + MIDI_GATE_MS);
+    TEST_ASSERT_TRUE(Serial2.tx == bytes({38, 0}));
+    midiService(1000 + MIDI_GATE_MS + 100);
+    TEST_ASSERT_EQUAL(2, Serial2.tx.size()); // only once
+}
+
+void test_retrigger_closes_the_open_note_first()
+{
+    midiHit(0, 100, 1000);
+    midiHit(0, 80, 1010);
+    TEST_ASSERT_TRUE(Serial2.tx == bytes({0x99, 38, 100, 38, 0, 38, 80}));
+    Serial2.tx.clear();
+    midiService(1010 + MIDI_GATE_MS - 1);
+    TEST_ASSERT_EQUAL(0, Serial2.tx.size()); // the gate restarted
+}
+
+void test_gate_survives_clock_wrap()
+{
+    midiHit(0, 100, UINT32_MAX - 10);
+    Serial2.tx.clear();
+    midiService(UINT32_MAX);
+    TEST_ASSERT_EQUAL(0, Serial2.tx.size());
+    midiService(MIDI_GATE_MS - 11);
+    TEST_ASSERT_TRUE(Serial2.tx == bytes({38, 0}));
+}
+
+void test_full_tx_ring_drops_and_resends_status()
+{
+    midiHit(0, 100, 1000);
+    Serial2.txRoom = 2;
+    midiHit(2, 64, 1001); // 2 bytes with running status, fits
+    TEST_ASSERT_EQUAL(0, midiDropped.load());
+    Serial2.txRoom = 1;
+    midiHit(3, 50, 1002);
+    TEST_ASSERT_EQUAL(1, midiDropped.load());
+    Serial2.txRoom = 128;
+    Serial2.tx.clear();
+    midiHit(4, 40, 1003);
+    TEST_ASSERT_TRUE(Serial2.tx == bytes({0x99, 43, 40}));
+}
+
+void test_piezo_hit_leaves_before_the_renderer_runs()
+{
+    dispatchHit(0, 2000, 90, 1000, HIT_PIEZO);
+    TEST_ASSERT_TRUE(Serial2.tx == bytes({0x99, 38, 90}));
+}
+
+void test_midi_in_hit_is_not_sent_back_out()
+{
+    dispatchHit(0, 2000, 90, 1000, HIT_MIDI);
+    TEST_ASSERT_EQUAL(0, Serial2.tx.size());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_first_hit_sends_status_then_running_status);
+    RUN_TEST(test_note_off_follows_after_the_gate);
+    RUN_TEST(test_retrigger_closes_the_open_note_first);
+    RUN_TEST(test_gate_survives_clock_wrap);
+    RUN_TEST(test_full_tx_ring_drops_and_resends_status);
+    RUN_TEST(test_piezo_hit_leaves_before_the_renderer_runs);
+    RUN_TEST(test_midi_in_hit_is_not_sent_back_out);
+    return UNITY_END();
+}
@@ -0,0 +1,213 @@
+// Binary control protocol: CRC-16/CCITT-FALSE, COBS framing and a few
+// commands round-tripped through handleFrame, including the flash commands
+// presetTask answers later.
+#include <unity.h>
+#include "main.cpp"
+
+// encodes [command][payload][crc] the way a host would, without delimiters
+size_t buildFrame(uint8_t *wire, uint8_t command, const uint8_t *payload, size_t len)
+{
+    uint8_t frame[PROTO_MAX_FRAME];
+    frame[0] = command;
+    if (len)
+        memcpy(frame + 1, payload, len);
+    uint16_t crc = crc16(frame, len + 1);
+    frame[len + 1] = crc & 0xFF;
+    frame[len + 2] = crc >> 8;
+    return cobsEncode(frame, len + 3, wire);
+}
+// the one reply in Serial.tx, decoded and CRC checked; its length, 0 if none
+size_t takeReply(uint8_t *reply)
+{
+    std::string tx = Serial.tx;
+    Serial.tx.clear();
+    if (tx.size() < 3 || tx.front() != 0 || tx.back() != 0)
+        return 0;
+    memcpy(reply, tx.data() + 1, tx.size() - 2);
+    size_t len = cobsDecode(reply, tx.size() - 2);
+    if (len < 4 || crc16(reply, len - 2) != (reply[len - 2] | reply[len - 1] << 8))
+        return 0;
+    return len - 2;
+}
+void roundTrip(const uint8_t *src, size_t len)
+{
+    uint8_t wire[PROTO_MAX_FRAME + PROTO_MAX_FRAME / 254 + 1];
+    size_t n = cobsEncode(src, len, wire);
+    TEST_ASSERT_LESS_OR_EQUAL(len + len / 254 + 1, n);
+    TEST_ASSERT_NULL(memchr(wire, 0, n));
+    TEST_ASSERT_EQUAL(len, cobsDecode(wire, n));
+    TEST_ASSERT_EQUAL_MEMORY(src, wire, len);
+}
+
+void setUp() { Serial.tx.clear(); }
+void tearDown() {}
+
+void test_crc16_check_value()
+{
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16((const uint8_t *)"123456789", 9));
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, crc16(NULL, 0));
+}
+
+void test_cobs_reference_vectors()
+{
+    struct
+    {
+        std::vector<uint8_t> raw, wire;
+    } cases[] = {
+        {{0x00}, {0x01, 0x01}},
+        {{0x00, 0x00}, {0x01, 0x01, 0x01}},
+        {{0x11, 0x22, 0x00, 0x33}, {0x03, 0x11, 0x22, 0x02, 0x33}},
+        {{0x11, 0x22, 0x33, 0x44}, {0x05, 0x11, 0x22, 0x33, 0x44}},
+        {{0x11, 0x00, 0x00, 0x00}, {0x02, 0x11, 0x01, 0x01, 0x01}},
+    };
+    for (auto &c : cases)
+    {
+        uint8_t wire[16];
+        TEST_ASSERT_EQUAL(c.wire.size(), cobsEncode(c.raw.data(), c.raw.size(), wire));
+        TEST_ASSERT_EQUAL_MEMORY(c.wire.data(), wire, c.wire.size());
+        TEST_ASSERT_EQUAL(c.raw.size(), cobsDecode(wire, c.wire.size()));
+        TEST_ASSERT_EQUAL_MEMORY(c.raw.data(), wire, c.raw.size());
+    }
+}
+
+void test_cobs_runs_past_254_bytes()
+{
+    uint8_t src[600];
+    for (size_t k = 0; k < sizeof(src); k++)
+        src[k] = k % 255 + 1;
+    roundTrip(src, 254);
+    roundTrip(src, 255);
+    roundTrip(src, sizeof(src));
+    src[254] = 0;
+    src[508] = 0;
+    roundTrip(src, sizeof(src));
+}
+
+void test_cobs_random_round_trips()
+{
+    srand(1);
+    uint8_t src[PROTO_MAX_FRAME];
+    for (int run = 0; run < 2000; run++)
+    {
+        size_t len = rand() % sizeof(src);
+        for (size_t k = 0; k < len; k++)
+            src[k] = rand() % 4 ? rand() : 0;
+        roundTrip(src, len);
+    }
+}
+
+void test_cobs_rejects_malformed_frames()
+{
+    uint8_t zero[] = {0x00, 0x11};
+    TEST_ASSERT_EQUAL(0, cobsDecode(zero, sizeof(zero)));
+    uint8_t overrun[] = {0x05, 0x11, 0x22};
+    TEST_ASSERT_EQUAL(0, cobsDecode(overrun, sizeof(overrun)));
+}
+
+void test_ping_is_answered()
+{
+    uint8_t wire[8], reply[PROTO_MAX_REPLY];
+    handleFrame(wire, buildFrame(wire, CMD_PING, NULL, 0));
+    TEST_ASSERT_EQUAL(2, takeReply(reply));
+    TEST_ASSERT_EQUAL_HEX8(CMD_PING | 0x80, reply[0]);
+    TEST_ASSERT_EQUAL(PROTO_OK, reply[1]);
+}
+
+void test_bad_crc_is_reported()
+{
+    uint8_t wire[8], reply[PROTO_MAX_REPLY];
+    size_t n = buildFrame(wire, CMD_PING, NULL, 0);
+    wire[n - 1] ^= 0x40;
+    handleFrame(wire, n);
+    TEST_ASSERT_EQUAL(2, takeReply(reply));
+    TEST_ASSERT_EQUAL(PROTO_BAD_CRC, reply[1]);
+}
+
+void test_runt_frames_get_no_reply()
+{
+    uint8_t wire[] = {0x02, CMD_PING};
+    handleFrame(wire, sizeof(wire));
+    TEST_ASSERT_EQUAL(0, Serial.tx.size());
+}
+
+void test_set_then_get_param_clamps_to_range()
+{
+    uint8_t wire[16], reply[PROTO_MAX_REPLY];
+    const uint8_t set[] = {P_HIT_TAIL, 200, 0, 0, 0};
+    handleFrame(wire, buildFrame(wire, CMD_SET_PARAM, set, sizeof(set)));
+    TEST_ASSERT_EQUAL(2, takeReply(reply));
+    TEST_ASSERT_EQUAL(PROTO_OK, reply[1]);
+
+    const uint8_t get[] = {P_HIT_TAIL};
+    handleFrame(wire, buildFrame(wire, CMD_GET_PARAM, get, sizeof(get)));
+    TEST_ASSERT_EQUAL(7, takeReply(reply));
+    TEST_ASSERT_EQUAL(P_HIT_TAIL, reply[2]);
+    TEST_ASSERT_EQUAL(9, reply[3] | reply[4] << 8 | reply[5] << 16 | reply[6] << 24);
+}
+
+void test_bad_requests_are_refused()
+{
+    uint8_t wire[16], reply[PROTO_MAX_REPLY];
+    const uint8_t shortSet[] = {P_HIT_RED, 1};
+    handleFrame(wire, buildFrame(wire, CMD_SET_PARAM, shortSet, sizeof(shortSet)));
+    takeReply(reply);
+    TEST_ASSERT_EQUAL(PROTO_BAD_LENGTH, reply[1]);
+
+    const uint8_t noParam[] = {P_COUNT};
+    handleFrame(wire, buildFrame(wire, CMD_GET_PARAM, noParam, sizeof(noParam)));
+    takeReply(reply);
+    TEST_ASSERT_EQUAL(PROTO_BAD_PARAM, reply[1]);
+
+    handleFrame(wire, buildFrame(wire, 0x7F, NULL, 0));
+    takeReply(reply);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, reply[0]);
+    TEST_ASSERT_EQUAL(PROTO_BAD_COMMAND, reply[1]);
+}
+
+// a recall or save is answered by presetTask, not inline; serialTask keeps
+// answering other frames meanwhile, and a second flash command is busy
+void test_preset_commands_are_answered_by_preset_task()
+{
+    std::string here = __FILE__;
+    SPIFFS.load(JSON_FILE, (here.substr(0, here.rfind("test/")) + "data/settings.json").c_str());
+    uint8_t wire[16], reply[PROTO_MAX_REPLY];
+    const uint8_t preset[] = {4};
+    handleFrame(wire, buildFrame(wire, CMD_RECALL_PRESET, preset, sizeof(preset)));
+    TEST_ASSERT_EQUAL(0, takeReply(reply));
+    handleFrame(wire, buildFrame(wire, CMD_PING, NULL, 0));
+    TEST_ASSERT_EQUAL(2, takeReply(reply));
+    handleFrame(wire, buildFrame(wire, CMD_SAVE_PRESET, preset, sizeof(preset)));
+    TEST_ASSERT_EQUAL(2, takeReply(reply));
+    TEST_ASSERT_EQUAL_HEX8(CMD_SAVE_PRESET | 0x80, reply[0]);
+    TEST_ASSERT_EQUAL(PROTO_BUSY, reply[1]);
+
+    serviceProtoJob();
+    TEST_ASSERT_EQUAL(2, takeReply(reply));
+    TEST_ASSERT_EQUAL_HEX8(CMD_RECALL_PRESET | 0x80, reply[0]);
+    TEST_ASSERT_EQUAL(PROTO_OK, reply[1]);
+    serviceProtoJob(); // nothing left
+    TEST_ASSERT_EQUAL(0, takeReply(reply));
+
+    handleFrame(wire, buildFrame(wire, CMD_SAVE_PRESET, preset, sizeof(preset)));
+    TEST_ASSERT_EQUAL(0, takeReply(reply));
+    serviceProtoJob();
+    TEST_ASSERT_EQUAL(2, takeReply(reply));
+    TEST_ASSERT_EQUAL(PROTO_OK, reply[1]);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_crc16_check_value);
+    RUN_TEST(test_cobs_reference_vectors);
+    RUN_TEST(test_cobs_runs_past_254_bytes);
+    RUN_TEST(test_cobs_random_round_trips);
+    RUN_TEST(test_cobs_rejects_malformed_frames);
+    RUN_TEST(test_ping_is_answered);
+    RUN_TEST(test_bad_crc_is_reported);
+    RUN_TEST(test_runt_frames_get_no_reply);
+    RUN_TEST(test_set_then_get_param_clamps_to_range);
+    RUN_TEST(test_bad_requests_are_refused);
+    RUN_TEST(test_preset_commands_are_answered_by_preset_task);
+    return UNITY_END();
+}
@@ -0,0 +1,183 @@
+// Hit recorder: the record format, a take recorded from dispatched hits, and
+// replay through the hit inbox on the virtual clock, standing in for
+// sensorTask by draining the inbox every millisecond.
+#include <unity.h>
+#include "main.cpp"
+
+struct Seen
+{
+    uint32_t ms;
+    uint8_t velocity;
+};
+std::vector<Seen> seen;
+
+std::string bytes(std::initializer_list<uint8_t> b) { return std::string(b.begin(), b.end()); }
+// sensorTask's pass at `now`: the inbox into dispatchHit, then the mailbox
+void sense(uint32_t now)
+{
+    dispatchInbox(now);
+    HitEvent event;
+    if (xQueueReceive(hitQueues[0], &event, 0) == pdTRUE)
+        seen.push_back({now, event.velocity});
+}
+// runs the recorder for `ms`, with a sensorTask pass every millisecond
+// (including those the recorder slept through)
+void runFor(uint32_t ms)
+{
+    uint32_t end = millis() + ms, sensed = millis();
+    while ((int32_t)(millis() - end) < 0)
+    {
+        recorder.service();
+        if (millis() == sensed)
+            shim::advanceMs(1);
+        while (sensed != millis())
+            sense(++sensed);
+    }
+}
+void recordTake(std::initializer_list<std::pair<uint32_t, uint8_t>> hits)
+{
+    requestRecorder(REC_RECORDING, 1);
+    recorder.service();
+    TEST_ASSERT_EQUAL(REC_RECORDING, recState.load());
+    uint32_t start = millis();
+    for (auto &h : hits)
+    {
+        shim::nowUs = (uint64_t)(start + h.first) * 1000;
+        dispatchHit(0, 2000, h.second, millis(), HIT_PIEZO);
+    }
+    requestRecorder(REC_IDLE, 1); // stops before the recorder drained anything
+    recorder.service();
+    TEST_ASSERT_EQUAL(REC_IDLE, recState.load());
+    xQueueReset(hitQueues[0]); // the live hits, already drawn
+}
+
+void setUp()
+{
+    SPIFFS.format();
+    seen.clear();
+    shim::nowUs = 5000000;
+    if (recQueue == NULL)
+    {
+        recQueue = xQueueCreate(REC_QUEUE, sizeof(RecHit));
+        hitInbox = xQueueCreate(HIT_INBOX, sizeof(QueuedHit));
+        hitQueues[0] = xQueueCreate(1, sizeof(HitEvent));
+    }
+    xQueueReset(hitInbox);
+    xQueueReset(hitQueues[0]);
+    requestRecorder(REC_IDLE, 1);
+    recorder.service();
+}
+void tearDown() {}
+
+void test_pack_records_time_deltas()
+{
+    File file = SPIFFS.open("/pack", FILE_WRITE);
+    uint8_t batch[REC_BATCH];
+    size_t used = 0;
+    uint32_t last = 1000;
+    recPack(file, batch, used, last, {0, 90, 1250});
+    recPack(file, batch, used, last, {3, 40, 1250});
+    TEST_ASSERT_EQUAL(8, used);
+    TEST_ASSERT_EQUAL_MEMORY(bytes({250, 0, 0, 90, 0, 0, 3, 40}).data(), batch, 8);
+    TEST_ASSERT_EQUAL(1250, last);
+}
+
+void test_pack_splits_long_gaps()
+{
+    File file = SPIFFS.open("/pack", FILE_WRITE);
+    uint8_t batch[REC_BATCH];
+    size_t used = 0;
+    uint32_t last = 0;
+    recPack(file, batch, used, last, {1, 100, 2 * 65535 + 10});
+    TEST_ASSERT_EQUAL(12, used);
+    TEST_ASSERT_EQUAL_MEMORY(bytes({0xFF, 0xFF, REC_GAP, 0, 0xFF, 0xFF, REC_GAP, 0, 10, 0, 1, 100}).data(), batch, 12);
+}
+
+void test_pack_writes_full_batches()
+{
+    File file = SPIFFS.open("/pack", FILE_WRITE);
+    uint8_t batch[REC_BATCH];
+    size_t used = 0;
+    uint32_t last = 0;
+    for (uint32_t k = 1; k <= REC_BATCH / 4 + 1; k++)
+        recPack(file, batch, used, last, {0, 1, k});
+    TEST_ASSERT_EQUAL(REC_BATCH, file.size());
+    TEST_ASSERT_EQUAL(4, used);
+}
+
+void test_a_take_keeps_hits_queued_at_stop()
+{
+    recordTake({{100, 80}, {350, 60}, {600, 127}});
+    std::string take = SPIFFS.contents(REC_FILE);
+    TEST_ASSERT_TRUE(take == "HREC" + bytes({100, 0, 0, 80, 250, 0, 0, 60, 250, 0, 0, 127}));
+    TEST_ASSERT_EQUAL(3, recEvents.load());
+}
+
+void test_replay_plays_at_the_recorded_times()
+{
+    recordTake({{100, 80}, {350, 60}, {600, 127}});
+    uint32_t start = millis();
+    requestRecorder(REC_REPLAYING, 1);
+    runFor(1000);
+    TEST_ASSERT_EQUAL(REC_IDLE, recState.load());
+    TEST_ASSERT_EQUAL(3, seen.size());
+    uint32_t want[] = {100, 350, 600};
+    uint8_t velocity[] = {80, 60, 127};
+    for (int k = 0; k < 3; k++)
+    {
+        TEST_ASSERT_UINT_WITHIN(2, want[k], seen[k].ms - start);
+        TEST_ASSERT_EQUAL(velocity[k], seen[k].velocity);
+    }
+    // replayed hits are not recorded again, and count as played
+    TEST_ASSERT_EQUAL(0, uxQueueMessagesWaiting(recQueue));
+    TEST_ASSERT_EQUAL(3, recEvents.load());
+}
+
+void test_replay_speed_scales_the_gaps()
+{
+    recordTake({{100, 80}, {500, 60}});
+    uint32_t start = millis();
+    requestRecorder(REC_REPLAYING, 4);
+    runFor(400);
+    TEST_ASSERT_EQUAL(2, seen.size());
+    TEST_ASSERT_UINT_WITHIN(2, 25, seen[0].ms - start);
+    TEST_ASSERT_UINT_WITHIN(2, 125, seen[1].ms - start);
+}
+
+void test_replay_waits_for_a_full_inbox()
+{
+    std::initializer_list<std::pair<uint32_t, uint8_t>> burst = {
+        {10, 1}, {10, 2}, {10, 3}, {10, 4}, {10, 5}, {10, 6}, {10, 7}, {10, 8}, {10, 9}, {10, 10}};
+    recordTake(burst);
+    requestRecorder(REC_REPLAYING, 0);
+    // sensorTask stalls: the recorder fills the inbox and keeps retrying
+    for (int k = 0; k < 40; k++)
+        recorder.service();
+    TEST_ASSERT_EQUAL(HIT_INBOX, uxQueueMessagesWaiting(hitInbox));
+    TEST_ASSERT_EQUAL(REC_REPLAYING, recState.load());
+    runFor(100);
+    TEST_ASSERT_EQUAL(10, recEvents.load());
+    TEST_ASSERT_EQUAL(REC_IDLE, recState.load());
+}
+
+void test_replay_needs_a_take()
+{
+    SPIFFS.put(REC_FILE, "NOPE", 4);
+    requestRecorder(REC_REPLAYING, 1);
+    recorder.service();
+    TEST_ASSERT_EQUAL(REC_IDLE, recState.load());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_pack_records_time_deltas);
+    RUN_TEST(test_pack_splits_long_gaps);
+    RUN_TEST(test_pack_writes_full_batches);
+    RUN_TEST(test_a_take_keeps_hits_queued_at_stop);
+    RUN_TEST(test_replay_plays_at_the_recorded_times);
+    RUN_TEST(test_replay_speed_scales_the_gaps);
+    RUN_TEST(test_replay_waits_for_a_full_inbox);
+    RUN_TEST(test_replay_needs_a_take);
+    return UNITY_END();
+}
@@ -0,0 +1,94 @@
+// Scheduling plan: the tasks setup() and bootTask create, checked against the
+// plan's invariants, and the hit path checked for never waiting on storage.
+#include <unity.h>
+#include "main.cpp"
+
+const shim::CreatedTask *findTask(TaskFunction_t fn)
+{
+    for (const shim::CreatedTask &t : shim::tasks)
+        if (t.fn == fn)
+            return &t;
+    return NULL;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_boot_creates_every_task()
+{
+    setup();
+    bootTask(NULL);
+    TaskFunction_t expected[] = {sensorTask, ledTask, ledOutputTask, audioTask, buttonTask,
+                                 oledTask, presetTask, serialTask, recorderTask};
+    for (TaskFunction_t fn : expected)
+        TEST_ASSERT_NOT_NULL(findTask(fn));
+    int leds = 0;
+    for (const shim::CreatedTask &t : shim::tasks)
+        leds += t.fn == ledTask;
+    TEST_ASSERT_EQUAL(NUM_PADS, leds);
+    TEST_ASSERT_NOT_NULL(ledOutput.task); // one show() per frame for all of them
+}
+
+void test_detection_preempts_rendering_on_one_core()
+{
+    const shim::CreatedTask *sense = findTask(sensorTask);
+    for (const shim::CreatedTask &t : shim::tasks)
+    {
+        if (t.fn != ledTask && t.fn != ledOutputTask)
+            continue;
+        TEST_ASSERT_EQUAL(sense->core, t.core);
+        TEST_ASSERT_GREATER_THAN(t.priority, sense->priority);
+    }
+}
+
+void test_ui_and_storage_stay_off_the_hit_core()
+{
+    const shim::CreatedTask *sense = findTask(sensorTask);
+    TaskFunction_t background[] = {buttonTask, oledTask, serialTask, presetTask, recorderTask, bootTask, audioTask};
+    for (TaskFunction_t fn : background)
+    {
+        const shim::CreatedTask *t = findTask(fn);
+        TEST_ASSERT_NOT_NULL(t);
+        TEST_ASSERT_NOT_EQUAL(sense->core, t->core);
+        TEST_ASSERT_LESS_THAN_MESSAGE(RENDER_TASK_PRIORITY, t->priority, t->name.c_str());
+    }
+    // persistence below the UI, so a save never delays a redraw
+    TEST_ASSERT_LESS_THAN(findTask(oledTask)->priority, findTask(presetTask)->priority);
+    TEST_ASSERT_LESS_THAN(findTask(buttonTask)->priority, findTask(recorderTask)->priority);
+    for (const shim::CreatedTask &t : shim::tasks)
+        TEST_ASSERT_LESS_THAN(configMAX_PRIORITIES, t.priority);
+}
+
+// a SPIFFS write holds the storage lock for tens of ms; a hit landing
+// meanwhile must reach the renderer and MIDI out without touching it
+void test_hit_during_a_save_does_not_wait()
+{
+    Serial2.tx.clear();
+    xQueueReset(hitQueues[0]);
+    recState.store(REC_RECORDING); // the recorder path too
+    uint32_t blocked = shim::blockedTakes;
+    {
+        StorageLock lock;
+        dispatchHit(0, 3000, 110, millis(), HIT_PIEZO);
+        TEST_ASSERT_EQUAL(blocked, shim::blockedTakes);
+    }
+    recState.store(REC_IDLE);
+    HitEvent event;
+    TEST_ASSERT_TRUE(xQueueReceive(hitQueues[0], &event, 0) == pdTRUE);
+    TEST_ASSERT_EQUAL(110, event.velocity);
+    TEST_ASSERT_EQUAL(3, Serial2.tx.size());
+    // the lock itself is real: a second taker would have waited
+    StorageLock first;
+    StorageLock second;
+    TEST_ASSERT_EQUAL(blocked + 1, shim::blockedTakes);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_boot_creates_every_task);
+    RUN_TEST(test_detection_preempts_rendering_on_one_core);
+    RUN_TEST(test_ui_and_storage_stay_off_the_hit_core);
+    RUN_TEST(test_hit_during_a_save_does_not_wait);
+    return UNITY_END();
+}
@@ -0,0 +1,238 @@
+// Effect VM: the verifier, each group of ops, the edge cases that are
+// undefined in C (run under UBSan in CI), faults, the per-frame budget, the
+// shipped programs and the double-buffered slots.
+#include <unity.h>
+#include "main.cpp"
+
+uint32_t palette[256];
+VmInputs in;
+
+VmProgram program(std::initializer_list<uint8_t> code, uint16_t duration = 0)
+{
+    VmProgram prog = {};
+    prog.duration = duration;
+    for (uint8_t byte : code)
+        prog.code[prog.length++] = byte;
+    return prog;
+}
+uint32_t run(std::initializer_list<uint8_t> code, int32_t index = 0)
+{
+    VmProgram prog = program(code);
+    TEST_ASSERT_TRUE(vmVerify(prog));
+    int32_t budget = VM_MAX_OPS_PER_FRAME;
+    return vmRun(prog, in, index, budget);
+}
+// a constant INT32_MIN on the stack
+#define PUSH_MIN OP_PUSH8, 1, OP_PUSH8, 31, OP_SHL
+
+void setUp()
+{
+    for (int k = 0; k < 256; k++)
+        palette[k] = k * 0x010101;
+    in = {1234, 14, 100, 128, 0x123456, 10, 20, 30, palette};
+    vmFaults.store(0);
+    vmOverruns.store(0);
+}
+void tearDown() {}
+
+void test_verify_rejects_what_the_interpreter_would_trust()
+{
+    TEST_ASSERT_TRUE(vmVerify(program({OP_PUSH8, 1, OP_JZ, 0, OP_END})));
+    TEST_ASSERT_TRUE(vmVerify(program({OP_PUSH8, 0, OP_JZ, 1, OP_DUP}))); // lands on the end
+    TEST_ASSERT_FALSE(vmVerify(program({OP_PUSH8, 0, OP_JZ, 2, OP_DUP})));
+    TEST_ASSERT_FALSE(vmVerify(program({OP_PUSH16, 1})));
+    TEST_ASSERT_FALSE(vmVerify(program({OP_LD, VM_REGS})));
+    TEST_ASSERT_FALSE(vmVerify(program({OP_ST, 0xFF})));
+    TEST_ASSERT_FALSE(vmVerify(program({0x0F})));
+    TEST_ASSERT_FALSE(vmVerify(program({OP_PAL + 1})));
+    TEST_ASSERT_FALSE(vmVerify(program({OP_JMP})));
+}
+
+void test_inputs_and_stack_ops()
+{
+    TEST_ASSERT_EQUAL(1234, run({OP_T}));
+    TEST_ASSERT_EQUAL(7, run({OP_I}, 7));
+    TEST_ASSERT_EQUAL(14, run({OP_N}));
+    TEST_ASSERT_EQUAL(60, run({OP_BASS, OP_MID, OP_HIGH, OP_ADD, OP_ADD}));
+    TEST_ASSERT_EQUAL_HEX32(0x123456, run({OP_COLOR}));
+    TEST_ASSERT_EQUAL(228, run({OP_V, OP_BEAT, OP_ADD}));
+    TEST_ASSERT_EQUAL(3, run({OP_PUSH8, 3, OP_PUSH8, 5, OP_SWAP}));
+    TEST_ASSERT_EQUAL(3, run({OP_PUSH8, 3, OP_PUSH8, 5, OP_OVER}));
+    TEST_ASSERT_EQUAL(3, run({OP_PUSH8, 3, OP_PUSH8, 5, OP_DROP}));
+    TEST_ASSERT_EQUAL(42, run({OP_PUSH8, 42, OP_ST, 7, OP_PUSH8, 1, OP_LD, 7}));
+    TEST_ASSERT_EQUAL(0x4321, run({OP_PUSH16, 0x21, 0x43}));
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({OP_PUSH8, 0xFF})); // -1, as a colour
+}
+
+void test_arithmetic()
+{
+    TEST_ASSERT_EQUAL(4, run({OP_PUSH8, 7, OP_PUSH8, 3, OP_SUB}));
+    TEST_ASSERT_EQUAL(21, run({OP_PUSH8, 7, OP_PUSH8, 3, OP_MUL}));
+    TEST_ASSERT_EQUAL(2, run({OP_PUSH8, 7, OP_PUSH8, 3, OP_DIV}));
+    TEST_ASSERT_EQUAL(1, run({OP_PUSH8, 7, OP_PUSH8, 3, OP_MOD}));
+    TEST_ASSERT_EQUAL(0xFFFFFE, run({OP_PUSH8, (uint8_t)-7, OP_PUSH8, 3, OP_DIV})); // -2, truncated
+    TEST_ASSERT_EQUAL(64, run({OP_PUSH16, 0x00, 0x01, OP_PUSH8, 64, OP_MULQ}));
+    TEST_ASSERT_EQUAL(5, run({OP_PUSH8, (uint8_t)-5, OP_ABS}));
+    TEST_ASSERT_EQUAL(5, run({OP_PUSH8, (uint8_t)-5, OP_NEG}));
+    TEST_ASSERT_EQUAL(3, run({OP_PUSH8, 3, OP_PUSH8, 9, OP_MIN}));
+    TEST_ASSERT_EQUAL(9, run({OP_PUSH8, 3, OP_PUSH8, 9, OP_MAX}));
+    TEST_ASSERT_EQUAL(0x0E, run({OP_PUSH8, 0x0C, OP_PUSH8, 0x06, OP_XOR, OP_PUSH8, 0x0C, OP_OR}));
+    TEST_ASSERT_EQUAL(4, run({OP_PUSH8, 0x0C, OP_PUSH8, 0x06, OP_AND}));
+    TEST_ASSERT_EQUAL(40, run({OP_PUSH8, 5, OP_PUSH8, 3, OP_SHL}));
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({OP_PUSH8, (uint8_t)-8, OP_PUSH8, 3, OP_SHR})); // arithmetic
+}
+
+void test_comparisons_and_jumps()
+{
+    TEST_ASSERT_EQUAL(1, run({OP_PUSH8, 2, OP_PUSH8, 3, OP_LT}));
+    TEST_ASSERT_EQUAL(0, run({OP_PUSH8, 2, OP_PUSH8, 3, OP_GT}));
+    TEST_ASSERT_EQUAL(1, run({OP_PUSH8, 3, OP_PUSH8, 3, OP_EQ}));
+    TEST_ASSERT_EQUAL(1, run({OP_PUSH8, 0, OP_NOT}));
+    // index < 5 ? 10 : 20
+    std::initializer_list<uint8_t> pick = {OP_I, OP_PUSH8, 5, OP_LT, OP_JZ, 4, OP_PUSH8, 10, OP_JMP, 2, OP_PUSH8, 20};
+    TEST_ASSERT_EQUAL(10, run(pick, 2));
+    TEST_ASSERT_EQUAL(20, run(pick, 9));
+    TEST_ASSERT_EQUAL(7, run({OP_PUSH8, 7, OP_END, OP_PUSH8, 8}));
+}
+
+void test_colour_ops()
+{
+    TEST_ASSERT_EQUAL_HEX32(0xFF007F, run({OP_PUSH16, 0x00, 0x01, OP_PUSH8, (uint8_t)-4, OP_PUSH8, 0x7F, OP_RGB}));
+    TEST_ASSERT_EQUAL_HEX32(0x402010, run({OP_PUSH16, 0x20, 0x80, OP_PUSH8, 0x40, OP_PUSH8, 0x20, OP_PUSH8, 0x10, OP_RGB, OP_SWAP, OP_DROP}));
+    TEST_ASSERT_EQUAL_HEX32(0x7F7F7F, run({OP_PUSH16, 0xFF, 0x00, OP_DUP, OP_DUP, OP_RGB, OP_PUSH8, 127, OP_SCALE}));
+    TEST_ASSERT_EQUAL_HEX32(0x050505, run({OP_PUSH16, 0x05, 0x01, OP_PAL}));
+    TEST_ASSERT_EQUAL_HEX32(Adafruit_NeoPixel::gamma32(Adafruit_NeoPixel::ColorHSV(0x5555, 255, 255)),
+                            run({OP_PUSH16, 0x55, 0x55, OP_PUSH16, 0xFF, 0x00, OP_PUSH16, 0x2C, 0x01, OP_HSV}));
+    TEST_ASSERT_EQUAL(Adafruit_NeoPixel::sine8(64), run({OP_PUSH8, 64, OP_SIN8}));
+    TEST_ASSERT_EQUAL(255 - 44, run({OP_PUSH16, 0x2C, 0x01, OP_TRI8}));
+    TEST_ASSERT_EQUAL(255, run({OP_PUSH16, 0x2C, 0x01, OP_CLAMP8}));
+    TEST_ASSERT_EQUAL(0, run({OP_PUSH8, (uint8_t)-1, OP_CLAMP8}));
+}
+
+// each of these is undefined behaviour in plain int32 C; the VM wraps
+void test_edge_cases_wrap_instead_of_trapping()
+{
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({PUSH_MIN, OP_PUSH8, 31, OP_SHR}));                        // INT32_MIN itself
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({PUSH_MIN, OP_PUSH8, (uint8_t)-1, OP_DIV, OP_PUSH8, 31, OP_SHR})); // / -1 stays INT32_MIN
+    TEST_ASSERT_EQUAL(0, run({PUSH_MIN, OP_PUSH8, (uint8_t)-1, OP_MOD}));
+    TEST_ASSERT_EQUAL(0, run({OP_PUSH8, 7, OP_PUSH8, 0, OP_DIV}));
+    TEST_ASSERT_EQUAL(0, run({OP_PUSH8, 7, OP_PUSH8, 0, OP_MOD}));
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({PUSH_MIN, OP_NEG, OP_PUSH8, 31, OP_SHR}));
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({PUSH_MIN, OP_ABS, OP_PUSH8, 31, OP_SHR}));
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({PUSH_MIN, OP_PUSH8, 1, OP_SUB, OP_PUSH8, 31, OP_SHL, OP_PUSH8, 31, OP_SHR}));
+    TEST_ASSERT_EQUAL(0, run({PUSH_MIN, OP_DUP, OP_ADD}));
+    TEST_ASSERT_EQUAL(1, run({OP_PUSH16, 0xFF, 0x7F, OP_DUP, OP_MUL, OP_DUP, OP_MUL, OP_PUSH8, 1, OP_AND}));
+    TEST_ASSERT_EQUAL(0, run({PUSH_MIN, OP_DUP, OP_MULQ, OP_PUSH8, 0, OP_AND}));
+    TEST_ASSERT_EQUAL(2, run({OP_PUSH8, 1, OP_PUSH8, 33, OP_SHL}));  // shift counts wrap at 32
+    TEST_ASSERT_EQUAL(0xFFFFFF, run({OP_PUSH8, (uint8_t)-1, OP_PUSH8, 40, OP_SHL, OP_PUSH8, 8, OP_SHR}));
+    TEST_ASSERT_EQUAL(0, vmFaults.load());
+}
+
+void test_stack_faults_are_caught()
+{
+    VmProgram deep = {};
+    for (int k = 0; k < VM_STACK; k++)
+    {
+        deep.code[deep.length++] = OP_PUSH8;
+        deep.code[deep.length++] = k;
+    }
+    int32_t budget = VM_MAX_OPS_PER_FRAME;
+    TEST_ASSERT_EQUAL(VM_STACK - 1, vmRun(deep, in, 0, budget)); // 16 deep is fine
+    deep.code[deep.length++] = OP_DUP;
+    TEST_ASSERT_EQUAL(0, vmRun(deep, in, 0, budget));
+    TEST_ASSERT_EQUAL(1, vmFaults.load());
+
+    TEST_ASSERT_EQUAL(0, run({OP_ADD}));
+    TEST_ASSERT_EQUAL(0, run({OP_DROP}));
+    TEST_ASSERT_EQUAL(0, run({OP_PUSH8, 1, OP_RGB}));
+    TEST_ASSERT_EQUAL(0, run({OP_ST, 0}));
+    TEST_ASSERT_EQUAL(5, vmFaults.load());
+    TEST_ASSERT_EQUAL(0, run({}));
+}
+
+void test_frame_budget_caps_the_work()
+{
+    // PUSH8 1, then DUP DROP pairs: 199 ops a pixel
+    VmProgram slow = program({OP_PUSH8, 1});
+    for (int k = 0; k < 198; k++)
+        slow.code[slow.length++] = k & 1 ? OP_DROP : OP_DUP;
+    int32_t budget = VM_MAX_OPS_PER_FRAME;
+    int lit = 0;
+    for (int i = 0; i < 200; i++)
+        lit += vmRun(slow, in, i, budget) != 0;
+    TEST_ASSERT_EQUAL(VM_MAX_OPS_PER_FRAME / 199, lit);
+    TEST_ASSERT_LESS_THAN(0, budget);
+
+    static uint8_t pixels[200 * 3];
+    LedSegment strip;
+    strip.attachBuffer(pixels, 200);
+    vmRender(strip, slow, in);
+    TEST_ASSERT_EQUAL(1, vmOverruns.load());
+    TEST_ASSERT_EQUAL(1, strip.getPixelColor(0));
+    TEST_ASSERT_EQUAL(0, strip.getPixelColor(199));
+}
+
+void test_shipped_programs_load_and_run()
+{
+    const char *files[] = {"data/fx/plasma.fxb", "data/fx/ripple.fxb"};
+    static uint8_t pixels[PAD_LEDS * 3];
+    LedSegment strip;
+    strip.attachBuffer(pixels, PAD_LEDS);
+    for (const char *file : files)
+    {
+        std::string here = __FILE__;
+        std::string path = here.substr(0, here.rfind("test/")) + file;
+        TEST_ASSERT_TRUE_MESSAGE(SPIFFS.load("/prog.fxb", path.c_str()), file);
+        VmProgram prog;
+        TEST_ASSERT_TRUE_MESSAGE(vmReadProgram("/prog.fxb", prog), file);
+        for (int32_t t = 0; t < 2000; t += 40)
+        {
+            in.time = t;
+            vmRender(strip, prog, in);
+        }
+        TEST_ASSERT_EQUAL(0, vmFaults.load());
+        TEST_ASSERT_EQUAL(0, vmOverruns.load());
+    }
+    const uint8_t bad[] = {'F', 'X', 'B', '2', 0, 0, 1, 0, OP_T};
+    SPIFFS.put("/bad.fxb", bad, sizeof(bad));
+    VmProgram prog;
+    TEST_ASSERT_FALSE(vmReadProgram("/bad.fxb", prog));
+    const uint8_t truncated[] = {'F', 'X', 'B', '1', 0, 0, 4, 0, OP_T};
+    SPIFFS.put("/short.fxb", truncated, sizeof(truncated));
+    TEST_ASSERT_FALSE(vmReadProgram("/short.fxb", prog));
+}
+
+void test_a_pinned_program_survives_two_loads()
+{
+    VmProgram a = program({OP_PUSH8, 1}), b = program({OP_PUSH8, 2}), c = program({OP_PUSH8, 3});
+    vmPublish(VM_BASE, &a);
+    const VmProgram *running = vmPin(VM_BASE);
+    vmPublish(VM_BASE, &b);
+    TEST_ASSERT_EQUAL(1, running->code[1]);
+    // the idle copy is now `running`; a third load must wait for it, so
+    // release it first as the frame would
+    vmUnpin(VM_BASE, running);
+    vmPublish(VM_BASE, &c);
+    const VmProgram *now = vmPin(VM_BASE);
+    TEST_ASSERT_EQUAL(3, now->code[1]);
+    vmUnpin(VM_BASE, now);
+    TEST_ASSERT_EQUAL(0, vmPins[VM_BASE][0].load() + vmPins[VM_BASE][1].load());
+    vmPublish(VM_BASE, NULL);
+    TEST_ASSERT_NULL(vmPin(VM_BASE));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_verify_rejects_what_the_interpreter_would_trust);
+    RUN_TEST(test_inputs_and_stack_ops);
+    RUN_TEST(test_arithmetic);
+    RUN_TEST(test_comparisons_and_jumps);
+    RUN_TEST(test_colour_ops);
+    RUN_TEST(test_edge_cases_wrap_instead_of_trapping);
+    RUN_TEST(test_stack_faults_are_caught);
+    RUN_TEST(test_frame_budget_caps_the_work);
+    RUN_TEST(test_shipped_programs_load_and_run);
+    RUN_TEST(test_a_pinned_program_survives_two_loads);
+    return UNITY_END();
+}
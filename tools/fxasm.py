@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Assemble an effect program (.fxa) into the .fxb format loaded by main.cpp.
+
+    python tools/fxasm.py tools/fx/plasma.fxa data/fx/plasma.fxb
+
+One instruction per line, ';' starts a comment, 'name:' defines a label for
+jz/jmp (forward only), '.duration 600' sets the hit effect length in ms.
+"""
+import struct
+import sys
+
+OPS = {
+    "end": 0x00, "push": None, "dup": 0x03, "drop": 0x04, "swap": 0x05,
+    "over": 0x06, "ld": 0x07, "st": 0x08,
+    "t": 0x10, "i": 0x11, "n": 0x12, "v": 0x13, "beat": 0x14, "color": 0x15,
+    "bass": 0x16, "mid": 0x17, "high": 0x18,
+    "add": 0x20, "sub": 0x21, "mul": 0x22, "div": 0x23, "mod": 0x24,
+    "mulq": 0x25, "neg": 0x26, "abs": 0x27, "min": 0x28, "max": 0x29,
+    "and": 0x2A, "or": 0x2B, "xor": 0x2C, "shl": 0x2D, "shr": 0x2E,
+    "lt": 0x30, "gt": 0x31, "eq": 0x32, "not": 0x33,
+    "jz": 0x38, "jmp": 0x39,
+    "sin8": 0x40, "tri8": 0x41, "clamp8": 0x42,
+    "rgb": 0x48, "hsv": 0x49, "scale": 0x4A, "pal": 0x4B,
+}
+MAX_CODE = 256
+
+
+def assemble(lines):
+    duration = 0
+    code = bytearray()
+    labels = {}
+    fixups = []
+    for number, line in enumerate(lines, 1):
+        line = line.split(";")[0].strip()
+        if not line:
+            continue
+        if line.endswith(":"):
+            labels[line[:-1]] = len(code)
+            continue
+        words = line.split()
+        op = words[0].lower()
+        if op == ".duration":
+            duration = int(words[1], 0)
+        elif op == "push":
+            value = int(words[1], 0)
+            if -128 <= value <= 127:
+                code += struct.pack("<Bb", 0x01, value)
+            elif -32768 <= value <= 32767:
+                code += struct.pack("<Bh", 0x02, value)
+            else:
+                sys.exit(f"line {number}: {value} does not fit in 16 bits")
+        elif op in ("ld", "st"):
+            reg = int(words[1].lstrip("r"))
+            if not 0 <= reg < 8:
+                sys.exit(f"line {number}: no register {words[1]}")
+            code += bytes([OPS[op], reg])
+        elif op in ("jz", "jmp"):
+            code += bytes([OPS[op], 0])
+            fixups.append((len(code) - 1, words[1], number))
+        elif op in OPS:
+            code.append(OPS[op])
+        else:
+            sys.exit(f"line {number}: unknown instruction {words[0]}")
+    for at, label, number in fixups:
+        if label not in labels:
+            sys.exit(f"line {number}: unknown label {label}")
+        offset = labels[label] - (at + 1)
+        if not 0 <= offset <= 255:
+            sys.exit(f"line {number}: jump to {label} must be forward and within 255 bytes")
+        code[at] = offset
+    if len(code) > MAX_CODE:
+        sys.exit(f"program is {len(code)} bytes, limit is {MAX_CODE}")
+    return b"FXB1" + struct.pack("<HH", duration, len(code)) + bytes(code)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    with open(sys.argv[1]) as source:
+        program = assemble(source.readlines())
+    with open(sys.argv[2], "wb") as output:
+        output.write(program)
+    print(f"{sys.argv[2]}: {len(program) - 8} bytes of code")
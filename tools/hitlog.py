@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+"""Dump a hit recording (take.hit, see recorderTask in main.cpp) as CSV.
+
+    python tools/hitlog.py take.hit > take.csv
+
+Prints "ms,pad,velocity" per hit, then a per-pad summary on stderr.
+"""
+import struct
+import sys
+
+REC_GAP = 0xFF
+
+
+def read_hits(data):
+    if data[:4] != b"HREC":
+        sys.exit("not a hit recording")
+    ms = 0
+    for offset in range(4, len(data) - 3, 4):
+        dt, pad, velocity = struct.unpack_from("<HBB", data, offset)
+        ms += dt
+        if pad != REC_GAP:
+            yield ms, pad, velocity
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1], "rb") as log:
+        hits = list(read_hits(log.read()))
+    print("ms,pad,velocity")
+    for hit in hits:
+        print("%d,%d,%d" % hit)
+    pads = {}
+    for _, pad, velocity in hits:
+        pads.setdefault(pad, []).append(velocity)
+    length = hits[-1][0] / 1000 if hits else 0
+    print(f"{len(hits)} hits over {length:.1f} s", file=sys.stderr)
+    for pad in sorted(pads):
+        v = pads[pad]
+        print(f"pad {pad}: {len(v)} hits, velocity {min(v)}-{max(v)}, mean {sum(v) / len(v):.0f}", file=sys.stderr)